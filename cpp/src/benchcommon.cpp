@@ -0,0 +1,145 @@
+#include <fstream>
+#include <iterator>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include "benchcommon.h"
+#include "config.h"
+#include "events.h"
+#include "cmds.h"
+
+using namespace std;
+
+string randomPlayerAddress()
+{
+    static const char hexChars[] = "0123456789abcdef";
+    string address = "0x";
+    for (int i = 0; i < 40; i++)
+    {
+        address += hexChars[rand() % 16];
+    }
+    return address;
+}
+
+vector2f randomPosNear(vector2f center, float radius)
+{
+    return center + randomVectorWithMagnitudeRange(0, radius);
+}
+
+void fillSyntheticGame(Game *game, unsigned int numEntities, unsigned int numPlayers)
+{
+    for (unsigned int i = 0; i < numPlayers; i++)
+    {
+        PlayerJoinedEvent(randomPlayerAddress()).execute(game);
+        BalanceUpdateEvent(game->players.size() - 1, 1000000000, true).execute(game);
+    }
+    game->startMatch();
+
+    float worldRadius = SPACE_BETWEEN_SPAWNS * numPlayers;
+    while (game->entities.size() < numEntities)
+    {
+        int ownerId = rand() % numPlayers;
+        vector2f pos = randomPosNear(vector2f(0, 0), worldRadius);
+
+        switch (rand() % 3)
+        {
+        case 0:
+        {
+            boost::shared_ptr<Prime> prime(new Prime(game, game->getNextEntityRef(), ownerId, pos));
+            prime->completeBuildingInstantly(&game->players[ownerId].credit);
+            prime->cmdMove(randomPosNear(pos, 500));
+            game->entities.push_back(prime);
+            break;
+        }
+        case 1:
+        {
+            boost::shared_ptr<Fighter> fighter(new Fighter(game, game->getNextEntityRef(), ownerId, pos));
+            fighter->completeBuildingInstantly(&game->players[ownerId].credit);
+            fighter->cmdMove(randomPosNear(pos, 500));
+            game->entities.push_back(fighter);
+            break;
+        }
+        case 2:
+        {
+            boost::shared_ptr<GoldPile> goldPile(new GoldPile(game, game->getNextEntityRef(), pos));
+            goldPile->gold.createMoreByFiat(1 + rand() % 10000);
+            game->entities.push_back(goldPile);
+            break;
+        }
+        }
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        game->iterate();
+    }
+}
+
+FrameEventsPacket makeSyntheticFramePacket(Game *game, unsigned int numCmds, unsigned int unitsPerCmd)
+{
+    vector<boost::shared_ptr<AuthdCmd>> authdCmds;
+    for (unsigned int i = 0; i < numCmds; i++)
+    {
+        vector<EntityRef> unitRefs;
+        for (unsigned int j = 0; j < unitsPerCmd; j++)
+        {
+            unitRefs.push_back(1 + rand() % game->entities.size());
+        }
+
+        boost::shared_ptr<Cmd> cmd;
+        switch (rand() % 3)
+        {
+        case 0:
+            cmd = boost::shared_ptr<Cmd>(new MoveCmd(unitRefs, randomPosNear(vector2f(0, 0), 1000)));
+            break;
+        case 1:
+            cmd = boost::shared_ptr<Cmd>(new AttackCmd(unitRefs, 1 + rand() % game->entities.size()));
+            break;
+        case 2:
+            cmd = boost::shared_ptr<Cmd>(new PickupCmd(unitRefs, 1 + rand() % game->entities.size()));
+            break;
+        }
+
+        uint8_t playerId = rand() % game->players.size();
+        authdCmds.push_back(boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, playerId)));
+    }
+
+    return FrameEventsPacket(game->frame, authdCmds, vector<boost::shared_ptr<Event>>());
+}
+
+vch loadFileToVch(string filename)
+{
+    ifstream file(filename, ios::binary);
+    if (!file.is_open())
+        throw runtime_error("Couldn't open " + filename);
+
+    return vch(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+atomic<uint64_t> allocationCount(0);
+
+uint64_t getAllocationCount()
+{
+    return allocationCount.load();
+}
+
+void *operator new(size_t size)
+{
+    allocationCount++;
+    if (void *p = malloc(size == 0 ? 1 : size))
+        return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t size) noexcept
+{
+    free(p);
+}
@@ -0,0 +1,30 @@
+#include <chrono>
+#include <string>
+#include "engine.h"
+#include "packets.h"
+
+#ifndef BENCHCOMMON_H
+#define BENCHCOMMON_H
+
+using namespace std;
+
+// Helpers shared by the benchmark binaries (see `make bench`).
+
+string randomPlayerAddress();
+
+// Fills an empty game with numPlayers funded players, starts the match,
+// then adds a mix of Primes, Fighters and GoldPiles until there are numEntities,
+// and runs a few frames so units are mid-move.
+void fillSyntheticGame(Game *game, unsigned int numEntities, unsigned int numPlayers);
+
+// A frame's worth of cmds from random players of the game, of a mix of types.
+FrameEventsPacket makeSyntheticFramePacket(Game *game, unsigned int numCmds, unsigned int unitsPerCmd);
+
+vch loadFileToVch(string filename);
+
+double secondsSince(chrono::steady_clock::time_point start);
+
+// Number of heap allocations made so far by the process (benchcommon replaces operator new to count them).
+uint64_t getAllocationCount();
+
+#endif // BENCHCOMMON_H
@@ -6,6 +6,7 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <vector>
+#include <deque>
 #include <string>
 #include "config.h"
 #include "cmds.h"
@@ -15,6 +16,10 @@
 #include "input.h"
 #include "packets.h"
 #include "events.h"
+#include "snapshots.h"
+#include "compression.h"
+#include "framescheduler.h"
+#include "jitterbuffer.h"
 
 using namespace std;
 using namespace boost::asio::ip;
@@ -23,13 +28,20 @@ Game game;
 
 UI ui;
 
-vector<FrameEventsPacket> receivedFrameCmdsPackets;
+// frames from the server, held a little while to smooth out network jitter
+JitterBuffer receivedFrames;
 vector<Game> receivedResyncs;
+// cmds announced by frames received so far, waiting for the frame they execute on
+CmdSchedule cmdSchedule;
+
+// snapshots of our own game, which the server can send a delta resync against
+SnapshotHistory snapshotHistory;
 
 void clearVchAndBuildCmdPacket(vch *dest, boost::shared_ptr<Cmd> cmd)
 {
     dest->clear();
 
+    packTypechar(dest, CLIENT_PACKET_CMD_CHAR);
     packTypechar(dest, cmd->getTypechar());
     cmd->pack(dest);
 
@@ -38,6 +50,18 @@ void clearVchAndBuildCmdPacket(vch *dest, boost::shared_ptr<Cmd> cmd)
 
     dest->insert(dest->begin(), prepended.begin(), prepended.end());
 }
+void clearVchAndBuildClientPacket(vch *dest, Packet *packet)
+{
+    dest->clear();
+
+    packTypechar(dest, packet->typechar());
+    packet->pack(dest);
+
+    vch prepended;
+    packToVch(&prepended, "H", (uint16_t)(dest->size()));
+
+    dest->insert(dest->begin(), prepended.begin(), prepended.end());
+}
 
 class ConnectionHandler
 {
@@ -45,14 +69,45 @@ class ConnectionHandler
     boost::asio::io_service &ioService;
     tcp::socket &socket;
 
-    vector<vch *> packetsToSend;
-    bool sending;
+    // everything queued goes out in one gather write; the first numPacketsSending are in flight
+    deque<vch *> packetsToSend;
+    size_t numPacketsSending;
+
+    bool receivingCompressed;
+
+    // with implicit frames on, any frame between this and the next one we hear about was empty
+    optional<uint64_t> maybeNextFrameExpected;
+
+    void addImplicitFramesBefore(uint64_t frame)
+    {
+        if (maybeNextFrameExpected)
+        {
+            for (uint64_t implicitFrame = *maybeNextFrameExpected; implicitFrame < frame; implicitFrame++)
+            {
+                receivedFrames.push(FrameEventsPacket(implicitFrame, {}, {}));
+            }
+        }
+    }
+    void heardAboutFramesThrough(uint64_t frame)
+    {
+        // in Pregame every packet has the same frame, so this doesn't always move forward
+        if (!maybeNextFrameExpected || *maybeNextFrameExpected < frame + 1)
+            maybeNextFrameExpected = frame + 1;
+    }
 
 public:
+    bool resyncRequested;
+    // handed out by the server once we're in, to get back in without signing again
+    optional<string> maybeSessionToken;
+    bool connectionLost;
+
     ConnectionHandler(boost::asio::io_service &ioService, tcp::socket &socket)
         : ioService(ioService), socket(socket)
     {
-        sending = false;
+        numPacketsSending = 0;
+        receivingCompressed = false;
+        resyncRequested = false;
+        connectionLost = false;
     }
     string receiveSigChallenge()
     {
@@ -96,6 +151,9 @@ public:
             uint64_t size;
             unpackFromIter(place, "CQ", &packetTypechar, &size);
 
+            receivingCompressed = packetTypechar & PACKET_COMPRESSED_FLAG;
+            packetTypechar &= ~PACKET_COMPRESSED_FLAG;
+
             switch (packetTypechar)
             {
             case PACKET_RESYNC_CHAR:
@@ -105,12 +163,31 @@ public:
             case PACKET_FRAMECMDS_CHAR:
                 clearVchAndReceiveFrameCmdsPacket(size);
                 break;
+
+            case PACKET_DELTARESYNC_CHAR:
+                clearVchAndReceiveDeltaResyncPacket(size);
+                break;
+
+            case PACKET_FRAMEBUNDLE_CHAR:
+                clearVchAndReceiveFrameBundlePacket(size);
+                break;
+
+            case PACKET_FRAMETICK_CHAR:
+                clearVchAndReceiveFrameTickPacket(size);
+                break;
+
+            case PACKET_PING_CHAR:
+                clearVchAndReceivePingPacket(size);
+                break;
+
+            case PACKET_SESSIONTOKEN_CHAR:
+                clearVchAndReceiveSessionTokenPacket(size);
+                break;
             }
         }
         else
         {
-            cout << error.message() << endl;
-            throw runtime_error("Error when receiving typechar");
+            connectionErrored("Error when receiving typechar", error);
         }
     }
     void clearVchAndReceiveResyncPacket(uint64_t size)
@@ -124,6 +201,17 @@ public:
                                boost::asio::placeholders::error,
                                boost::asio::placeholders::bytes_transferred));
     }
+    void clearVchAndReceiveDeltaResyncPacket(uint64_t size)
+    {
+        receivedBytes = vch(size);
+
+        async_read(socket,
+                   boost::asio::buffer(receivedBytes),
+                   boost::bind(&ConnectionHandler::deltaResyncPacketReceived,
+                               this,
+                               boost::asio::placeholders::error,
+                               boost::asio::placeholders::bytes_transferred));
+    }
     void clearVchAndReceiveFrameCmdsPacket(uint64_t size)
     {
         receivedBytes = vch(size);
@@ -135,10 +223,67 @@ public:
                                boost::asio::placeholders::error,
                                boost::asio::placeholders::bytes_transferred));
     }
+    void clearVchAndReceiveFrameBundlePacket(uint64_t size)
+    {
+        receivedBytes = vch(size);
+
+        async_read(socket,
+                   boost::asio::buffer(receivedBytes),
+                   boost::bind(&ConnectionHandler::frameBundlePacketReceived,
+                               this,
+                               boost::asio::placeholders::error,
+                               boost::asio::placeholders::bytes_transferred));
+    }
+    void clearVchAndReceiveFrameTickPacket(uint64_t size)
+    {
+        receivedBytes = vch(size);
+
+        async_read(socket,
+                   boost::asio::buffer(receivedBytes),
+                   boost::bind(&ConnectionHandler::frameTickPacketReceived,
+                               this,
+                               boost::asio::placeholders::error,
+                               boost::asio::placeholders::bytes_transferred));
+    }
+    void clearVchAndReceivePingPacket(uint64_t size)
+    {
+        receivedBytes = vch(size);
+
+        async_read(socket,
+                   boost::asio::buffer(receivedBytes),
+                   boost::bind(&ConnectionHandler::pingPacketReceived,
+                               this,
+                               boost::asio::placeholders::error,
+                               boost::asio::placeholders::bytes_transferred));
+    }
+    void clearVchAndReceiveSessionTokenPacket(uint64_t size)
+    {
+        receivedBytes.clear();
+        receivedBytes.resize(size);
+
+        async_read(socket,
+                   boost::asio::buffer(receivedBytes),
+                   boost::bind(&ConnectionHandler::sessionTokenPacketReceived,
+                               this,
+                               boost::asio::placeholders::error,
+                               boost::asio::placeholders::bytes_transferred));
+    }
+    void decompressReceivedBytesIfNeeded()
+    {
+        if (!receivingCompressed)
+            return;
+
+        vch decompressed;
+        if (!decompressToVch(&decompressed, receivedBytes.data(), receivedBytes.size()))
+            throw runtime_error("Received a compressed packet that didn't decompress");
+
+        receivedBytes.swap(decompressed);
+    }
     void resyncPacketReceived(const boost::system::error_code &error, size_t received)
     {
         if (!error)
         {
+            decompressReceivedBytesIfNeeded();
             vchIter place = receivedBytes.begin();
 
             // cout << "BYTES:" << endl;
@@ -146,30 +291,196 @@ public:
             // cout << endl << ":FIN" << endl;
 
             receivedResyncs.push_back(Game(&place));
+            // the frames that follow a resync start from its frame
+            maybeNextFrameExpected = receivedResyncs.back().frame;
 
             clearVchAndReceiveNextPacket();
         }
         else
         {
-            throw runtime_error("Error when receiving resync packet");
+            connectionErrored("Error when receiving resync packet", error);
+        }
+    }
+    void deltaResyncPacketReceived(const boost::system::error_code &error, size_t received)
+    {
+        if (!error)
+        {
+            decompressReceivedBytesIfNeeded();
+            vchIter place = receivedBytes.begin();
+
+            if (optional<vch> packedGame = unpackDeltaResyncToPackedGame(&place, receivedBytes.end(), &snapshotHistory))
+            {
+                vchIter gamePlace = packedGame->begin();
+                receivedResyncs.push_back(Game(&gamePlace));
+                maybeNextFrameExpected = receivedResyncs.back().frame;
+            }
+            else
+            {
+                cout << "Couldn't apply delta resync. Asking for a full one." << endl;
+                sendResyncRequest(ResyncRequestPacket());
+            }
+
+            clearVchAndReceiveNextPacket();
+        }
+        else
+        {
+            connectionErrored("Error when receiving delta resync packet", error);
         }
     }
     void frameCmdsPacketReceived(const boost::system::error_code &error, size_t received)
     {
         if (error)
         {
-            throw runtime_error("Error receiving frameCmds packet:" + error.value());
+            connectionErrored("Error receiving frameCmds packet", error);
+        }
+        else
+        {
+            decompressReceivedBytesIfNeeded();
+            vchIter place = receivedBytes.begin();
+
+            FrameEventsPacket fcp(&place);
+            cmdSchedule.addFromPacket(&fcp);
+            addImplicitFramesBefore(fcp.frame);
+            receivedFrames.push(fcp);
+            heardAboutFramesThrough(fcp.frame);
+
+            clearVchAndReceiveNextPacket();
+        }
+    }
+
+    void frameBundlePacketReceived(const boost::system::error_code &error, size_t received)
+    {
+        if (error)
+        {
+            connectionErrored("Error receiving frame bundle packet", error);
         }
         else
         {
+            decompressReceivedBytesIfNeeded();
             vchIter place = receivedBytes.begin();
 
-            receivedFrameCmdsPackets.push_back(FrameEventsPacket(&place));
+            vector<FrameEventsPacket> frames;
+            unpackFrameBundleAndMoveIter(&place, &frames);
+
+            addImplicitFramesBefore(frames[0].frame);
+            for (unsigned int i = 0; i < frames.size(); i++)
+            {
+                cmdSchedule.addFromPacket(&frames[i]);
+                receivedFrames.push(frames[i]);
+            }
+            heardAboutFramesThrough(frames.back().frame);
+
+            clearVchAndReceiveNextPacket();
+        }
+    }
+
+    void frameTickPacketReceived(const boost::system::error_code &error, size_t received)
+    {
+        if (error)
+        {
+            connectionErrored("Error receiving frame tick packet", error);
+        }
+        else
+        {
+            uint64_t lastEmptyFrame;
+            unpackFromIter(receivedBytes.begin(), "Q", &lastEmptyFrame);
+
+            addImplicitFramesBefore(lastEmptyFrame + 1);
+            heardAboutFramesThrough(lastEmptyFrame);
+
+            clearVchAndReceiveNextPacket();
+        }
+    }
+
+    void pingPacketReceived(const boost::system::error_code &error, size_t received)
+    {
+        if (error)
+        {
+            connectionErrored("Error receiving ping packet", error);
+        }
+        else
+        {
+            uint64_t pingFrame;
+            unpackFromIter(receivedBytes.begin(), "Q", &pingFrame);
+
+            // answered on arrival, not when we get to that frame, so the server sees the network's round trip
+            sendPong(PongPacket(pingFrame));
+
+            clearVchAndReceiveNextPacket();
+        }
+    }
+
+    void sessionTokenPacketReceived(const boost::system::error_code &error, size_t received)
+    {
+        if (error)
+        {
+            connectionErrored("Error receiving session token packet", error);
+        }
+        else
+        {
+            string token;
+            unpackStringFromIter(receivedBytes.begin(), SESSION_TOKEN_MAX_SIZE, &token);
+            maybeSessionToken = token;
 
             clearVchAndReceiveNextPacket();
         }
     }
 
+    // Without a session token there's no way back in short of signing again, so a lost connection is the end.
+    // With one, the main loop sees connectionLost and resumes.
+    void connectionErrored(string what, const boost::system::error_code &error)
+    {
+        // the handlers left over from a connection we closed ourselves in resume()
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        if (!maybeSessionToken)
+            throw runtime_error(what + ": " + error.message());
+
+        if (!connectionLost)
+            cout << what << ": " << error.message() << ". Will try to resume." << endl;
+        connectionLost = true;
+    }
+
+    // Reconnects and presents the session token instead of a signature.
+    // Anything received before the drop is kept; the server picks up from the first frame we hadn't heard about.
+    // Returns false if we couldn't get back in.
+    bool resume(tcp::endpoint endpoint)
+    {
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        ioService.poll();
+        ioService.restart();
+
+        // whatever was in flight may or may not have made it
+        for (unsigned int i = 0; i < numPacketsSending; i++)
+            delete packetsToSend[i];
+        packetsToSend.erase(packetsToSend.begin(), packetsToSend.begin() + numPacketsSending);
+        numPacketsSending = 0;
+
+        string resumeLine = "resume " + *maybeSessionToken + " " + to_string(maybeNextFrameExpected ? *maybeNextFrameExpected : 0);
+        if (boost::shared_ptr<GameSnapshot> baseline = snapshotHistory.getLatestOrNull())
+            resumeLine += " " + to_string(baseline->frame) + " " + to_string(baseline->hash);
+
+        try
+        {
+            socket.connect(endpoint);
+            receiveSigChallenge();
+            sendSignature(resumeLine + "\n");
+            receiveAddress();
+        }
+        catch (boost::system::system_error &e)
+        {
+            cout << "Couldn't resume: " << e.what() << endl;
+            return false;
+        }
+
+        connectionLost = false;
+        sendConnectionOptions(ConnectionOptionsPacket(CONNECTION_OPTION_COMPRESSION | CONNECTION_OPTION_FRAME_BUNDLES | CONNECTION_OPTION_IMPLICIT_FRAMES));
+        startReceivingLoop();
+        return true;
+    }
+
     void sendCmd(boost::shared_ptr<Cmd> cmd)
     {
         packetsToSend.push_back(new vch);
@@ -178,35 +489,73 @@ public:
 
         sendNextPacketIfNotBusy();
     }
+    void sendResyncRequest(ResyncRequestPacket request)
+    {
+        packetsToSend.push_back(new vch);
+
+        clearVchAndBuildClientPacket(packetsToSend.back(), &request);
+
+        resyncRequested = true;
+
+        sendNextPacketIfNotBusy();
+    }
+    void sendPong(PongPacket pong)
+    {
+        packetsToSend.push_back(new vch);
+
+        clearVchAndBuildClientPacket(packetsToSend.back(), &pong);
+
+        sendNextPacketIfNotBusy();
+    }
+    void sendConnectionOptions(ConnectionOptionsPacket options)
+    {
+        packetsToSend.push_back(new vch);
+
+        clearVchAndBuildClientPacket(packetsToSend.back(), &options);
+
+        sendNextPacketIfNotBusy();
+    }
+    void requestResync()
+    {
+        // ask for a delta against the latest snapshot we have, if any
+        if (boost::shared_ptr<GameSnapshot> baseline = snapshotHistory.getLatestOrNull())
+            sendResyncRequest(ResyncRequestPacket(baseline->frame, baseline->hash));
+        else
+            sendResyncRequest(ResyncRequestPacket());
+    }
     void sendNextPacketIfNotBusy()
     {
-        if (!sending && packetsToSend.size() > 0)
+        if (numPacketsSending == 0 && packetsToSend.size() > 0)
         {
-            sending = true;
+            vector<boost::asio::const_buffer> buffers;
+            for (unsigned int i = 0; i < packetsToSend.size(); i++)
+            {
+                buffers.push_back(boost::asio::buffer(*(packetsToSend[i])));
+            }
+            numPacketsSending = packetsToSend.size();
 
             boost::asio::async_write(socket,
-                                     boost::asio::buffer(*(packetsToSend[0])),
-                                     boost::bind(&ConnectionHandler::wrapUpSendingPacket,
+                                     buffers,
+                                     boost::bind(&ConnectionHandler::wrapUpSendingPackets,
                                                  this,
-                                                 packetsToSend[0],
                                                  boost::asio::placeholders::error,
                                                  boost::asio::placeholders::bytes_transferred));
         }
     }
-    void wrapUpSendingPacket(vch *sourceToDispose, const boost::system::error_code &error, size_t bytes_transferred)
+    void wrapUpSendingPackets(const boost::system::error_code &error, size_t bytes_transferred)
     {
         if (error)
         {
-            throw runtime_error("ConnectionHandler error sending packet:" + error.value());
+            connectionErrored("ConnectionHandler error sending packet", error);
         }
         else
         {
-            assert(packetsToSend[0] == sourceToDispose);
-
-            delete packetsToSend[0];
-            packetsToSend.erase(packetsToSend.begin());
-
-            sending = false;
+            for (unsigned int i = 0; i < numPacketsSending; i++)
+            {
+                delete packetsToSend[i];
+            }
+            packetsToSend.erase(packetsToSend.begin(), packetsToSend.begin() + numPacketsSending);
+            numPacketsSending = 0;
 
             sendNextPacketIfNotBusy();
         }
@@ -226,17 +575,28 @@ int main(int argc, char *argv[])
     boost::asio::io_service io_service;
     tcp::socket socket(io_service);
 
-    cout << "Enter server IP (or 'l' for localhost) : ";
+    cout << "Enter server IP, optionally with :port (or 'l' for localhost) : ";
     string ipString;
     cin >> ipString;
 
+    // a relay (see relay.cpp) may be on another port
+    unsigned short port = 8473;
+    size_t portStart = ipString.find(':');
+    if (portStart != string::npos)
+    {
+        port = atoi(ipString.c_str() + portStart + 1);
+        ipString = ipString.substr(0, portStart);
+    }
+
     cout << "Connecting..." << endl;
     // this is "connecting" to INADDR_ANY, which is very weird, but translates (at least on linux) to
     // "connect to the loopback network". This is why this works on local tests.
+    tcp::endpoint serverEndpoint;
     if (ipString == "l")
-        socket.connect(tcp::endpoint(tcp::v4(), 8473));
+        serverEndpoint = tcp::endpoint(tcp::v4(), port);
     else
-        socket.connect(tcp::endpoint(boost::asio::ip::address::from_string(ipString), 8473));
+        serverEndpoint = tcp::endpoint(boost::asio::ip::address::from_string(ipString), port);
+    socket.connect(serverEndpoint);
 
     // socket will now have its own local port.
 
@@ -260,12 +620,13 @@ int main(int argc, char *argv[])
     connectionHandler.sendSignature(userResponse + "\n");
     playerAddress = connectionHandler.receiveAddress();
 
+    connectionHandler.sendConnectionOptions(ConnectionOptionsPacket(CONNECTION_OPTION_COMPRESSION | CONNECTION_OPTION_FRAME_BUNDLES | CONNECTION_OPTION_IMPLICIT_FRAMES));
     connectionHandler.startReceivingLoop();
 
     // Get the first resync packet
     while (true)
     {
-        io_service.poll();
+        io_service.run_one();
 
         if (receivedResyncs.size() > 0)
         {
@@ -283,16 +644,18 @@ int main(int argc, char *argv[])
 
     ParticlesContainer particles;
 
-    chrono::time_point<chrono::system_clock, chrono::duration<double>> nextFrameStart(chrono::system_clock::now());
+    FrameScheduler frameScheduler(FRAME_SPIN_TAIL, 0);
     while (window->isOpen())
     {
-        io_service.poll();
+        // the display keeps a steady pace; receivedFrames decides how many game frames to play each time
+        frameScheduler.waitUntilFrameDue(&io_service);
+        frameScheduler.startFrame();
 
-        chrono::time_point<chrono::system_clock, chrono::duration<double>> now(chrono::system_clock::now());
-        if (now < nextFrameStart || receivedFrameCmdsPackets.size() == 0)
-            continue;
-        
-        nextFrameStart += ONE_FRAME;
+        // the game carries on from what's buffered while we get back in
+        if (connectionHandler.connectionLost && !connectionHandler.resume(serverEndpoint))
+        {
+            throw runtime_error("Lost the connection to the server and couldn't resume.");
+        }
 
         vector<boost::shared_ptr<Cmd>> cmdsToSend = pollWindowEventsAndUpdateUI(&game, &ui, playerIdOrNegativeOne, window);
 
@@ -306,79 +669,81 @@ int main(int argc, char *argv[])
         }
         cmdsToSend.clear();
 
-        if (receivedResyncs.size() > 0 && receivedResyncs[0].frame == game.frame)
+        // If we've fallen far behind, skip the backlog with a resync rather than crawling through it
+        if (!connectionHandler.resyncRequested && receivedFrames.size() > RESYNC_REQUEST_BACKLOG_FRAMES)
+        {
+            cout << "Fallen " << receivedFrames.size() << " frames behind. Requesting resync." << endl;
+            connectionHandler.requestResync();
+        }
+
+        // A resync ahead of us replaces the frames it covers
+        if (receivedResyncs.size() > 0 && receivedResyncs[0].frame >= game.frame)
         {
             game = receivedResyncs[0];
             game.reassignEntityGamePointers();
 
             receivedResyncs.erase(receivedResyncs.begin());
+            connectionHandler.resyncRequested = false;
         }
-
-        FrameEventsPacket fcp = receivedFrameCmdsPackets[0];
-        receivedFrameCmdsPackets.erase(receivedFrameCmdsPackets.begin());
-
-        assert(fcp.frame == game.frame);
-
-        // go through events
-        for (unsigned int i = 0; i < fcp.events.size(); i++)
-        {
-            fcp.events[i]->execute(&game);
-        }
-        
-        // go through cmds
-        for (unsigned int i = 0; i < fcp.authdCmds.size(); i++)
+        else if (receivedResyncs.size() > 0)
         {
-            if (auto unitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>(fcp.authdCmds[i]->cmd))
-            {
-                unitCmd->executeAsPlayer(&game, fcp.authdCmds[i]->playerAddress);
-            }
-            else if (auto withdrawCmd = boost::dynamic_pointer_cast<WithdrawCmd, Cmd>(fcp.authdCmds[i]->cmd))
-            {
-                // ignore. Server processes withdrawals and creates an event.
-            }
-            else
-            {
-                cout << "Woah, I don't know how to handle that event as a client!" << endl;
-            }
+            // we've already played past it; drop it, and ask again below if we're still behind
+            receivedResyncs.erase(receivedResyncs.begin());
+            connectionHandler.resyncRequested = false;
         }
 
-        game.iterate();
+        // a resync is followed by the frames since its snapshot, some of which we may already have run
+        receivedFrames.dropFramesBefore(game.frame);
+        cmdSchedule.dropCmdsBefore(game.frame);
 
-        // Try to update playerId if necessary
-        if (playerIdOrNegativeOne < 0)
+        unsigned int framesToPlay = receivedFrames.framesToPlayThisTick();
+        for (unsigned int frameNum = 0; frameNum < framesToPlay; frameNum++)
         {
-            playerIdOrNegativeOne = game.playerAddressToIdOrNegativeOne(playerAddress);
-        }
+            snapshotHistory.maybeRecord(&game);
 
-        // check for game start cmd, and do some ux prep if we got one
-        for (uint i=0; i<fcp.events.size(); i++)
-        {
-            if (auto gse = boost::dynamic_pointer_cast<HoneypotAddedEvent, Event>(fcp.events[i]))
+            FrameEventsPacket fcp(0, {}, {});
+            if (!receivedFrames.popFrameFor(game.frame, &fcp))
+                break;
+
+            assert(fcp.frame == game.frame);
+
+            runFrameAsClient(&game, &fcp, &cmdSchedule);
+
+            // Try to update playerId if necessary
+            if (playerIdOrNegativeOne < 0)
+            {
+                playerIdOrNegativeOne = game.playerAddressToIdOrNegativeOne(playerAddress);
+            }
+
+            // check for game start cmd, and do some ux prep if we got one
+            for (uint i=0; i<fcp.events.size(); i++)
             {
-                if (playerIdOrNegativeOne >= 0)
+                if (auto gse = boost::dynamic_pointer_cast<HoneypotAddedEvent, Event>(fcp.events[i]))
                 {
-                    // find owned unit and center on it
-                    for (uint i=0; i<game.entities.size(); i++)
+                    if (playerIdOrNegativeOne >= 0)
                     {
-                        if (auto unit = boost::dynamic_pointer_cast<Unit, Entity>(game.entities[i]))
+                        // find owned unit and center on it
+                        for (uint i=0; i<game.entities.size(); i++)
                         {
-                            if (unit->ownerId == playerIdOrNegativeOne)
+                            if (auto unit = boost::dynamic_pointer_cast<Unit, Entity>(game.entities[i]))
                             {
-                                ui.camera.gamePos = unit->pos;
+                                if (unit->ownerId == playerIdOrNegativeOne)
+                                {
+                                    ui.camera.gamePos = unit->pos;
+                                }
                             }
                         }
                     }
                 }
             }
+
+            if (game.frame % 200 == 0)
+                cout << "num ncps " << receivedFrames.size() << ", target " << receivedFrames.getTargetBacklog() << ", jitter " << receivedFrames.getJitterFrames() << " frames" << endl;
         }
 
         // only display if we're not behind schedule
-        now = chrono::system_clock::now();
-        if (now <= nextFrameStart)
+        if (!frameScheduler.frameDue())
             display(window, &game, ui, &particles, game.playerAddressToIdOrNegativeOne(playerAddress));
-
-        if (game.frame % 200 == 0)
-            cout << "num ncps " << receivedFrameCmdsPackets.size() << endl;
     }
     delete window;
 
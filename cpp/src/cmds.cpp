@@ -1,4 +1,6 @@
 #include <stdexcept>
+#include <cmath>
+#include <algorithm>
 #include <boost/shared_ptr.hpp>
 #include "cmds.h"
 #include "common.h"
@@ -33,8 +35,8 @@ boost::shared_ptr<Cmd> unpackFullCmdAndMoveIter(vchIter *iter)
     }
 }
 
-AuthdCmd::AuthdCmd(boost::shared_ptr<Cmd> cmd, string playerAddress)
-    : cmd(cmd), playerAddress(playerAddress){}
+AuthdCmd::AuthdCmd(boost::shared_ptr<Cmd> cmd, uint8_t playerId)
+    : cmd(cmd), playerId(playerId){}
 
 unsigned char Cmd::getTypechar()
 {
@@ -121,10 +123,9 @@ void UnitCmd::unpackUnitCmdAndMoveIter(vchIter *iter)
     }
 }
 
-void UnitCmd::executeAsPlayer(Game *game, string userAddress)
+void UnitCmd::executeAsPlayer(Game *game, uint8_t playerId)
 {
-    int playerId = game->playerAddressToIdOrNegativeOne(userAddress);
-    if (playerId == -1)
+    if (playerId >= game->players.size())
         return;
         
     vector<boost::shared_ptr<Unit>> units = getUnits(game);
@@ -158,6 +159,50 @@ vector<boost::shared_ptr<Unit>> UnitCmd::getUnits(Game *game)
     return units;
 }
 
+// Entities are never removed from game->entities (only nulled), so a ref that exists now still will when the cmd runs.
+bool entityRefExists(Game *game, EntityRef ref)
+{
+    return ref != NULL_ENTITYREF && ref <= game->entities.size();
+}
+
+bool positionValid(vector2f pos)
+{
+    return isfinite(pos.x) && isfinite(pos.y);
+}
+
+bool UnitCmd::admitForPlayer(Game *game, uint8_t playerId)
+{
+    vector<EntityRef> ownUnitRefs;
+    for (unsigned int i = 0; i < unitRefs.size(); i++)
+    {
+        if (!entityRefExists(game, unitRefs[i]))
+            continue;
+        auto unit = boost::dynamic_pointer_cast<Unit, Entity>(entityRefToPtrOrNull(*game, unitRefs[i]));
+        if (unit && unit->ownerId == playerId)
+            ownUnitRefs.push_back(unitRefs[i]);
+    }
+    unitRefs = ownUnitRefs;
+
+    return unitRefs.size() > 0 && argumentsValid(game);
+}
+bool UnitCmd::argumentsValid(Game *game)
+{
+    return true;
+}
+bool UnitCmd::supersedes(UnitCmd *earlier)
+{
+    return false;
+}
+bool UnitCmd::coversUnitsOf(UnitCmd *other)
+{
+    for (unsigned int i = 0; i < other->unitRefs.size(); i++)
+    {
+        if (find(unitRefs.begin(), unitRefs.end(), other->unitRefs[i]) == unitRefs.end())
+            return false;
+    }
+    return true;
+}
+
 unsigned char MoveCmd::getTypechar()
 {
     return CMD_MOVE_CHAR;
@@ -187,6 +232,16 @@ void MoveCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
         cout << "That's not a mobile unit!!" << endl;
     }
 }
+bool MoveCmd::argumentsValid(Game *game)
+{
+    return positionValid(pos);
+}
+// A move resets the target, range and state of every mobile unit, which is all an earlier move or attack sets.
+bool MoveCmd::supersedes(UnitCmd *earlier)
+{
+    unsigned char earlierTypechar = earlier->getTypechar();
+    return (earlierTypechar == CMD_MOVE_CHAR || earlierTypechar == CMD_ATTACK_CHAR) && coversUnitsOf(earlier);
+}
 
 MoveCmd::MoveCmd(vector<EntityRef> units, vector2f pos) : UnitCmd(units), pos(pos) {}
 MoveCmd::MoveCmd(vchIter *iter) : UnitCmd(iter)
@@ -222,6 +277,10 @@ void PickupCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
         cout << "That's not a Prime!!" << endl;
     }
 }
+bool PickupCmd::argumentsValid(Game *game)
+{
+    return entityRefExists(game, goldRef);
+}
 
 PickupCmd::PickupCmd(vector<EntityRef> units, EntityRef goldRef) : UnitCmd(units), goldRef(goldRef) {}
 PickupCmd::PickupCmd(vchIter *iter) : UnitCmd(iter)
@@ -258,6 +317,14 @@ void PutdownCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
     else
         cout << "That's not a prime!!" << endl;
 }
+bool PutdownCmd::argumentsValid(Game *game)
+{
+    if (target.type != Target::PointTarget && target.type != Target::EntityTarget)
+        return false;
+    if (auto point = target.castToPoint())
+        return positionValid(*point);
+    return entityRefExists(game, *target.castToEntityRef());
+}
 
 PutdownCmd::PutdownCmd(vector<EntityRef> units, Target target) : UnitCmd(units), target(target) {}
 PutdownCmd::PutdownCmd(vchIter *iter) : UnitCmd(iter), target(NULL_ENTITYREF)
@@ -294,6 +361,10 @@ void GatewayBuildCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
         cout << "trying to gatewayBuild on something other than a gateway!" << endl;
     }
 }
+bool GatewayBuildCmd::argumentsValid(Game *game)
+{
+    return buildTypechar == PRIME_TYPECHAR || buildTypechar == FIGHTER_TYPECHAR;
+}
 
 GatewayBuildCmd::GatewayBuildCmd(vector<EntityRef> units, unsigned char buildTypechar)
     : UnitCmd(units), buildTypechar(buildTypechar) {}
@@ -335,6 +406,10 @@ void PrimeBuildCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
         cout << "trying to primeBuild on something other than a prime!" << endl;
     }
 }
+bool PrimeBuildCmd::argumentsValid(Game *game)
+{
+    return buildTypechar == GATEWAY_TYPECHAR && positionValid(buildPos);
+}
 
 PrimeBuildCmd::PrimeBuildCmd(vector<EntityRef> units, unsigned char buildTypechar, vector2f buildPos)
     : UnitCmd(units), buildTypechar(buildTypechar), buildPos(buildPos) {}
@@ -370,6 +445,15 @@ void AttackCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
         fighter->cmdAttack(targetUnit);
     }
 }
+bool AttackCmd::argumentsValid(Game *game)
+{
+    return entityRefExists(game, targetUnit);
+}
+// An attack only touches fighters, so it can't stand in for an earlier move, which would still have moved any primes.
+bool AttackCmd::supersedes(UnitCmd *earlier)
+{
+    return earlier->getTypechar() == CMD_ATTACK_CHAR && coversUnitsOf(earlier);
+}
 
 AttackCmd::AttackCmd(vector<EntityRef> units, EntityRef targetUnit)
     : UnitCmd(units), targetUnit(targetUnit)
@@ -405,6 +489,10 @@ void ResumeBuildingCmd::executeOnUnit(boost::shared_ptr<Unit> unit)
         prime->cmdResumeBuilding(targetUnit);
     }
 }
+bool ResumeBuildingCmd::argumentsValid(Game *game)
+{
+    return entityRefExists(game, targetUnit);
+}
 
 ResumeBuildingCmd::ResumeBuildingCmd(vector<EntityRef> units, EntityRef targetUnit)
     : UnitCmd(units), targetUnit(targetUnit)
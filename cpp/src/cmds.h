@@ -40,8 +40,8 @@ struct Cmd
 struct AuthdCmd
 {
     boost::shared_ptr<Cmd> cmd;
-    string playerAddress;
-    AuthdCmd(boost::shared_ptr<Cmd> cmd, string playerAddress);
+    uint8_t playerId; // index into Game::players
+    AuthdCmd(boost::shared_ptr<Cmd> cmd, uint8_t playerId);
 };
 
 struct WithdrawCmd : public Cmd
@@ -64,9 +64,20 @@ struct UnitCmd : public Cmd
     vector<EntityRef> unitRefs;
     vector<boost::shared_ptr<Unit>> getUnits(Game *game);
 
-    void executeAsPlayer(Game *, string userAddress);
+    void executeAsPlayer(Game *, uint8_t playerId);
     virtual void executeOnUnit(boost::shared_ptr<Unit> unit);
 
+    // Run by the server before it lets the cmd into a frame.
+    // Drops any unitRefs that aren't the player's own units (which executeAsPlayer would skip on every client anyway),
+    // and returns false if none are left or if the rest of the cmd refers to something that can't exist.
+    bool admitForPlayer(Game *, uint8_t playerId);
+    virtual bool argumentsValid(Game *);
+
+    // True if running this cmd right after `earlier` leaves every unit just as running this cmd alone would,
+    // so the server can drop `earlier` when both come from the same player for the same frame.
+    virtual bool supersedes(UnitCmd *earlier);
+    bool coversUnitsOf(UnitCmd *other);
+
     void packUnitCmd(vch *dest);
     void unpackUnitCmdAndMoveIter(vchIter *iter);
 
@@ -84,6 +95,8 @@ struct MoveCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *iter);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
+    bool supersedes(UnitCmd *earlier);
 
     MoveCmd(vector<EntityRef> unitRefs, vector2f pos);
     MoveCmd(vchIter *iter);
@@ -99,6 +112,7 @@ struct PickupCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
 
     PickupCmd(vector<EntityRef>, EntityRef);
     PickupCmd(vchIter *iter);
@@ -114,6 +128,7 @@ struct PutdownCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
 
     PutdownCmd(vector<EntityRef>, Target);
     PutdownCmd(vchIter *iter);
@@ -129,6 +144,7 @@ struct GatewayBuildCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
 
     GatewayBuildCmd(vector<EntityRef>, unsigned char buildTypechar);
     GatewayBuildCmd(vchIter *iter);
@@ -145,6 +161,7 @@ struct PrimeBuildCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
 
     PrimeBuildCmd(vector<EntityRef>, unsigned char buildTypechar, vector2f buildPos);
     PrimeBuildCmd(vchIter *iter);
@@ -160,6 +177,8 @@ struct AttackCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
+    bool supersedes(UnitCmd *earlier);
 
     AttackCmd(vector<EntityRef>, EntityRef);
     AttackCmd(vchIter *iter);
@@ -175,6 +194,7 @@ struct ResumeBuildingCmd : public UnitCmd
     void unpackAndMoveIter(vchIter *);
 
     void executeOnUnit(boost::shared_ptr<Unit>);
+    bool argumentsValid(Game *);
 
     ResumeBuildingCmd(vector<EntityRef>, EntityRef);
     ResumeBuildingCmd(vchIter *iter);
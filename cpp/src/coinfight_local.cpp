@@ -14,6 +14,7 @@
 #include "input.h"
 #include "events.h"
 #include "packets.h"
+#include "framescheduler.h"
 
 Game game;
 
@@ -78,8 +79,10 @@ int main(int argc, char *argv[])
 
     vector<boost::shared_ptr<Event>> firstEvents;
 
-    firstEvents.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent("0xf00", 15000, true)));
-    firstEvents.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent("0x0f0", 15000, true)));
+    firstEvents.push_back(boost::shared_ptr<Event>(new PlayerJoinedEvent("0xf00")));
+    firstEvents.push_back(boost::shared_ptr<Event>(new PlayerJoinedEvent("0x0f0")));
+    firstEvents.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent(0, 15000, true)));
+    firstEvents.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent(1, 15000, true)));
     firstEvents.push_back(boost::shared_ptr<Event>(new HoneypotAddedEvent(honeypotStartingAmount)));
     
     for (uint i=0; i<firstEvents.size(); i++)
@@ -98,13 +101,17 @@ int main(int argc, char *argv[])
 
     int lastDisplayedFrame = -1;
 
-    chrono::time_point<chrono::system_clock, chrono::duration<double>> nextFrameStart(chrono::system_clock::now());
+    FrameScheduler frameScheduler(FRAME_SPIN_TAIL, 0);
     while (window->isOpen())
     {
-        chrono::time_point<chrono::system_clock, chrono::duration<double>> now(chrono::system_clock::now());
-        if (now < nextFrameStart)
+        if (!frameScheduler.frameDue())
         {
-            if (lastDisplayedFrame < (int)game.frame)
+            if (lastDisplayedFrame >= (int)game.frame)
+            {
+                // already displayed this frame; nothing to do until the next
+                frameScheduler.waitUntilFrameDue(NULL);
+            }
+            else
             {
                 lastDisplayedFrame = game.frame;
                 // if we have time, display and perform UX.
@@ -126,7 +133,7 @@ int main(int argc, char *argv[])
             }
         }
         else {
-            nextFrameStart += ONE_FRAME;
+            frameScheduler.startFrame();
 
             // gonna pack queued cmds up and clear list
             vector<vch*> packages;
@@ -149,7 +156,7 @@ int main(int argc, char *argv[])
                 vchIter place = packages[i]->begin() + 2; // we're looking past the size specifier, because in this case we already know...
 
                 boost::shared_ptr<Cmd> cmd = unpackFullCmdAndMoveIter(&place);
-                boost::shared_ptr<AuthdCmd> authdCmd = boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, game.playerIdToAddress(currentPlayerId)));
+                boost::shared_ptr<AuthdCmd> authdCmd = boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, currentPlayerId));
 
                 authdCmds.push_back(authdCmd);
 
@@ -161,7 +168,7 @@ int main(int argc, char *argv[])
             {
                 if (auto unitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>(authdCmds[i]->cmd))
                 {
-                    unitCmd->executeAsPlayer(&game, authdCmds[i]->playerAddress);
+                    unitCmd->executeAsPlayer(&game, authdCmds[i]->playerId);
                 }
                 else if (auto withdrawCmd = boost::dynamic_pointer_cast<WithdrawCmd, Cmd>(authdCmds[i]->cmd))
                 {
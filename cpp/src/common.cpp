@@ -1,5 +1,6 @@
 #include <iostream>
 #include <stdio.h>
+#include <cstring>
 #include "common.h"
 #include "coins.h"
 
@@ -38,14 +39,34 @@ void prependVchWithSize(vch *vchDest)
     vchDest->insert(vchDest->begin(), sizeData.begin(), sizeData.end());
 }
 
+// The float's own bits, rather than vchpack's half-precision "f",
+// so that a game that's been packed and unpacked goes on exactly as the original does.
+void packFloat(vch *destVch, float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    packToVch(destVch, "L", (unsigned long)bits);
+}
+
+vchIter unpackFloat(vchIter src, float *f)
+{
+    unsigned long bits;
+    src = unpackFromIter(src, "L", &bits);
+    uint32_t bits32 = bits;
+    memcpy(f, &bits32, sizeof(bits32));
+    return src;
+}
+
 void packVector2f(vch *destVch, const vector2f &v)
 {
-    packToVch(destVch, "ff", v.x, v.y);
+    packFloat(destVch, v.x);
+    packFloat(destVch, v.y);
 }
 
 vchIter unpackVector2f(vchIter src, vector2f *v)
 {
-    return unpackFromIter(src, "ff", &v->x, &v->y);
+    src = unpackFloat(src, &v->x);
+    return unpackFloat(src, &v->y);
 }
 
 vchIter unpackTypecharFromIter(vchIter src, unsigned char *typechar)
@@ -80,6 +101,18 @@ vchIter unpackStringFromIter(vchIter iter, uint16_t maxSize, string *s)
     return newIter;
 }
 
+uint64_t hashVch(const vch &v)
+{
+    // 64-bit FNV-1a. Not cryptographic; just for checking two sides hold the same bytes.
+    uint64_t hash = 14695981039346656037u;
+    for (unsigned int i = 0; i < v.size(); i++)
+    {
+        hash ^= v[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
 bool entityRefIsNull(EntityRef ref)
 {
     return ref == 0;
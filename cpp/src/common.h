@@ -22,6 +22,9 @@ void debugOutputVector(const char *,vector3f);
 
 void prependVchWithSize(vch *vchDest);
 
+void packFloat(vch *destVch, float f);
+vchIter unpackFloat(vchIter src, float *f);
+
 void packVector2f(vch *destVch, const vector2f &v);
 vchIter unpackVector2f(vchIter src, vector2f *v);
 
@@ -33,6 +36,8 @@ vchIter unpackEntityRef(vchIter iter, EntityRef *ref);
 void packStringToVch(std::vector<unsigned char> *vch, string s);
 vchIter unpackStringFromIter(vchIter iter, uint16_t maxSize, string *s);
 
+uint64_t hashVch(const vch &);
+
 bool entityRefIsNull(EntityRef);
 std::optional<unsigned int> safeUIntAdd(unsigned int, unsigned int);
 
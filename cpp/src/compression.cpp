@@ -0,0 +1,177 @@
+#include <string.h>
+#include "compression.h"
+#include "config.h"
+#include "vchpack.h"
+
+using namespace std;
+
+const unsigned int COMPRESSION_HASH_BITS = 12;
+const uint32_t COMPRESSION_MIN_MATCH = 4;
+const uint32_t COMPRESSION_MAX_OFFSET = 65535;
+
+uint32_t read32(unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+uint32_t hashSequence(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - COMPRESSION_HASH_BITS);
+}
+
+// lengths that don't fit in a token nibble continue in 255-valued bytes
+void packExtraLength(vch *dest, uint32_t length)
+{
+    while (length >= 255)
+    {
+        dest->push_back(255);
+        length -= 255;
+    }
+    dest->push_back(length);
+}
+bool unpackExtraLength(unsigned char *src, uint32_t srcSize, uint32_t *i, uint32_t *length)
+{
+    unsigned char next;
+    do
+    {
+        if (*i >= srcSize)
+            return false;
+        next = src[(*i)++];
+        *length += next;
+    } while (next == 255);
+    return true;
+}
+
+void packSequence(vch *dest, unsigned char *literals, uint32_t numLiterals, uint32_t offset, uint32_t matchLength)
+{
+    uint32_t extraMatchLength = matchLength > 0 ? matchLength - COMPRESSION_MIN_MATCH : 0;
+
+    unsigned char token = (min(numLiterals, (uint32_t)15) << 4) | min(extraMatchLength, (uint32_t)15);
+    dest->push_back(token);
+    if (numLiterals >= 15)
+        packExtraLength(dest, numLiterals - 15);
+
+    dest->insert(dest->end(), literals, literals + numLiterals);
+
+    if (matchLength > 0)
+    {
+        dest->push_back(offset & 0xff);
+        dest->push_back(offset >> 8);
+        if (extraMatchLength >= 15)
+            packExtraLength(dest, extraMatchLength - 15);
+    }
+}
+
+void compressToVch(vch *dest, unsigned char *src, uint32_t srcSize)
+{
+    packToVch(dest, "L", (unsigned long)srcSize);
+
+    // most recent position each hashed 4-byte sequence was seen at
+    vector<int32_t> lastSeen(1 << COMPRESSION_HASH_BITS, -1);
+
+    uint32_t anchor = 0; // start of literals not yet written
+    uint32_t i = 0;
+    while (i + COMPRESSION_MIN_MATCH <= srcSize)
+    {
+        uint32_t sequence = read32(src + i);
+        uint32_t hash = hashSequence(sequence);
+        int32_t candidate = lastSeen[hash];
+        lastSeen[hash] = i;
+
+        if (candidate >= 0 && i - candidate <= COMPRESSION_MAX_OFFSET && read32(src + candidate) == sequence)
+        {
+            uint32_t matchLength = COMPRESSION_MIN_MATCH;
+            while (i + matchLength < srcSize && src[candidate + matchLength] == src[i + matchLength])
+                matchLength++;
+
+            packSequence(dest, src + anchor, i - anchor, i - candidate, matchLength);
+
+            i += matchLength;
+            anchor = i;
+        }
+        else
+        {
+            // step faster through data that isn't compressing
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+
+    // whatever's left goes out as a final literal-only sequence
+    packSequence(dest, src + anchor, srcSize - anchor, 0, 0);
+}
+
+bool decompressToVch(vch *dest, unsigned char *src, uint32_t srcSize)
+{
+    if (srcSize < PACK_L_SIZE)
+        return false;
+
+    vch sizeBytes(src, src + PACK_L_SIZE);
+    unsigned long decompressedSize;
+    unpackFromIter(sizeBytes.begin(), "L", &decompressedSize);
+
+    dest->resize(decompressedSize);
+    uint32_t out = 0;
+
+    uint32_t i = PACK_L_SIZE;
+    while (i < srcSize)
+    {
+        unsigned char token = src[i++];
+
+        uint32_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !unpackExtraLength(src, srcSize, &i, &numLiterals))
+            return false;
+        if (i + numLiterals > srcSize || out + numLiterals > decompressedSize)
+            return false;
+
+        // dest->data() may be null when the whole thing decompresses to nothing
+        if (numLiterals > 0)
+            memcpy(dest->data() + out, src + i, numLiterals);
+        i += numLiterals;
+        out += numLiterals;
+
+        // the last sequence has no match
+        if (i == srcSize)
+            break;
+
+        if (i + 2 > srcSize)
+            return false;
+        uint32_t offset = src[i] | (src[i + 1] << 8);
+        i += 2;
+
+        uint32_t matchLength = token & 15;
+        if (matchLength == 15 && !unpackExtraLength(src, srcSize, &i, &matchLength))
+            return false;
+        matchLength += COMPRESSION_MIN_MATCH;
+
+        if (offset == 0 || offset > out || out + matchLength > decompressedSize)
+            return false;
+
+        // may overlap with what it's writing, so go byte by byte
+        unsigned char *from = dest->data() + out - offset;
+        unsigned char *to = dest->data() + out;
+        for (uint32_t j = 0; j < matchLength; j++)
+            to[j] = from[j];
+        out += matchLength;
+    }
+
+    return out == decompressedSize;
+}
+
+void compressPacketIfSmaller(vch *packet)
+{
+    uint32_t bodySize = packet->size() - PACKET_HEADER_SIZE;
+
+    vch compressed;
+    compressToVch(&compressed, packet->data() + PACKET_HEADER_SIZE, bodySize);
+
+    if (compressed.size() >= bodySize)
+        return;
+
+    unsigned char typechar = (*packet)[0];
+
+    packet->clear();
+    packToVch(packet, "C", typechar | PACKET_COMPRESSED_FLAG);
+    packToVch(packet, "Q", (uint64_t)(compressed.size()));
+    packet->insert(packet->end(), compressed.begin(), compressed.end());
+}
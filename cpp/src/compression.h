@@ -0,0 +1,22 @@
+#include "common.h"
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+using namespace std;
+
+// A small LZ77 compressor in the style of an LZ4 block:
+// each sequence is a token (literal length << 4 | match length - 4),
+// the literals, then a 2-byte offset back into the output and any extra match length.
+// Favors speed over ratio. Compressed data is prefixed with the uncompressed size ("L").
+
+void compressToVch(vch *dest, unsigned char *src, uint32_t srcSize);
+
+// Returns false if src isn't valid compressed data.
+bool decompressToVch(vch *dest, unsigned char *src, uint32_t srcSize);
+
+// For packets built with the usual 9-byte header (typechar, then size of the body):
+// compresses the body and sets PACKET_COMPRESSED_FLAG on the typechar, unless that doesn't make it smaller.
+void compressPacketIfSmaller(vch *packet);
+
+#endif // COMPRESSION_H
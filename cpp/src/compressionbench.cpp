@@ -0,0 +1,95 @@
+#include <iostream>
+#include <stdio.h>
+#include "benchcommon.h"
+#include "compression.h"
+#include "engine.h"
+#include "packets.h"
+
+using namespace std;
+
+// Measures compression ratio and CPU cost of compression.h on game states and frame packets.
+// Usage: compressionbench [packedGameFile ...]
+// With no arguments, states are generated with fillSyntheticGame.
+// Otherwise each file should hold the body of a resync packet (the output of Game::pack).
+
+void benchCompression(string label, vch *data)
+{
+    // repeat small inputs so the timings mean something
+    int reps = max(3, (int)(20000000 / (data->size() + 1)));
+
+    vch compressed;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        compressed.clear();
+        compressToVch(&compressed, data->data(), data->size());
+    }
+    double compressSeconds = secondsSince(start) / reps;
+
+    vch decompressed;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        if (!decompressToVch(&decompressed, compressed.data(), compressed.size()))
+            throw runtime_error("decompression failed");
+    }
+    double decompressSeconds = secondsSince(start) / reps;
+
+    if (decompressed != *data)
+        throw runtime_error("decompressed data doesn't match for " + label);
+
+    printf("%-32s %10lu %10lu %7.3f %10.1f %10.1f %12.1f %12.1f\n",
+           label.c_str(),
+           data->size(),
+           compressed.size(),
+           (double)compressed.size() / data->size(),
+           compressSeconds * 1e6,
+           decompressSeconds * 1e6,
+           data->size() / compressSeconds / 1e6,
+           data->size() / decompressSeconds / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    printf("%-32s %10s %10s %7s %10s %10s %12s %12s\n",
+           "input", "bytes", "compressed", "ratio", "comp us", "decomp us", "comp MB/s", "decomp MB/s");
+
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            vch packedGame = loadFileToVch(argv[i]);
+            benchCompression(argv[i], &packedGame);
+        }
+        return 0;
+    }
+
+    unsigned int gameSizes[] = {100, 1000, 10000, 50000};
+    for (unsigned int numEntities : gameSizes)
+    {
+        Game game;
+        fillSyntheticGame(&game, numEntities, 8);
+
+        vch packedGame;
+        game.pack(&packedGame);
+
+        benchCompression("resync, " + to_string(numEntities) + " entities", &packedGame);
+    }
+
+    Game game;
+    fillSyntheticGame(&game, 1000, 8);
+    unsigned int cmdCounts[] = {1, 5, 20, 100};
+    for (unsigned int numCmds : cmdCounts)
+    {
+        FrameEventsPacket fcp = makeSyntheticFramePacket(&game, numCmds, 3);
+
+        vch packedFrame;
+        fcp.pack(&packedFrame);
+
+        benchCompression("frame, " + to_string(numCmds) + " cmds", &packedFrame);
+    }
+
+    return 0;
+}
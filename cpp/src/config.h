@@ -19,8 +19,101 @@ const EntityRef NULL_ENTITYREF = 0;
 
 const unsigned char NULL_TYPECHAR = 0;
 
+// players are referred to by a single-byte index on the wire
+const unsigned int MAX_PLAYERS = 255;
+
 const unsigned char PACKET_RESYNC_CHAR = 1;
 const unsigned char PACKET_FRAMECMDS_CHAR = 2;
+const unsigned char PACKET_DELTARESYNC_CHAR = 3;
+const unsigned char PACKET_FRAMEBUNDLE_CHAR = 4;
+const unsigned char PACKET_FRAMETICK_CHAR = 5;
+const unsigned char PACKET_PING_CHAR = 6;
+const unsigned char PACKET_SESSIONTOKEN_CHAR = 7;
+
+// server packets start with a typechar and a "Q" body size
+const unsigned int PACKET_HEADER_SIZE = 9;
+// set on the typechar when the body has been compressed (see compression.h)
+const unsigned char PACKET_COMPRESSED_FLAG = 0x80;
+// frame packets smaller than this aren't worth compressing
+const unsigned int COMPRESSION_MIN_FRAME_PACKET_SIZE = 256;
+
+const unsigned char CLIENT_PACKET_CMD_CHAR = 1;
+const unsigned char CLIENT_PACKET_RESYNCREQUEST_CHAR = 2;
+const unsigned char CLIENT_PACKET_CONNECTIONOPTIONS_CHAR = 3;
+const unsigned char CLIENT_PACKET_PONG_CHAR = 4;
+
+// flags a client can set in its ConnectionOptionsPacket
+const unsigned char CONNECTION_OPTION_COMPRESSION = 1;
+const unsigned char CONNECTION_OPTION_FRAME_BUNDLES = 2;
+const unsigned char CONNECTION_OPTION_IMPLICIT_FRAMES = 4;
+
+// With CONNECTION_OPTION_IMPLICIT_FRAMES, the server doesn't send empty frames during a match.
+// The client infers them from the next frame it does get, or from a tick the server sends
+// once the oldest frame it's held back has waited this many frames.
+const unsigned int IMPLICIT_FRAMES_MAX_DELAY = 4;
+
+// both server and client snapshot the game every RESYNC_SNAPSHOT_INTERVAL frames,
+// so a client can ask for a resync as a delta against one of these
+const uint64_t RESYNC_SNAPSHOT_INTERVAL = 60;
+const unsigned int RESYNC_SNAPSHOTS_KEPT = 30;
+// if a client falls this many frames behind, it asks for a (delta) resync instead of grinding through the backlog
+const unsigned int RESYNC_REQUEST_BACKLOG_FRAMES = 300;
+
+// During a match, a unit cmd the server gets on frame F is announced in F's packet and executed on F + k,
+// so clients hear about it before it's due. k covers the one-way trip to the slowest client,
+// going by round trips measured with a ping every CMD_DELAY_PING_INTERVAL frames.
+const uint64_t CMD_DELAY_MIN_FRAMES = 2;
+const uint64_t CMD_DELAY_MAX_FRAMES = 30;
+const unsigned int CMD_DELAY_PING_INTERVAL = 30;
+
+// After authenticating, a client gets a session token it can present instead of a signature when it reconnects.
+// If the frames it missed are still in the server's recent frame packets it's just sent those; otherwise it gets a (delta) resync.
+const uint64_t SESSION_TOKEN_LIFETIME_SECONDS = 24 * 60 * 60;
+const uint16_t SESSION_TOKEN_MAX_SIZE = 200;
+
+// Answering the challenge with "spectate" logs in as a spectator, who's sent the game but can't act in it.
+// The server and relays (see relay.cpp) both accept it, and answer with this in place of an address.
+const char SPECTATOR_ADDRESS[] = "0x0000000000000000000000000000000000000000";
+
+// Each player's cmds are let into frames at up to CMD_RATE_LIMIT_PER_SECOND on average, in bursts of up to CMD_RATE_LIMIT_BURST;
+// the server drops any more. Well above what anyone clicking could send.
+const double CMD_RATE_LIMIT_PER_SECOND = 20;
+const double CMD_RATE_LIMIT_BURST = 40;
+
+// below this many entities per thread, packing and unpacking in parallel isn't worth starting threads for
+const unsigned int PARALLEL_PACK_MIN_ENTITIES_PER_THREAD = 2048;
+
+// Limits on what the server will queue up for a client that isn't reading fast enough.
+// The byte limit has to leave room for a full resync, or a lagging client would never get out from under it.
+const size_t SEND_QUEUE_MAX_PACKETS = 600;
+const size_t SEND_QUEUE_MAX_BYTES = 16 * 1024 * 1024;
+// What to do with a client over either limit:
+// ResyncSlowClient drops everything queued that isn't already being written, and sends a fresh resync once the client has read the rest;
+// DisconnectSlowClient kicks the client once it's been over for SLOW_CLIENT_GRACE_FRAMES frames in a row.
+enum SlowClientPolicy {
+    ResyncSlowClient,
+    DisconnectSlowClient
+};
+const SlowClientPolicy SLOW_CLIENT_POLICY = ResyncSlowClient;
+const unsigned int SLOW_CLIENT_GRACE_FRAMES = 600;
+// every so often the server reports the deepest send queues, listing clients more than this many packets behind
+const unsigned int SEND_QUEUE_REPORT_INTERVAL = 3600;
+const size_t SEND_QUEUE_LAGGING_PACKETS = 60;
+
+// the server writes the game to SNAPSHOT_FILE_PATH about this often, and loads it on startup
+const unsigned int SNAPSHOT_FILE_INTERVAL = 600;
+const char SNAPSHOT_FILE_PATH[] = "./game_snapshot.bin";
+// every frame since that snapshot goes in the write-ahead log in WAL_DIR (see writeaheadlog.h), committed about every WAL_COMMIT_INTERVAL.
+// To start a fresh game rather than recover the old one, clear out both.
+const char WAL_DIR[] = "./wal/";
+const std::chrono::milliseconds WAL_COMMIT_INTERVAL(50);
+// deposit files wait here, once taken up, until the frame with their events is committed
+const char CONSUMED_DEPOSITS_DIR[] = "./accounting/consumed_deposits/";
+
+// each run, the server records the game to a new replay log in REPLAY_LOG_DIR (see replaylog.h),
+// with a keyframe every REPLAY_KEYFRAME_INTERVAL frames of a match (a multiple of RESYNC_SNAPSHOT_INTERVAL, so it's one already taken)
+const char REPLAY_LOG_DIR[] = "./replays/";
+const uint64_t REPLAY_KEYFRAME_INTERVAL = 3600;
 
 const unsigned char GOLDPILE_TYPECHAR = 1;
 const unsigned char PRIME_TYPECHAR = 2;
@@ -28,6 +121,20 @@ const unsigned char GATEWAY_TYPECHAR = 3;
 const unsigned char FIGHTER_TYPECHAR = 4;
 
 const std::chrono::duration<double, std::ratio<1,60>> ONE_FRAME(1);
+// FrameScheduler sleeps until this long before a frame is due, then spins, to absorb OS wakeup latency.
+// Raise it if reported jitter is too high; lower it to spend less CPU spinning.
+const std::chrono::microseconds FRAME_SPIN_TAIL(1000);
+const unsigned int FRAME_JITTER_REPORT_INTERVAL = 3600;
+
+// The client's JitterBuffer aims to keep this many times its arrival jitter estimate in reserve, within these bounds.
+const double JITTER_BUFFER_JITTER_MULTIPLE = 2;
+const unsigned int JITTER_BUFFER_MIN_TARGET_FRAMES = 1;
+const unsigned int JITTER_BUFFER_MAX_TARGET_FRAMES = 30;
+// Once the backlog is more than this many frames over the target, it plays an extra frame per tick
+// for every this-many frames over, up to JITTER_BUFFER_MAX_FRAMES_PER_TICK.
+const double JITTER_BUFFER_CATCHUP_SLACK = 3;
+const unsigned int JITTER_BUFFER_MAX_FRAMES_PER_TICK = 8;
+const size_t JITTER_BUFFER_INITIAL_CAPACITY = 64;
 
 const float ENTITY_COLLIDE_RADIUS = 15;
 
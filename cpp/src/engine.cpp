@@ -4,6 +4,8 @@
 #include <boost/bind.hpp>
 #include <vector>
 #include <string>
+#include <thread>
+#include <algorithm>
 #include "myvectors.h"
 #include "config.h"
 #include "vchpack.h"
@@ -66,19 +68,39 @@ string Game::playerIdToAddress(uint playerId)
 }
 
 void Game::pack(vch *dest)
+{
+    packAndRecordEntityOffsets(dest, NULL);
+}
+// state, frame, honeypot and players: everything before the entities
+void Game::packHeader(vch *dest)
 {
     packToVch(dest, "C", (unsigned char)(state));
     packToVch(dest, "Q", frame);
 
+    // the honeypot is an ordinary entity, so it's enough to note which one it is
+    EntityRef honeypotRef = NULL_ENTITYREF;
+    if (honeypotGoldPileIfGameStarted
+     && honeypotGoldPileIfGameStarted->ref <= entities.size()
+     && entities[honeypotGoldPileIfGameStarted->ref - 1] == honeypotGoldPileIfGameStarted)
+    {
+        honeypotRef = honeypotGoldPileIfGameStarted->ref;
+    }
+    packEntityRef(dest, honeypotRef);
+
     packToVch(dest, "C", (unsigned char)(players.size()));
     for (uint i=0; i < players.size(); i++)
     {
         players[i].pack(dest);
     }
-
-    packToVch(dest, "H", (EntityRef)(entities.size()));
-    for (EntityRef i = 0; i < entities.size(); i++)
+}
+// entityOffsets, if given, gets where each entity starts in dest.
+void Game::packEntityRange(vch *dest, EntityRef first, EntityRef count, vector<uint32_t> *entityOffsets)
+{
+    for (EntityRef i = first; i < first + count; i++)
     {
+        if (entityOffsets)
+            entityOffsets->push_back(dest->size());
+
         unsigned char typechar = getMaybeNullEntityTypechar(entities[i]);
 
         packTypechar(dest, typechar);
@@ -89,13 +111,69 @@ void Game::pack(vch *dest)
         }
     }
 }
-void Game::unpackAndMoveIter(vchIter *iter)
+// entityOffsets, if given, gets where each entity starts in dest, plus one final entry for the end.
+void Game::packAndRecordEntityOffsets(vch *dest, vector<uint32_t> *entityOffsets)
+{
+    packHeader(dest);
+
+    packToVch(dest, "H", (EntityRef)(entities.size()));
+    packEntityRange(dest, 0, entities.size(), entityOffsets);
+
+    if (entityOffsets)
+        entityOffsets->push_back(dest->size());
+}
+void Game::packInParallelAndRecordEntityOffsets(vch *dest, vector<uint32_t> *entityOffsets, unsigned int numThreads)
+{
+    numThreads = min(numThreads, (unsigned int)(entities.size() / PARALLEL_PACK_MIN_ENTITIES_PER_THREAD));
+    if (numThreads <= 1)
+    {
+        packAndRecordEntityOffsets(dest, entityOffsets);
+        return;
+    }
+
+    vector<vch> chunks(numThreads);
+    vector<vector<uint32_t>> chunkOffsets(numThreads);
+    vector<thread> threads;
+    for (unsigned int t = 0; t < numThreads; t++)
+    {
+        EntityRef first = (entities.size() * t) / numThreads;
+        EntityRef count = (entities.size() * (t + 1)) / numThreads - first;
+        threads.push_back(thread([this, &chunks, &chunkOffsets, t, first, count]
+        {
+            packEntityRange(&chunks[t], first, count, &chunkOffsets[t]);
+        }));
+    }
+
+    packHeader(dest);
+    packToVch(dest, "H", (EntityRef)(entities.size()));
+
+    for (unsigned int t = 0; t < numThreads; t++)
+    {
+        threads[t].join();
+
+        uint32_t chunkStart = dest->size();
+        dest->insert(dest->end(), chunks[t].begin(), chunks[t].end());
+        if (entityOffsets)
+        {
+            for (unsigned int i = 0; i < chunkOffsets[t].size(); i++)
+            {
+                entityOffsets->push_back(chunkStart + chunkOffsets[t][i]);
+            }
+        }
+    }
+    if (entityOffsets)
+        entityOffsets->push_back(dest->size());
+}
+void Game::unpackHeaderAndMoveIter(vchIter *iter)
 {
     unsigned char enumInt;
     *iter = unpackFromIter(*iter, "C", &enumInt);
     state = static_cast<State>(enumInt);
 
     *iter = unpackFromIter(*iter, "Q", &frame);
+
+    *iter = unpackEntityRef(*iter, &honeypotRefToUnpack);
+    honeypotGoldPileIfGameStarted.reset();
     
     uint8_t playersSize;
     *iter = unpackFromIter(*iter, "C", &playersSize);
@@ -105,6 +183,10 @@ void Game::unpackAndMoveIter(vchIter *iter)
     {
         players.push_back(Player(iter));
     }
+}
+void Game::unpackAndMoveIter(vchIter *iter)
+{
+    unpackHeaderAndMoveIter(iter);
 
     uint16_t entitiesSize;
     *iter = unpackFromIter(*iter, "H", &entitiesSize);
@@ -117,9 +199,60 @@ void Game::unpackAndMoveIter(vchIter *iter)
 
         entities.push_back(unpackFullEntityAndMoveIter(iter, typechar, this, getNextEntityRef()));
     }
+
+    if (honeypotRefToUnpack != NULL_ENTITYREF && honeypotRefToUnpack <= entities.size())
+        honeypotGoldPileIfGameStarted = boost::dynamic_pointer_cast<GoldPile, Entity>(entities[honeypotRefToUnpack - 1]);
+}
+void Game::unpackHeaderWithEntityOffsets(vchIter start, const vector<uint32_t> &entityOffsets)
+{
+    vchIter place = start;
+    unpackHeaderAndMoveIter(&place);
+
+    entities.clear();
+    entities.resize(entityOffsets.size() - 1);
+}
+void Game::unpackEntityRange(vchIter start, const vector<uint32_t> &entityOffsets, EntityRef first, EntityRef count)
+{
+    for (EntityRef i = first; i < first + count; i++)
+    {
+        vchIter place = start + entityOffsets[i];
+
+        unsigned char typechar;
+        place = unpackTypecharFromIter(place, &typechar);
+
+        EntityRef ref = i + 1;
+        entities[i] = unpackFullEntityAndMoveIter(&place, typechar, this, ref);
+
+        if (ref == honeypotRefToUnpack)
+            honeypotGoldPileIfGameStarted = boost::dynamic_pointer_cast<GoldPile, Entity>(entities[i]);
+    }
+}
+void Game::unpackInParallelWithEntityOffsets(vchIter start, const vector<uint32_t> &entityOffsets, unsigned int numThreads)
+{
+    unpackHeaderWithEntityOffsets(start, entityOffsets);
+
+    numThreads = max(1u, min(numThreads, (unsigned int)(entities.size() / PARALLEL_PACK_MIN_ENTITIES_PER_THREAD)));
+
+    vector<thread> threads;
+    for (unsigned int t = 1; t < numThreads; t++)
+    {
+        EntityRef first = (entities.size() * t) / numThreads;
+        EntityRef count = (entities.size() * (t + 1)) / numThreads - first;
+        threads.push_back(thread([this, start, &entityOffsets, first, count]
+        {
+            unpackEntityRange(start, entityOffsets, first, count);
+        }));
+    }
+    // this thread takes the first range
+    unpackEntityRange(start, entityOffsets, 0, entities.size() / numThreads);
+
+    for (unsigned int t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
 }
 
-Game::Game() : state(Pregame), frame(0) {}
+Game::Game() : state(Pregame), frame(0), honeypotRefToUnpack(NULL_ENTITYREF) {}
 Game::Game(vchIter *iter)
 {
     unpackAndMoveIter(iter);
@@ -46,6 +46,7 @@ public:
     vector<Player> players;
     vector<boost::shared_ptr<Entity>> entities;
     boost::shared_ptr<GoldPile> honeypotGoldPileIfGameStarted;
+    EntityRef honeypotRefToUnpack; // set by unpackHeaderWithEntityOffsets for unpackEntityRange
 
     boost::shared_ptr<Entity> entityRefToPtrOrNull(EntityRef);
     EntityRef getNextEntityRef();
@@ -53,9 +54,23 @@ public:
     int playerAddressToIdOrNegativeOne(string address);
     string playerIdToAddress(uint playerId);
 
+    void packHeader(vch *dest);
+    void packEntityRange(vch *dest, EntityRef first, EntityRef count, vector<uint32_t> *entityOffsets);
     void pack(vch *dest);
+    void packAndRecordEntityOffsets(vch *dest, vector<uint32_t> *entityOffsets);
+    void unpackHeaderAndMoveIter(vchIter *iter);
     void unpackAndMoveIter(vchIter *iter);
 
+    // Same bytes and offsets as packAndRecordEntityOffsets, with ranges of entities packed on separate threads.
+    void packInParallelAndRecordEntityOffsets(vch *dest, vector<uint32_t> *entityOffsets, unsigned int numThreads);
+
+    // For bytes from pack(), along with the entity offsets recorded when packing them (relative to start).
+    // unpackHeader leaves every entity null; unpackEntityRange then fills in any range, independently of the others,
+    // so ranges can be unpacked in parallel or only as they're needed.
+    void unpackHeaderWithEntityOffsets(vchIter start, const vector<uint32_t> &entityOffsets);
+    void unpackEntityRange(vchIter start, const vector<uint32_t> &entityOffsets, EntityRef first, EntityRef count);
+    void unpackInParallelWithEntityOffsets(vchIter start, const vector<uint32_t> &entityOffsets, unsigned int numThreads);
+
     Game();
     Game(vchIter *);
     void startMatch();
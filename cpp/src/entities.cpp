@@ -372,12 +372,12 @@ void MobileUnit::packMobileUnit(vch *dest)
 {
     packUnit(dest);
     target.pack(dest);
-    packToVch(dest, "f", targetRange);
+    packFloat(dest, targetRange);
 }
 void MobileUnit::unpackMobileUnitAndMoveIter(vchIter *iter)
 {
     target = Target(iter);
-    *iter = unpackFromIter(*iter, "f", &targetRange);
+    *iter = unpackFloat(*iter, &targetRange);
 }
 
 MobileUnit::MobileUnit(Game *game, uint16_t ref, int ownerId, coinsInt totalCost, uint16_t health, vector2f pos)
@@ -473,7 +473,8 @@ void Prime::unpackAndMoveIter(vchIter *iter)
 Prime::Prime(Game *game, uint16_t ref, int ownerId, vector2f pos)
     : MobileUnit(game, ref, ownerId, PRIME_COST, PRIME_HEALTH, pos),
       heldGold(PRIME_MAX_GOLD_HELD),
-      state(Idle)
+      state(Idle),
+      gonnabuildTypechar(NULL_TYPECHAR)
 {}
 Prime::Prime(Game *game, uint16_t ref, vchIter *iter) : MobileUnit(game, ref, iter),
                                                         heldGold(PRIME_MAX_GOLD_HELD)
@@ -785,17 +786,27 @@ string Gateway::getTypeName() { return "Gateway"; }
 coinsInt Gateway::getCost() { return GATEWAY_COST; }
 uint16_t Gateway::getMaxHealth() { return GATEWAY_HEALTH; }
 
+// Everyone running the game has to put the new unit in the same spot, so it's scattered by its ref rather than rand().
+vector2f gatewaySpawnOffset(EntityRef newUnitRef)
+{
+    uint32_t scrambled = (uint32_t)newUnitRef * 2654435761u;
+    float angle = ((scrambled >> 16) / 65536.0) * M_PI * 2;
+    float magnitude = 20 + ((scrambled & 0xffff) / 65536.0) * (GATEWAY_RANGE - 20);
+    return composeVector2f(angle, magnitude);
+}
+
 void Gateway::cmdBuildUnit(unsigned char unitTypechar)
 {
-    vector2f newUnitPos = this->pos + randomVectorWithMagnitudeRange(20, GATEWAY_RANGE);
+    EntityRef newUnitRef = this->game->getNextEntityRef();
+    vector2f newUnitPos = this->pos + gatewaySpawnOffset(newUnitRef);
     boost::shared_ptr<Unit> littleBabyUnitAwwwwSoCute;
     switch (unitTypechar)
     {
         case PRIME_TYPECHAR:
-            littleBabyUnitAwwwwSoCute = boost::shared_ptr<Prime>(new Prime(this->game, this->game->getNextEntityRef(), this->ownerId, newUnitPos));
+            littleBabyUnitAwwwwSoCute = boost::shared_ptr<Prime>(new Prime(this->game, newUnitRef, this->ownerId, newUnitPos));
             break;
         case FIGHTER_TYPECHAR:
-            littleBabyUnitAwwwwSoCute = boost::shared_ptr<Fighter>(new Fighter(this->game, this->game->getNextEntityRef(), this->ownerId, newUnitPos));
+            littleBabyUnitAwwwwSoCute = boost::shared_ptr<Fighter>(new Fighter(this->game, newUnitRef, this->ownerId, newUnitPos));
             break;
         default:
             cout << "Gateway doesn't know how to build that unit..." << endl;
@@ -861,7 +872,7 @@ void Gateway::go()
         }
         else
         {
-            Coins* maybeCoinsToDepositTo;
+            Coins* maybeCoinsToDepositTo = NULL;
             boost::shared_ptr<Unit> maybeBuildingUnit;
             if (auto goldpile = boost::dynamic_pointer_cast<GoldPile, Entity>(maybeDepositingToEntity))
             {
@@ -896,6 +907,11 @@ void Gateway::go()
                     maybeDepositingToEntity.reset();
                 }
             }
+            else
+            {
+                // e.g. a unit that got finished some other way; nothing more to put in
+                maybeDepositingToEntity.reset();
+            }
         }
     }
     else
@@ -23,6 +23,9 @@ boost::shared_ptr<Event> unpackFullEventAndMoveIter(vchIter *iter)
     case EVENT_HONEYPOT_CHAR:
         return boost::shared_ptr<Event>(new HoneypotAddedEvent(iter));
         break;
+    case EVENT_PLAYERJOINED_CHAR:
+        return boost::shared_ptr<Event>(new PlayerJoinedEvent(iter));
+        break;
     default:
         throw runtime_error("Trying to unpack an unrecognized event");
     }
@@ -56,36 +59,58 @@ Event::Event(vchIter *iter)
     unpackEventAndMoveIter(iter);
 }
 
+unsigned char PlayerJoinedEvent::typechar()
+{
+    return EVENT_PLAYERJOINED_CHAR;
+}
+void PlayerJoinedEvent::execute(Game *game)
+{
+    if (game->playerAddressToIdOrNegativeOne(userAddress) != -1)
+    {
+        cout << "Woah, a player joined with an address that's already playing!" << endl;
+        return;
+    }
+
+    game->players.push_back(Player(userAddress));
+}
+void PlayerJoinedEvent::pack(vch *dest)
+{
+    packEvent(dest);
+
+    packStringToVch(dest, userAddress);
+}
+void PlayerJoinedEvent::unpackAndMoveIter(vchIter *iter)
+{
+    *iter = unpackStringFromIter(*iter, 50, &userAddress);
+}
+
+PlayerJoinedEvent::PlayerJoinedEvent(string userAddress)
+    : Event(), userAddress(userAddress) {}
+
+PlayerJoinedEvent::PlayerJoinedEvent(vchIter *iter)
+    : Event(iter)
+{
+    unpackAndMoveIter(iter);
+}
+
 unsigned char BalanceUpdateEvent::typechar()
 {
     return EVENT_BALANCEUPDATE_CHAR;
 }
 void BalanceUpdateEvent::execute(Game *game)
 {
-    if (isDeposit)
+    if (playerId >= game->players.size())
     {
-        // see if player exists for this address
-        int playerId = game->playerAddressToIdOrNegativeOne(userAddress);
-
-        // if no user for this address, create one
-        if (playerId == -1)
-        {
-            game->players.push_back(Player(userAddress));
-            playerId = game->players.size() - 1;
-        }
+        cout << "Woah, we're executing a balance update for a player I can't find!" << endl;
+        return;
+    }
 
+    if (isDeposit)
+    {
         game->players[playerId].credit.createMoreByFiat(amount);
     }
     else
     {
-        int playerId = game->playerAddressToIdOrNegativeOne(userAddress);
-
-        if (playerId == -1)
-        {
-            cout << "Woah, we're executing a deposit for an address I can't find!" << endl;
-            return;
-        }
-        
         game->players[playerId].credit.destroySomeByFiat(amount);
     }
 }
@@ -93,23 +118,22 @@ void BalanceUpdateEvent::pack(vch *dest)
 {
     packEvent(dest);
 
-    packStringToVch(dest, userAddress);
+    packToVch(dest, "C", playerId);
     packToVch(dest, "L", amount);
     packToVch(dest, "C", (unsigned char)isDeposit);
 }
 void BalanceUpdateEvent::unpackAndMoveIter(vchIter *iter)
 {
-    *iter = unpackStringFromIter(*iter, 50, &userAddress);
-    cout << "userAddress after unpack: " << userAddress << endl;
+    *iter = unpackFromIter(*iter, "C", &playerId);
     *iter = unpackFromIter(*iter, "L", &amount);
     unsigned char isDepositBoolChar;
     *iter = unpackFromIter(*iter, "C", &isDepositBoolChar);
     isDeposit = (bool)isDepositBoolChar;
 }
 
-BalanceUpdateEvent::BalanceUpdateEvent(string userAddress, coinsInt amount, bool isDeposit)
+BalanceUpdateEvent::BalanceUpdateEvent(uint8_t playerId, coinsInt amount, bool isDeposit)
     : Event(),
-      userAddress(userAddress), amount(amount), isDeposit(isDeposit) {}
+      playerId(playerId), amount(amount), isDeposit(isDeposit) {}
 
 BalanceUpdateEvent::BalanceUpdateEvent(vchIter *iter)
     : Event(iter)
@@ -10,6 +10,7 @@ using namespace std;
 
 const unsigned char EVENT_BALANCEUPDATE_CHAR = 1;
 const unsigned char EVENT_HONEYPOT_CHAR = 2;
+const unsigned char EVENT_PLAYERJOINED_CHAR = 3;
 
 struct Event;
 
@@ -29,9 +30,26 @@ struct Event
     Event(vchIter *iter);
 };
 
-struct BalanceUpdateEvent : public Event
+// Introduces a new address as the next entry in Game::players.
+// Everything else refers to players by that index, so the address only goes over the wire once.
+struct PlayerJoinedEvent : public Event
 {
     string userAddress;
+
+    unsigned char typechar();
+
+    void execute(Game *game);
+
+    void pack(vch *dest);
+    void unpackAndMoveIter(vchIter *iter);
+
+    PlayerJoinedEvent(string userAddress);
+    PlayerJoinedEvent(vchIter *iter);
+};
+
+struct BalanceUpdateEvent : public Event
+{
+    uint8_t playerId;
     coinsInt amount;
     bool isDeposit;
 
@@ -42,7 +60,7 @@ struct BalanceUpdateEvent : public Event
     void pack(vch *dest);
     void unpackAndMoveIter(vchIter *iter);
 
-    BalanceUpdateEvent(string userAddress, coinsInt amount, bool isDeposit);
+    BalanceUpdateEvent(uint8_t playerId, coinsInt amount, bool isDeposit);
     BalanceUpdateEvent(vchIter *iter);
 };
 
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <thread>
+#include <algorithm>
+#include "framescheduler.h"
+#include "config.h"
+
+using namespace std;
+
+bool FrameScheduler::frameDue()
+{
+    return chrono::steady_clock::now() >= nextFrameStart;
+}
+
+void FrameScheduler::waitUntilFrameDue(boost::asio::io_service *ioServiceOrNull)
+{
+    auto spinFrom = nextFrameStart - spinTail;
+
+    if (chrono::steady_clock::now() < spinFrom)
+    {
+        if (ioServiceOrNull)
+        {
+            ioServiceOrNull->run_until(chrono::time_point_cast<chrono::steady_clock::duration>(spinFrom));
+
+            // run_until returns early (and leaves the io_service stopped) if it runs out of work
+            if (ioServiceOrNull->stopped())
+                ioServiceOrNull->restart();
+        }
+        this_thread::sleep_until(spinFrom);
+    }
+
+    while (!frameDue())
+    {
+        if (ioServiceOrNull)
+        {
+            ioServiceOrNull->poll();
+            if (ioServiceOrNull->stopped())
+                ioServiceOrNull->restart();
+        }
+    }
+}
+
+void FrameScheduler::startFrame()
+{
+    chrono::duration<double, micro> lateness = chrono::steady_clock::now() - nextFrameStart;
+    nextFrameStart += ONE_FRAME;
+
+    if (reportInterval == 0)
+        return;
+
+    latenessSamples.push_back(lateness.count());
+    if (latenessSamples.size() >= reportInterval)
+    {
+        reportJitter();
+        latenessSamples.clear();
+    }
+}
+
+void FrameScheduler::reportJitter()
+{
+    sort(latenessSamples.begin(), latenessSamples.end());
+
+    double sum = 0;
+    for (unsigned int i = 0; i < latenessSamples.size(); i++)
+        sum += latenessSamples[i];
+
+    double mean = sum / latenessSamples.size();
+    double p99 = latenessSamples[(latenessSamples.size() * 99) / 100];
+    double max = latenessSamples.back();
+
+    cout << "frame start lateness over " << latenessSamples.size() << " frames (us): "
+         << "mean " << mean << ", p99 " << p99 << ", max " << max << endl;
+}
+
+FrameScheduler::FrameScheduler(chrono::microseconds spinTail, unsigned int reportInterval)
+    : nextFrameStart(chrono::steady_clock::now()), spinTail(spinTail), reportInterval(reportInterval) {}
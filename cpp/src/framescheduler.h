@@ -0,0 +1,34 @@
+#include <chrono>
+#include <vector>
+#include <boost/asio.hpp>
+
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+using namespace std;
+
+// Paces a loop at one frame per ONE_FRAME on steady_clock, without busy-spinning the whole time.
+// Keeps track of how late each frame starts and prints a summary every reportInterval frames (0 for never).
+class FrameScheduler
+{
+    chrono::time_point<chrono::steady_clock, chrono::duration<double>> nextFrameStart;
+    chrono::microseconds spinTail;
+
+    unsigned int reportInterval;
+    vector<double> latenessSamples; // in microseconds, since the last report
+
+    void reportJitter();
+public:
+    bool frameDue();
+
+    // Sleeps until spinTail before the next frame, then spins until it's due.
+    // If given an io_service, runs its handlers in the meantime instead of sleeping.
+    void waitUntilFrameDue(boost::asio::io_service *ioServiceOrNull);
+
+    // Call when starting the frame that's due; schedules the next one.
+    void startFrame();
+
+    FrameScheduler(chrono::microseconds spinTail, unsigned int reportInterval);
+};
+
+#endif // FRAMESCHEDULER_H
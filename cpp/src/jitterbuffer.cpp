@@ -0,0 +1,123 @@
+#include <cmath>
+#include <algorithm>
+#include "jitterbuffer.h"
+#include "config.h"
+
+using namespace std;
+
+void JitterBuffer::recordArrival(uint64_t frame)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+    // frames that don't move forward (Pregame, or a resync going back) say nothing about transit time
+    if (maybeLastArrival && frame > maybeLastArrival->second)
+    {
+        double framesSinceLastArrival = chrono::duration<double>(now - maybeLastArrival->first) / ONE_FRAME;
+        double difference = framesSinceLastArrival - (double)(frame - maybeLastArrival->second);
+
+        jitterFrames += (fabs(difference) - jitterFrames) / 16;
+    }
+    maybeLastArrival = {now, frame};
+}
+
+void JitterBuffer::push(FrameEventsPacket fcp)
+{
+    recordArrival(fcp.frame);
+
+    if (count == ring.size())
+    {
+        vector<FrameEventsPacket> grown;
+        grown.reserve(max((size_t)JITTER_BUFFER_INITIAL_CAPACITY, ring.size() * 2));
+        for (size_t i = 0; i < count; i++)
+        {
+            grown.push_back(ring[(head + i) % ring.size()]);
+        }
+        grown.resize(grown.capacity(), FrameEventsPacket(0, {}, {}));
+
+        ring.swap(grown);
+        head = 0;
+    }
+
+    ring[(head + count) % ring.size()] = fcp;
+    count++;
+}
+
+size_t JitterBuffer::size()
+{
+    return count;
+}
+
+FrameEventsPacket &JitterBuffer::front()
+{
+    return ring[head];
+}
+
+void JitterBuffer::popFront()
+{
+    // let go of the cmds and events it holds
+    ring[head] = FrameEventsPacket(0, {}, {});
+
+    head = (head + 1) % ring.size();
+    count--;
+}
+
+void JitterBuffer::dropFramesBefore(uint64_t frame)
+{
+    while (count > 0 && front().frame < frame)
+    {
+        popFront();
+    }
+}
+
+bool JitterBuffer::popFrameFor(uint64_t gameFrame, FrameEventsPacket *dest)
+{
+    dropFramesBefore(gameFrame);
+    if (count == 0)
+        return false;
+
+    *dest = front();
+    popFront();
+    return true;
+}
+
+double JitterBuffer::getJitterFrames()
+{
+    return jitterFrames;
+}
+
+unsigned int JitterBuffer::getTargetBacklog()
+{
+    unsigned int target = (unsigned int)ceil(jitterFrames * JITTER_BUFFER_JITTER_MULTIPLE);
+    return min(max(target, JITTER_BUFFER_MIN_TARGET_FRAMES), JITTER_BUFFER_MAX_TARGET_FRAMES);
+}
+
+unsigned int JitterBuffer::framesToPlayThisTick()
+{
+    smoothedBacklog += ((double)count - smoothedBacklog) / 8;
+
+    if (count == 0)
+    {
+        buffering = true;
+        return 0;
+    }
+
+    unsigned int target = getTargetBacklog();
+    if (buffering)
+    {
+        if (count < target)
+            return 0;
+        buffering = false;
+    }
+
+    // the backlog swings by a few frames as bursts come in, so only the smoothed one counts as too much
+    double excess = smoothedBacklog - target;
+    unsigned int frames = 1;
+    if (excess > JITTER_BUFFER_CATCHUP_SLACK)
+    {
+        frames = min(1 + (unsigned int)(excess / JITTER_BUFFER_CATCHUP_SLACK), JITTER_BUFFER_MAX_FRAMES_PER_TICK);
+    }
+    return min(frames, (unsigned int)count);
+}
+
+JitterBuffer::JitterBuffer()
+    : head(0), count(0), jitterFrames(0), smoothedBacklog(0), buffering(true) {}
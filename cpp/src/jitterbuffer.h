@@ -0,0 +1,49 @@
+#include <chrono>
+#include <vector>
+#include <optional>
+#include "packets.h"
+
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+using namespace std;
+
+// Holds received frames until the client plays them, keeping a small backlog in reserve
+// so that uneven arrival doesn't turn into uneven playback.
+// The backlog it aims for (the playout delay) follows a running estimate of arrival jitter, as in RFC 3550.
+// If more than that piles up, it plays several frames per tick until it's back down.
+class JitterBuffer
+{
+    // a ring buffer, grown when full; frames sit in order from head
+    vector<FrameEventsPacket> ring;
+    size_t head;
+    size_t count;
+
+    double jitterFrames;
+    double smoothedBacklog;
+    optional<pair<chrono::steady_clock::time_point, uint64_t>> maybeLastArrival;
+    // set after running dry; nothing gets played until the backlog is back up to the target
+    bool buffering;
+
+    void recordArrival(uint64_t frame);
+public:
+    void push(FrameEventsPacket fcp);
+    size_t size();
+    FrameEventsPacket &front();
+    void popFront();
+    void dropFramesBefore(uint64_t frame);
+    // Skips over any frames before gameFrame, then pops the next one into dest; false if there's none left.
+    // A resync is followed by frames from before its snapshot on, which land behind anything already buffered,
+    // so stale frames can turn up after fresh ones and not only at the front.
+    bool popFrameFor(uint64_t gameFrame, FrameEventsPacket *dest);
+
+    double getJitterFrames();
+    unsigned int getTargetBacklog();
+
+    // Call once per display tick; says how many frames to play this tick (possibly 0).
+    unsigned int framesToPlayThisTick();
+
+    JitterBuffer();
+};
+
+#endif // JITTERBUFFER_H
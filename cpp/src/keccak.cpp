@@ -0,0 +1,131 @@
+#include <cstring>
+#include "keccak.h"
+
+using namespace std;
+
+const uint64_t KECCAK_ROUND_CONSTANTS[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL, 0x8000000080008000ULL,
+    0x000000000000808bULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008aULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800aULL, 0x800000008000000aULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+// rotation amounts and destination lanes for the combined rho and pi steps, following lane 1 around
+const unsigned int KECCAK_RHO_OFFSETS[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44
+};
+const unsigned int KECCAK_PI_LANES[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1
+};
+
+const size_t KECCAK_256_RATE = 136;
+
+uint64_t rotl64(uint64_t x, unsigned int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+void keccakF1600(uint64_t state[25])
+{
+    for (unsigned int round = 0; round < 24; round++)
+    {
+        // theta
+        uint64_t c[5];
+        for (unsigned int x = 0; x < 5; x++)
+            c[x] = state[x] ^ state[x + 5] ^ state[x + 10] ^ state[x + 15] ^ state[x + 20];
+        for (unsigned int x = 0; x < 5; x++)
+        {
+            uint64_t d = c[(x + 4) % 5] ^ rotl64(c[(x + 1) % 5], 1);
+            for (unsigned int y = 0; y < 25; y += 5)
+                state[y + x] ^= d;
+        }
+
+        // rho and pi
+        uint64_t carried = state[1];
+        for (unsigned int i = 0; i < 24; i++)
+        {
+            unsigned int lane = KECCAK_PI_LANES[i];
+            uint64_t displaced = state[lane];
+            state[lane] = rotl64(carried, KECCAK_RHO_OFFSETS[i]);
+            carried = displaced;
+        }
+
+        // chi
+        for (unsigned int y = 0; y < 25; y += 5)
+        {
+            uint64_t row[5];
+            for (unsigned int x = 0; x < 5; x++)
+                row[x] = state[y + x];
+            for (unsigned int x = 0; x < 5; x++)
+                state[y + x] = row[x] ^ (~row[(x + 1) % 5] & row[(x + 2) % 5]);
+        }
+
+        // iota
+        state[0] ^= KECCAK_ROUND_CONSTANTS[round];
+    }
+}
+
+// lanes are little-endian regardless of the host
+void absorbBlock(uint64_t state[25], const unsigned char *block)
+{
+    for (size_t i = 0; i < KECCAK_256_RATE / 8; i++)
+    {
+        uint64_t lane = 0;
+        for (unsigned int b = 0; b < 8; b++)
+            lane |= (uint64_t)block[i * 8 + b] << (8 * b);
+        state[i] ^= lane;
+    }
+    keccakF1600(state);
+}
+
+vch keccak256(const unsigned char *data, size_t size)
+{
+    uint64_t state[25] = {0};
+
+    while (size >= KECCAK_256_RATE)
+    {
+        absorbBlock(state, data);
+        data += KECCAK_256_RATE;
+        size -= KECCAK_256_RATE;
+    }
+
+    unsigned char lastBlock[KECCAK_256_RATE] = {0};
+    memcpy(lastBlock, data, size);
+    lastBlock[size] ^= 0x01;
+    lastBlock[KECCAK_256_RATE - 1] ^= 0x80;
+    absorbBlock(state, lastBlock);
+
+    vch hash(32);
+    for (unsigned int i = 0; i < 32; i++)
+        hash[i] = (unsigned char)(state[i / 8] >> (8 * (i % 8)));
+    return hash;
+}
+
+vch keccak256(const vch &data)
+{
+    return keccak256(data.data(), data.size());
+}
+
+vch keccak256(string s)
+{
+    return keccak256((const unsigned char*)s.data(), s.size());
+}
+
+vch hmacKeccak256(const vch &key, const vch &message)
+{
+    vch blockKey = key.size() > KECCAK_256_RATE ? keccak256(key) : key;
+    blockKey.resize(KECCAK_256_RATE, 0);
+
+    vch inner, outer;
+    for (size_t i = 0; i < KECCAK_256_RATE; i++)
+    {
+        inner.push_back(blockKey[i] ^ 0x36);
+        outer.push_back(blockKey[i] ^ 0x5c);
+    }
+    inner.insert(inner.end(), message.begin(), message.end());
+    vch innerHash = keccak256(inner);
+    outer.insert(outer.end(), innerHash.begin(), innerHash.end());
+    return keccak256(outer);
+}
@@ -0,0 +1,17 @@
+#include <string>
+#include "common.h"
+
+#ifndef KECCAK_H
+#define KECCAK_H
+
+using namespace std;
+
+// Ethereum's Keccak-256: the original Keccak padding, not the one SHA3-256 ended up with.
+vch keccak256(const unsigned char *data, size_t size);
+vch keccak256(const vch &data);
+vch keccak256(string s);
+
+// HMAC (RFC 2104) with Keccak-256 as the hash
+vch hmacKeccak256(const vch &key, const vch &message);
+
+#endif // KECCAK_H
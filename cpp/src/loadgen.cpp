@@ -0,0 +1,690 @@
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <random>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <vector>
+#include <deque>
+#include <string>
+#include "config.h"
+#include "cmds.h"
+#include "engine.h"
+#include "common.h"
+#include "packets.h"
+#include "events.h"
+#include "compression.h"
+#include "framescheduler.h"
+#include "sigWrapper.h"
+#include "keccak.h"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+// Puts a server under the load of many players, without needing the players.
+// Usage: loadgen <server ip> [options]
+//   --port P                server port (8473)
+//   --bots N                how many connections to open (10)
+//   --replicas N            how many of the bots keep their own replica of the game (1).
+//                           The rest pick their units from the first replica; with none, cmds name random entity refs.
+//   --cmds-per-second R     per bot, at random intervals (1)
+//   --seconds S             how long to run (60; 0 to run until killed)
+//   --report-every S        seconds between reports (5)
+//   --login keys|admin      keys (the default): each bot signs the challenge with a test key derived from its index,
+//                           so it has an address of its own. admin: log in as "admin", as a local test client would;
+//                           only the first to do so gets the admin address, so the rest's cmds are dropped.
+//   --deposit-dir D         fund every bot by writing a deposit file into D (the server's accounting/pending_deposits)
+//   --deposit-eth X         how much each bot deposits (10)
+//   --honeypot-eth X        also add this much to the honeypot after the deposits, which starts a match if none has (0)
+//   --options F             CONNECTION_OPTION_* flags to ask for (default: the same as the client)
+// Everything runs on one thread, paced by a FrameScheduler.
+
+boost::asio::io_service ioService;
+mt19937 randomGen(0);
+
+chrono::steady_clock::time_point startTime;
+
+double msSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+const double ONE_FRAME_MS = chrono::duration<double, milli>(ONE_FRAME).count();
+
+// everything counted across all bots since the last report
+struct Stats
+{
+    vector<double> frameInterarrivalsMs; // time since the bot's previous frame arrived; 0 for the rest of a bundle
+    vector<uint64_t> resyncSizes; // as received, header included
+    uint64_t bytesReceived;
+    uint64_t packetsReceived;
+    uint64_t framesReceived;
+    uint64_t cmdsSent;
+
+    Stats() : bytesReceived(0), packetsReceived(0), framesReceived(0), cmdsSent(0) {}
+} stats;
+
+vch botPrivKey(unsigned int index)
+{
+    return keccak256("coinfight loadgen bot " + to_string(index));
+}
+
+void clearVchAndBuildCmdPacket(vch *dest, boost::shared_ptr<Cmd> cmd)
+{
+    dest->clear();
+
+    packTypechar(dest, CLIENT_PACKET_CMD_CHAR);
+    packTypechar(dest, cmd->getTypechar());
+    cmd->pack(dest);
+
+    vch prepended;
+    packToVch(&prepended, "H", (uint16_t)(dest->size()));
+
+    dest->insert(dest->begin(), prepended.begin(), prepended.end());
+}
+void clearVchAndBuildClientPacket(vch *dest, Packet *packet)
+{
+    dest->clear();
+
+    packTypechar(dest, packet->typechar());
+    packet->pack(dest);
+
+    vch prepended;
+    packToVch(&prepended, "H", (uint16_t)(dest->size()));
+
+    dest->insert(dest->begin(), prepended.begin(), prepended.end());
+}
+
+vector2f randomPosNear(vector2f center, float radius)
+{
+    uniform_real_distribution<float> angle(0, 2 * M_PI), distance(0, radius);
+    float a = angle(randomGen), d = distance(randomGen);
+    return center + vector2f(cos(a) * d, sin(a) * d);
+}
+
+template<class T> T pickRandom(const vector<T> &from)
+{
+    return from[uniform_int_distribution<size_t>(0, from.size() - 1)(randomGen)];
+}
+
+// A random Move, Attack, Pickup or Build for the player's units, or null if it has none.
+boost::shared_ptr<Cmd> makeRandomCmd(Game *game, int playerId)
+{
+    vector<EntityRef> primes, fighters, gateways, goldPiles, enemies;
+    for (unsigned int i = 0; i < game->entities.size(); i++)
+    {
+        boost::shared_ptr<Entity> entity = game->entities[i];
+        if (!entity || entity->dead)
+            continue;
+
+        if (entity->typechar() == GOLDPILE_TYPECHAR)
+        {
+            goldPiles.push_back(entity->ref);
+        }
+        else if (auto unit = boost::dynamic_pointer_cast<Unit, Entity>(entity))
+        {
+            if (unit->ownerId != playerId)
+                enemies.push_back(unit->ref);
+            else if (unit->typechar() == PRIME_TYPECHAR)
+                primes.push_back(unit->ref);
+            else if (unit->typechar() == FIGHTER_TYPECHAR)
+                fighters.push_back(unit->ref);
+            else if (unit->typechar() == GATEWAY_TYPECHAR)
+                gateways.push_back(unit->ref);
+        }
+    }
+
+    vector<EntityRef> mobileUnits(primes);
+    mobileUnits.insert(mobileUnits.end(), fighters.begin(), fighters.end());
+    if (mobileUnits.empty() && gateways.empty())
+        return boost::shared_ptr<Cmd>();
+
+    // a handful of units at a time, like a player dragging a box
+    vector<EntityRef> chosen;
+    if (!mobileUnits.empty())
+    {
+        shuffle(mobileUnits.begin(), mobileUnits.end(), randomGen);
+        chosen.assign(mobileUnits.begin(), mobileUnits.begin() + min<size_t>(mobileUnits.size(), 1 + randomGen() % 8));
+    }
+
+    switch (randomGen() % 4)
+    {
+    case 1:
+        if (!enemies.empty() && !chosen.empty())
+            return boost::shared_ptr<Cmd>(new AttackCmd(chosen, pickRandom(enemies)));
+        break;
+    case 2:
+        if (!goldPiles.empty() && !primes.empty())
+            return boost::shared_ptr<Cmd>(new PickupCmd({pickRandom(primes)}, pickRandom(goldPiles)));
+        break;
+    case 3:
+        if (!gateways.empty())
+            return boost::shared_ptr<Cmd>(new GatewayBuildCmd({pickRandom(gateways)}, randomGen() % 2 ? PRIME_TYPECHAR : FIGHTER_TYPECHAR));
+        if (!primes.empty())
+        {
+            EntityRef prime = pickRandom(primes);
+            vector2f buildPos = randomPosNear(entityRefToPtrOrNull(*game, prime)->pos, 200);
+            return boost::shared_ptr<Cmd>(new PrimeBuildCmd({prime}, GATEWAY_TYPECHAR, buildPos));
+        }
+        break;
+    }
+
+    if (chosen.empty())
+        return boost::shared_ptr<Cmd>();
+    vector2f center = entityRefToPtrOrNull(*game, chosen[0])->pos;
+    return boost::shared_ptr<Cmd>(new MoveCmd(chosen, randomPosNear(center, 500)));
+}
+
+// Without any game to look at, cmds can still make the server unpack them and look the units up.
+boost::shared_ptr<Cmd> makeBlindCmd()
+{
+    vector<EntityRef> units;
+    for (unsigned int i = 0; i < 1 + randomGen() % 8; i++)
+        units.push_back(1 + randomGen() % 1000);
+    return boost::shared_ptr<Cmd>(new MoveCmd(units, randomPosNear(vector2f(0, 0), 2000)));
+}
+
+class Bot
+{
+    unsigned int index;
+    tcp::socket socket;
+    bool keepsReplica;
+
+    vch receivedBytes;
+    unsigned char receivedTypechar;
+    bool receivedCompressed;
+
+    // everything queued goes out in one gather write; the first numPacketsSending are in flight
+    deque<vch *> packetsToSend;
+    size_t numPacketsSending;
+
+    // frames before this have been counted already (or, with implicit frames, will never come)
+    optional<uint64_t> maybeNextFrameExpected;
+    optional<chrono::steady_clock::time_point> maybeLastFrameArrival;
+
+    void sendNextPacketsIfNotBusy()
+    {
+        if (closed || numPacketsSending > 0 || packetsToSend.size() == 0)
+            return;
+
+        vector<boost::asio::const_buffer> buffers;
+        for (unsigned int i = 0; i < packetsToSend.size(); i++)
+        {
+            buffers.push_back(boost::asio::buffer(*packetsToSend[i]));
+        }
+        numPacketsSending = packetsToSend.size();
+
+        boost::asio::async_write(socket,
+                                 buffers,
+                                 boost::bind(&Bot::wrapUpSendingPackets,
+                                             this,
+                                             boost::asio::placeholders::error,
+                                             boost::asio::placeholders::bytes_transferred));
+    }
+
+    void wrapUpSendingPackets(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            connectionErrored("Error sending", error);
+            return;
+        }
+
+        for (unsigned int i = 0; i < numPacketsSending; i++)
+        {
+            delete packetsToSend.front();
+            packetsToSend.pop_front();
+        }
+        numPacketsSending = 0;
+
+        sendNextPacketsIfNotBusy();
+    }
+
+    void queueClientPacket(Packet *packet)
+    {
+        packetsToSend.push_back(new vch);
+        clearVchAndBuildClientPacket(packetsToSend.back(), packet);
+        sendNextPacketsIfNotBusy();
+    }
+
+    void connectionErrored(string what, const boost::system::error_code &error)
+    {
+        if (!closed)
+            cout << "Bot " << index << ": " << what << ": " << error.message() << endl;
+        closed = true;
+    }
+
+    void receiveNextPacketHeader()
+    {
+        receivedBytes = vch(PACKET_HEADER_SIZE);
+        boost::asio::async_read(socket,
+                                boost::asio::buffer(receivedBytes),
+                                boost::bind(&Bot::packetHeaderReceived,
+                                            this,
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void packetHeaderReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            connectionErrored("Error receiving packet header", error);
+            return;
+        }
+
+        uint64_t size;
+        unpackFromIter(receivedBytes.begin(), "CQ", &receivedTypechar, &size);
+        receivedCompressed = receivedTypechar & PACKET_COMPRESSED_FLAG;
+        receivedTypechar &= ~PACKET_COMPRESSED_FLAG;
+
+        receivedBytes = vch(size);
+        boost::asio::async_read(socket,
+                                boost::asio::buffer(receivedBytes),
+                                boost::bind(&Bot::packetBodyReceived,
+                                            this,
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void packetBodyReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            connectionErrored("Error receiving packet body", error);
+            return;
+        }
+
+        stats.packetsReceived++;
+        stats.bytesReceived += PACKET_HEADER_SIZE + receivedBytes.size();
+
+        if (receivedTypechar == PACKET_RESYNC_CHAR)
+            stats.resyncSizes.push_back(PACKET_HEADER_SIZE + receivedBytes.size());
+
+        // a bot without a replica only needs the frame numbers out of a resync, so doesn't unpack it
+        if (receivedTypechar == PACKET_RESYNC_CHAR && !keepsReplica)
+        {
+            receiveNextPacketHeader();
+            return;
+        }
+
+        if (receivedCompressed)
+        {
+            vch decompressed;
+            if (!decompressToVch(&decompressed, receivedBytes.data(), receivedBytes.size()))
+                throw runtime_error("Bot " + to_string(index) + " received a compressed packet that didn't decompress");
+            receivedBytes.swap(decompressed);
+        }
+        vchIter place = receivedBytes.begin();
+
+        switch (receivedTypechar)
+        {
+        case PACKET_RESYNC_CHAR:
+            game = Game(&place);
+            game.reassignEntityGamePointers();
+            haveGame = true;
+            break;
+
+        case PACKET_FRAMECMDS_CHAR:
+        {
+            FrameEventsPacket fcp(&place);
+            framesArrivedThrough(fcp.frame);
+            if (keepsReplica)
+                runReplicaThrough(&fcp);
+            break;
+        }
+
+        case PACKET_FRAMEBUNDLE_CHAR:
+        {
+            vector<FrameEventsPacket> frames;
+            unpackFrameBundleAndMoveIter(&place, &frames);
+            framesArrivedThrough(frames.back().frame);
+            if (keepsReplica)
+            {
+                for (unsigned int i = 0; i < frames.size(); i++)
+                    runReplicaThrough(&frames[i]);
+            }
+            break;
+        }
+
+        case PACKET_FRAMETICK_CHAR:
+        {
+            uint64_t lastEmptyFrame;
+            unpackFromIter(place, "Q", &lastEmptyFrame);
+            framesArrivedThrough(lastEmptyFrame);
+            if (keepsReplica)
+                runReplicaEmptyFramesBefore(lastEmptyFrame + 1);
+            break;
+        }
+
+        case PACKET_PING_CHAR:
+        {
+            uint64_t pingFrame;
+            unpackFromIter(place, "Q", &pingFrame);
+            PongPacket pong(pingFrame);
+            queueClientPacket(&pong);
+            break;
+        }
+        }
+
+        receiveNextPacketHeader();
+    }
+
+    // Everything up to frame has now arrived, including any empty frames it implies.
+    void framesArrivedThrough(uint64_t frame)
+    {
+        // frames resent after a resync, or repeated during Pregame, were counted the first time
+        if (maybeNextFrameExpected && frame < *maybeNextFrameExpected)
+            return;
+        uint64_t firstFrame = maybeNextFrameExpected ? *maybeNextFrameExpected : frame;
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        for (uint64_t f = firstFrame; f <= frame; f++)
+        {
+            // how far behind the frame's place on a steady ONE_FRAME schedule it arrived, before taking out this bot's best
+            double offsetMs = chrono::duration<double, milli>(now - startTime).count() - f * ONE_FRAME_MS;
+            frameOffsetsMs.push_back(offsetMs);
+            if (!maybeMinFrameOffsetMs || offsetMs < *maybeMinFrameOffsetMs)
+                maybeMinFrameOffsetMs = offsetMs;
+
+            double interarrivalMs = 0;
+            if (f == firstFrame && maybeLastFrameArrival)
+                interarrivalMs = chrono::duration<double, milli>(now - *maybeLastFrameArrival).count();
+            if (f != firstFrame || maybeLastFrameArrival)
+                stats.frameInterarrivalsMs.push_back(interarrivalMs);
+        }
+        stats.framesReceived += frame + 1 - firstFrame;
+
+        maybeLastFrameArrival = now;
+        maybeNextFrameExpected = frame + 1;
+    }
+
+    // With implicit frames, the frames the server skipped over were empty.
+    void runReplicaEmptyFramesBefore(uint64_t frame)
+    {
+        if (!haveGame)
+            return;
+        while (game.state == Game::Active && game.frame < frame)
+        {
+            FrameEventsPacket emptyFrame(game.frame, {}, {});
+            runFrameAsClient(&game, &emptyFrame, &cmdSchedule);
+            cmdSchedule.dropCmdsBefore(game.frame);
+        }
+    }
+
+    void runReplicaThrough(FrameEventsPacket *fcp)
+    {
+        cmdSchedule.addFromPacket(fcp);
+        if (!haveGame)
+            return;
+
+        runReplicaEmptyFramesBefore(fcp->frame);
+        // the frames following a resync start before it, just to announce cmds
+        if (fcp->frame == game.frame)
+        {
+            runFrameAsClient(&game, fcp, &cmdSchedule);
+            cmdSchedule.dropCmdsBefore(game.frame);
+        }
+    }
+
+public:
+    string address;
+    bool closed;
+
+    Game game;
+    bool haveGame;
+    CmdSchedule cmdSchedule;
+
+    chrono::steady_clock::time_point nextCmdTime;
+
+    // since the last report
+    vector<double> frameOffsetsMs;
+    // over the whole run; the offset of a frame that made it with no delay beyond the network's
+    optional<double> maybeMinFrameOffsetMs;
+
+    Bot(unsigned int index, bool keepsReplica)
+        : index(index), socket(ioService), keepsReplica(keepsReplica), numPacketsSending(0), closed(false), haveGame(false) {}
+
+    // The handshake is done blocking, one bot at a time, like the client does it.
+    void connectAndLogIn(tcp::endpoint endpoint, bool useAdminLogin, unsigned char connectionOptions)
+    {
+        socket.connect(endpoint);
+
+        vch challengeBytes(50);
+        boost::asio::read(socket, boost::asio::buffer(challengeBytes));
+        string challenge(challengeBytes.begin(), challengeBytes.end());
+
+        string response = "admin";
+        if (!useAdminLogin)
+            response = *signMessage(challenge, botPrivKey(index));
+        boost::asio::write(socket, boost::asio::buffer(response + "\n"));
+
+        vch addressBytes(42);
+        boost::asio::read(socket, boost::asio::buffer(addressBytes));
+        address = string(addressBytes.begin(), addressBytes.end());
+
+        ConnectionOptionsPacket options(connectionOptions);
+        queueClientPacket(&options);
+        receiveNextPacketHeader();
+    }
+
+    void sendCmd(boost::shared_ptr<Cmd> cmd)
+    {
+        packetsToSend.push_back(new vch);
+        clearVchAndBuildCmdPacket(packetsToSend.back(), cmd);
+        sendNextPacketsIfNotBusy();
+        stats.cmdsSent++;
+    }
+
+    ~Bot()
+    {
+        for (unsigned int i = 0; i < packetsToSend.size(); i++)
+            delete packetsToSend[i];
+    }
+};
+
+// to a millionth of an ether, without going through a double that can't hold wei
+string ethToWeiString(double eth)
+{
+    return to_string((uint64_t)(eth * 1000000)) + "000000000000";
+}
+
+// All the bots' deposits in one file, in the format the server's deposit poller reads.
+// Written next to the directory first, so the server never sees it half written.
+void writeDepositFile(string depositDir, const vector<string> &addresses, double depositEth, double honeypotEth)
+{
+    boost::filesystem::path dirPath(depositDir);
+    boost::filesystem::path tempPath = dirPath.parent_path() / "loadgen_deposits.tmp";
+    boost::filesystem::path finalPath = dirPath / ("loadgen_" + to_string(time(NULL)) + ".dat");
+
+    ofstream depositFile(tempPath.string());
+    for (unsigned int i = 0; i < addresses.size(); i++)
+        depositFile << addresses[i] << " " << ethToWeiString(depositEth) << "\n";
+    if (honeypotEth > 0)
+        depositFile << "honeypot " << ethToWeiString(honeypotEth) << "\n";
+    depositFile.close();
+    if (!depositFile)
+        throw runtime_error("Couldn't write deposit file " + tempPath.string());
+
+    boost::filesystem::rename(tempPath, finalPath);
+    cout << "Deposited " << depositEth << " for each of " << addresses.size() << " bots in " << finalPath.string() << endl;
+}
+
+template<class T> T percentile(vector<T> *sorted, unsigned int percent)
+{
+    if (sorted->empty())
+        return 0;
+    return (*sorted)[min(sorted->size() - 1, (sorted->size() * percent) / 100)];
+}
+
+void report(vector<boost::shared_ptr<Bot>> *bots, double seconds)
+{
+    vector<double> delaysMs;
+    unsigned int connected = 0;
+    for (unsigned int i = 0; i < bots->size(); i++)
+    {
+        Bot *bot = (*bots)[i].get();
+        if (!bot->closed)
+            connected++;
+        for (unsigned int j = 0; j < bot->frameOffsetsMs.size(); j++)
+            delaysMs.push_back(bot->frameOffsetsMs[j] - *bot->maybeMinFrameOffsetMs);
+        bot->frameOffsetsMs.clear();
+    }
+    sort(delaysMs.begin(), delaysMs.end());
+    sort(stats.frameInterarrivalsMs.begin(), stats.frameInterarrivalsMs.end());
+    sort(stats.resyncSizes.begin(), stats.resyncSizes.end());
+
+    printf("--- %.0fs, %u/%lu bots connected\n", msSince(startTime) / 1000, connected, bots->size());
+    printf("  received %.1f KB/s (%.1f per bot), %.0f packets/s, %.0f frames/s; sent %.1f cmds/s\n",
+           stats.bytesReceived / seconds / 1024,
+           stats.bytesReceived / seconds / 1024 / max(1u, connected),
+           stats.packetsReceived / seconds,
+           stats.framesReceived / seconds,
+           stats.cmdsSent / seconds);
+    printf("  frame delivery delay (ms past best):  p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f\n",
+           percentile(&delaysMs, 50), percentile(&delaysMs, 90), percentile(&delaysMs, 99),
+           delaysMs.empty() ? 0 : delaysMs.back());
+    printf("  frame interarrival (ms):              p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f\n",
+           percentile(&stats.frameInterarrivalsMs, 50), percentile(&stats.frameInterarrivalsMs, 90),
+           percentile(&stats.frameInterarrivalsMs, 99),
+           stats.frameInterarrivalsMs.empty() ? 0 : stats.frameInterarrivalsMs.back());
+    if (!stats.resyncSizes.empty())
+        printf("  %lu resyncs (bytes):  min %lu  p50 %lu  max %lu\n",
+               stats.resyncSizes.size(), stats.resyncSizes.front(), percentile(&stats.resyncSizes, 50), stats.resyncSizes.back());
+
+    stats = Stats();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: loadgen <server ip> [--port P] [--bots N] [--replicas N] [--cmds-per-second R] [--seconds S]" << endl
+             << "               [--report-every S] [--login keys|admin] [--deposit-dir D] [--deposit-eth X]" << endl
+             << "               [--honeypot-eth X] [--options F]" << endl;
+        return 1;
+    }
+    string serverIp = argv[1];
+    unsigned short port = 8473;
+    unsigned int numBots = 10;
+    unsigned int numReplicas = 1;
+    double cmdsPerSecond = 1;
+    double runSeconds = 60;
+    double reportSeconds = 5;
+    bool useAdminLogin = false;
+    string depositDir;
+    double depositEth = 10;
+    double honeypotEth = 0;
+    unsigned char connectionOptions = CONNECTION_OPTION_COMPRESSION | CONNECTION_OPTION_FRAME_BUNDLES | CONNECTION_OPTION_IMPLICIT_FRAMES;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--port")
+            port = stoi(value);
+        else if (flag == "--bots")
+            numBots = stoi(value);
+        else if (flag == "--replicas")
+            numReplicas = stoi(value);
+        else if (flag == "--cmds-per-second")
+            cmdsPerSecond = stod(value);
+        else if (flag == "--seconds")
+            runSeconds = stod(value);
+        else if (flag == "--report-every")
+            reportSeconds = stod(value);
+        else if (flag == "--login")
+            useAdminLogin = (value == "admin");
+        else if (flag == "--deposit-dir")
+            depositDir = value;
+        else if (flag == "--deposit-eth")
+            depositEth = stod(value);
+        else if (flag == "--honeypot-eth")
+            honeypotEth = stod(value);
+        else if (flag == "--options")
+            connectionOptions = stoi(value);
+        else
+        {
+            cout << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    tcp::endpoint serverEndpoint(boost::asio::ip::address::from_string(serverIp), port);
+
+    if (!depositDir.empty() && !useAdminLogin)
+    {
+        vector<string> addresses;
+        for (unsigned int i = 0; i < numBots; i++)
+            addresses.push_back(*privKeyToAddress(botPrivKey(i)));
+        writeDepositFile(depositDir, addresses, depositEth, honeypotEth);
+    }
+
+    // frame delivery is measured against a schedule starting here, so only its spread between frames means anything
+    startTime = chrono::steady_clock::now();
+
+    vector<boost::shared_ptr<Bot>> bots;
+    for (unsigned int i = 0; i < numBots; i++)
+    {
+        bots.push_back(boost::shared_ptr<Bot>(new Bot(i, i < numReplicas)));
+        bots.back()->connectAndLogIn(serverEndpoint, useAdminLogin, connectionOptions);
+        // keep up with what's come in so far while the rest log in
+        ioService.poll();
+        if (ioService.stopped())
+            ioService.restart();
+    }
+    cout << numBots << " bots logged in, " << min(numBots, numReplicas) << " with replicas." << endl;
+
+    exponential_distribution<double> secondsBetweenCmds(cmdsPerSecond > 0 ? cmdsPerSecond : 1);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < bots.size(); i++)
+        bots[i]->nextCmdTime = now + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(secondsBetweenCmds(randomGen)));
+
+    // stats are per report, so the logins don't count towards the first
+    stats = Stats();
+    chrono::steady_clock::time_point lastReportTime = chrono::steady_clock::now();
+
+    FrameScheduler frameScheduler(FRAME_SPIN_TAIL, 0);
+    while (true)
+    {
+        frameScheduler.waitUntilFrameDue(&ioService);
+        frameScheduler.startFrame();
+
+        Game *referenceGameOrNull = (numReplicas > 0 && bots[0]->haveGame) ? &bots[0]->game : NULL;
+
+        now = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < bots.size(); i++)
+        {
+            Bot *bot = bots[i].get();
+            if (bot->closed || cmdsPerSecond <= 0)
+                continue;
+
+            while (bot->nextCmdTime <= now)
+            {
+                bot->nextCmdTime += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(secondsBetweenCmds(randomGen)));
+
+                Game *gameOrNull = bot->haveGame ? &bot->game : referenceGameOrNull;
+                boost::shared_ptr<Cmd> cmd;
+                if (!gameOrNull)
+                    cmd = makeBlindCmd();
+                else if (gameOrNull->state == Game::Active)
+                    cmd = makeRandomCmd(gameOrNull, gameOrNull->playerAddressToIdOrNegativeOne(bot->address));
+
+                if (cmd)
+                    bot->sendCmd(cmd);
+            }
+        }
+
+        bool finished = runSeconds > 0 && msSince(startTime) >= runSeconds * 1000;
+        double sinceReportSeconds = msSince(lastReportTime) / 1000;
+        if (finished || sinceReportSeconds >= reportSeconds)
+        {
+            report(&bots, sinceReportSeconds);
+            lastReportTime = chrono::steady_clock::now();
+        }
+        if (finished)
+            return 0;
+    }
+}
@@ -0,0 +1,55 @@
+#include <atomic>
+#include <vector>
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+using namespace std;
+
+// Lock-free queue for any number of producer threads and a single consumer.
+// Producers push onto a linked stack with a CAS; the consumer takes the whole stack in one exchange
+// and reverses it, so items come out in the order they were pushed.
+// Since the consumer never pops single nodes, there's no ABA problem to worry about.
+template<class T> class MPSCQueue
+{
+    struct Node
+    {
+        T item;
+        Node *next;
+        Node(T item) : item(item), next(NULL) {}
+    };
+    atomic<Node*> head;
+
+public:
+    void push(T item)
+    {
+        Node *node = new Node(item);
+        node->next = head.load(memory_order_relaxed);
+        while (!head.compare_exchange_weak(node->next, node, memory_order_release, memory_order_relaxed));
+    }
+
+    // Only to be called from the consumer thread.
+    vector<T> drain()
+    {
+        Node *node = head.exchange(NULL, memory_order_acquire);
+
+        vector<T> items;
+        while (node)
+        {
+            items.push_back(node->item);
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+
+        return vector<T>(items.rbegin(), items.rend());
+    }
+
+    MPSCQueue() : head(NULL) {}
+    ~MPSCQueue()
+    {
+        drain();
+    }
+};
+
+#endif // MPSCQUEUE_H
@@ -1,3 +1,4 @@
+#include <iostream>
 #include "packets.h"
 #include "events.h"
 
@@ -24,6 +25,9 @@ Packet::Packet(vchIter *iter)
     unpackPacketAndMoveIter(iter);
 }
 
+ScheduledCmd::ScheduledCmd(uint64_t executeFrame, boost::shared_ptr<AuthdCmd> authdCmd)
+    : executeFrame(executeFrame), authdCmd(authdCmd) {}
+
 unsigned char FrameEventsPacket::typechar()
 {
     return PACKET_FRAMECMDS_CHAR;
@@ -32,11 +36,16 @@ void FrameEventsPacket::pack(vch *dest)
 {
     packPacket(dest);
 
-    packToVch(dest, "QCC", frame, (unsigned char)(authdCmds.size()), (unsigned char)(events.size()));
+    packToVch(dest, "Q", frame);
+    packCmdsAndEvents(dest);
+}
+void FrameEventsPacket::packCmdsAndEvents(vch *dest)
+{
+    packToVch(dest, "HHH", (uint16_t)(authdCmds.size()), (uint16_t)(events.size()), (uint16_t)(scheduledCmds.size()));
 
     for (unsigned int i = 0; i < authdCmds.size(); i++)
     {
-        packStringToVch(dest, authdCmds[i]->playerAddress);
+        packToVch(dest, "C", authdCmds[i]->playerId);
         packTypechar(dest, authdCmds[i]->cmd->getTypechar());
         authdCmds[i]->cmd->pack(dest);
     }
@@ -46,21 +55,33 @@ void FrameEventsPacket::pack(vch *dest)
         packTypechar(dest, events[i]->typechar());
         events[i]->pack(dest);
     }
+
+    for (unsigned int i = 0; i < scheduledCmds.size(); i++)
+    {
+        packToVch(dest, "CC", (unsigned char)(scheduledCmds[i].executeFrame - frame), scheduledCmds[i].authdCmd->playerId);
+        packTypechar(dest, scheduledCmds[i].authdCmd->cmd->getTypechar());
+        scheduledCmds[i].authdCmd->cmd->pack(dest);
+    }
 }
 
 void FrameEventsPacket::unpackAndMoveIter(vchIter *iter)
 {
-    unsigned char numCmds, numEvents;
-    *iter = unpackFromIter(*iter, "QCC", &frame, &numCmds, &numEvents);
+    *iter = unpackFromIter(*iter, "Q", &frame);
+    unpackCmdsAndEventsAndMoveIter(iter);
+}
+void FrameEventsPacket::unpackCmdsAndEventsAndMoveIter(vchIter *iter)
+{
+    uint16_t numCmds, numEvents, numScheduledCmds;
+    *iter = unpackFromIter(*iter, "HHH", &numCmds, &numEvents, &numScheduledCmds);
 
     authdCmds.clear();
     for (unsigned int i = 0; i < numCmds; i++)
     {
-        string playerAddress;
-        *iter = unpackStringFromIter(*iter, 42, &playerAddress);
+        uint8_t playerId;
+        *iter = unpackFromIter(*iter, "C", &playerId);
         boost::shared_ptr<Cmd> unauthdCmd = unpackFullCmdAndMoveIter(iter);
 
-        authdCmds.push_back(boost::shared_ptr<AuthdCmd>(new AuthdCmd(unauthdCmd, playerAddress)));
+        authdCmds.push_back(boost::shared_ptr<AuthdCmd>(new AuthdCmd(unauthdCmd, playerId)));
     }
 
     events.clear();
@@ -68,6 +89,17 @@ void FrameEventsPacket::unpackAndMoveIter(vchIter *iter)
     {
         events.push_back(unpackFullEventAndMoveIter(iter));
     }
+
+    scheduledCmds.clear();
+    for (unsigned int i = 0; i < numScheduledCmds; i++)
+    {
+        unsigned char delay;
+        uint8_t playerId;
+        *iter = unpackFromIter(*iter, "CC", &delay, &playerId);
+        boost::shared_ptr<Cmd> unauthdCmd = unpackFullCmdAndMoveIter(iter);
+
+        scheduledCmds.push_back(ScheduledCmd(frame + delay, boost::shared_ptr<AuthdCmd>(new AuthdCmd(unauthdCmd, playerId))));
+    }
 }
 
 FrameEventsPacket::FrameEventsPacket(uint64_t frame, vector<boost::shared_ptr<AuthdCmd>> authdCmds, vector<boost::shared_ptr<Event>> events)
@@ -76,4 +108,220 @@ FrameEventsPacket::FrameEventsPacket(uint64_t frame, vector<boost::shared_ptr<Au
 FrameEventsPacket::FrameEventsPacket(vchIter *iter)
 {
     unpackAndMoveIter(iter);
-}
\ No newline at end of file
+}
+
+void CmdSchedule::addFromPacket(FrameEventsPacket *fcp)
+{
+    if (fcp->scheduledCmds.size() == 0)
+        return;
+    if (maybeLastAnnouncingFrame && fcp->frame <= *maybeLastAnnouncingFrame)
+        return;
+
+    for (unsigned int i = 0; i < fcp->scheduledCmds.size(); i++)
+    {
+        cmdsByFrame[fcp->scheduledCmds[i].executeFrame].push_back(fcp->scheduledCmds[i].authdCmd);
+    }
+    maybeLastAnnouncingFrame = fcp->frame;
+}
+
+vector<boost::shared_ptr<AuthdCmd>> CmdSchedule::takeCmdsForFrame(uint64_t frame)
+{
+    vector<boost::shared_ptr<AuthdCmd>> cmds;
+
+    auto iter = cmdsByFrame.find(frame);
+    if (iter != cmdsByFrame.end())
+    {
+        cmds.swap(iter->second);
+        cmdsByFrame.erase(iter);
+    }
+    return cmds;
+}
+
+void CmdSchedule::dropCmdsBefore(uint64_t frame)
+{
+    cmdsByFrame.erase(cmdsByFrame.begin(), cmdsByFrame.lower_bound(frame));
+}
+
+void runFrameAsClient(Game *game, FrameEventsPacket *fcp, CmdSchedule *cmdSchedule)
+{
+    // the server pays withdrawals out with events of their own
+    vector<WithdrawEvent> withdrawEvents;
+    runFrameAsServer(game, fcp, cmdSchedule, &withdrawEvents);
+}
+
+void runFrameAsServer(Game *game, FrameEventsPacket *fcp, CmdSchedule *cmdSchedule, vector<WithdrawEvent> *withdrawEventsDest)
+{
+    // go through events
+    for (unsigned int i = 0; i < fcp->events.size(); i++)
+    {
+        fcp->events[i]->execute(game);
+    }
+
+    // go through cmds
+    for (unsigned int i = 0; i < fcp->authdCmds.size(); i++)
+    {
+        if (auto unitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>(fcp->authdCmds[i]->cmd))
+        {
+            unitCmd->executeAsPlayer(game, fcp->authdCmds[i]->playerId);
+        }
+        else if (auto withdrawCmd = boost::dynamic_pointer_cast<WithdrawCmd, Cmd>(fcp->authdCmds[i]->cmd))
+        {
+            uint8_t playerId = fcp->authdCmds[i]->playerId;
+            if (playerId >= game->players.size())
+            {
+                cout << "Woah, getting an out-of-range playerId when processing a withdraw cmd..." << endl;
+                continue;
+            }
+            // if 0, interpret this as "all"
+            coinsInt withdrawSpecified = withdrawCmd->amount > 0 ? withdrawCmd->amount : game->players[playerId].credit.getInt();
+            coinsInt amountToWithdraw = min(withdrawSpecified, game->players[playerId].credit.getInt());
+
+            withdrawEventsDest->push_back(WithdrawEvent(playerId, amountToWithdraw));
+        }
+        else
+        {
+            cout << "Woah, I don't know how to handle that event as a client!" << endl;
+        }
+    }
+
+    // then those announced earlier for this frame, in the same order the server runs them
+    vector<boost::shared_ptr<AuthdCmd>> dueCmds = cmdSchedule->takeCmdsForFrame(game->frame);
+    for (unsigned int i = 0; i < dueCmds.size(); i++)
+    {
+        if (auto unitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>(dueCmds[i]->cmd))
+        {
+            unitCmd->executeAsPlayer(game, dueCmds[i]->playerId);
+        }
+    }
+
+    game->iterate();
+}
+
+unsigned char ResyncRequestPacket::typechar()
+{
+    return CLIENT_PACKET_RESYNCREQUEST_CHAR;
+}
+void ResyncRequestPacket::pack(vch *dest)
+{
+    packPacket(dest);
+
+    packToVch(dest, "CQQ", (unsigned char)hasBaseline, baselineFrame, baselineHash);
+}
+void ResyncRequestPacket::unpackAndMoveIter(vchIter *iter)
+{
+    unsigned char hasBaselineChar;
+    *iter = unpackFromIter(*iter, "CQQ", &hasBaselineChar, &baselineFrame, &baselineHash);
+    hasBaseline = (bool)hasBaselineChar;
+}
+
+ResyncRequestPacket::ResyncRequestPacket()
+    : hasBaseline(false), baselineFrame(0), baselineHash(0) {}
+ResyncRequestPacket::ResyncRequestPacket(uint64_t baselineFrame, uint64_t baselineHash)
+    : hasBaseline(true), baselineFrame(baselineFrame), baselineHash(baselineHash) {}
+ResyncRequestPacket::ResyncRequestPacket(vchIter *iter)
+{
+    unpackAndMoveIter(iter);
+}
+
+unsigned char ConnectionOptionsPacket::typechar()
+{
+    return CLIENT_PACKET_CONNECTIONOPTIONS_CHAR;
+}
+void ConnectionOptionsPacket::pack(vch *dest)
+{
+    packPacket(dest);
+
+    packToVch(dest, "C", flags);
+}
+void ConnectionOptionsPacket::unpackAndMoveIter(vchIter *iter)
+{
+    *iter = unpackFromIter(*iter, "C", &flags);
+}
+
+ConnectionOptionsPacket::ConnectionOptionsPacket(unsigned char flags)
+    : flags(flags) {}
+ConnectionOptionsPacket::ConnectionOptionsPacket(vchIter *iter)
+{
+    unpackAndMoveIter(iter);
+}
+
+unsigned char PongPacket::typechar()
+{
+    return CLIENT_PACKET_PONG_CHAR;
+}
+void PongPacket::pack(vch *dest)
+{
+    packPacket(dest);
+
+    packToVch(dest, "Q", pingFrame);
+}
+void PongPacket::unpackAndMoveIter(vchIter *iter)
+{
+    *iter = unpackFromIter(*iter, "Q", &pingFrame);
+}
+
+PongPacket::PongPacket(uint64_t pingFrame)
+    : pingFrame(pingFrame) {}
+PongPacket::PongPacket(vchIter *iter)
+{
+    unpackAndMoveIter(iter);
+}
+
+void packFrameBundle(vch *dest, const vector<boost::shared_ptr<const vch>> &framePackets)
+{
+    // a frame packet's body starts with the frame ("Q"), then the cmd, event and scheduled cmd counts
+    const unsigned int countsOffset = PACKET_HEADER_SIZE + 8;
+    const unsigned int emptyFramePacketSize = countsOffset + 3 * 2;
+
+    vch firstFrameBytes(framePackets[0]->begin() + PACKET_HEADER_SIZE, framePackets[0]->begin() + countsOffset);
+    uint64_t firstFrame;
+    unpackFromIter(firstFrameBytes.begin(), "Q", &firstFrame);
+
+    uint16_t numNonEmptyFrames = 0;
+    for (unsigned int i = 0; i < framePackets.size(); i++)
+    {
+        if (framePackets[i]->size() > emptyFramePacketSize)
+            numNonEmptyFrames++;
+    }
+
+    packToVch(dest, "QHH", firstFrame, (uint16_t)framePackets.size(), numNonEmptyFrames);
+
+    uint16_t emptyFramesSkipped = 0;
+    for (unsigned int i = 0; i < framePackets.size(); i++)
+    {
+        if (framePackets[i]->size() <= emptyFramePacketSize)
+        {
+            emptyFramesSkipped++;
+            continue;
+        }
+
+        packToVch(dest, "H", emptyFramesSkipped);
+        dest->insert(dest->end(), framePackets[i]->begin() + countsOffset, framePackets[i]->end());
+        emptyFramesSkipped = 0;
+    }
+}
+
+void unpackFrameBundleAndMoveIter(vchIter *iter, vector<FrameEventsPacket> *dest)
+{
+    uint64_t frame;
+    uint16_t numFrames, numNonEmptyFrames;
+    *iter = unpackFromIter(*iter, "QHH", &frame, &numFrames, &numNonEmptyFrames);
+
+    uint64_t endFrame = frame + numFrames;
+    for (unsigned int i = 0; i < numNonEmptyFrames; i++)
+    {
+        uint16_t emptyFramesSkipped;
+        *iter = unpackFromIter(*iter, "H", &emptyFramesSkipped);
+        for (unsigned int j = 0; j < emptyFramesSkipped; j++)
+        {
+            dest->push_back(FrameEventsPacket(frame++, {}, {}));
+        }
+
+        dest->push_back(FrameEventsPacket(frame++, {}, {}));
+        dest->back().unpackCmdsAndEventsAndMoveIter(iter);
+    }
+    while (frame < endFrame)
+    {
+        dest->push_back(FrameEventsPacket(frame++, {}, {}));
+    }
+}
@@ -1,3 +1,5 @@
+#include <map>
+#include <optional>
 #include <boost/shared_ptr.hpp>
 #include "cmds.h"
 #include "vchpack.h"
@@ -26,19 +28,116 @@ public:
 
 // note that a resync packet is so simple that it's just made directly in server and client
 
+// A cmd announced in one frame's packet, to be executed on a later frame.
+struct ScheduledCmd
+{
+    uint64_t executeFrame;
+    boost::shared_ptr<AuthdCmd> authdCmd;
+    ScheduledCmd(uint64_t executeFrame, boost::shared_ptr<AuthdCmd> authdCmd);
+};
+
 struct FrameEventsPacket : public Packet
 {
     unsigned char typechar();
 
     uint64_t frame;
-    vector<boost::shared_ptr<AuthdCmd>> authdCmds;
+    vector<boost::shared_ptr<AuthdCmd>> authdCmds; // executed this frame
     vector<boost::shared_ptr<Event>> events;
+    vector<ScheduledCmd> scheduledCmds; // announced this frame, for up to CMD_DELAY_MAX_FRAMES frames later
 
     void pack(vch *dest);
     void unpackAndMoveIter(vchIter *iter);
+    // everything after the frame number, which is how frames appear in a frame bundle
+    void packCmdsAndEvents(vch *dest);
+    void unpackCmdsAndEventsAndMoveIter(vchIter *iter);
 
     FrameEventsPacket(uint64_t frame, vector<boost::shared_ptr<AuthdCmd>> authdCmds, vector<boost::shared_ptr<Event>> events);
     FrameEventsPacket(vchIter *iter);
 };
 
+// Cmds announced by frame packets, waiting for the frame they execute on.
+// Server and client each keep one, fed the same packets in the same order, so cmds for a frame come out in the same order on both.
+class CmdSchedule
+{
+    map<uint64_t, vector<boost::shared_ptr<AuthdCmd>>> cmdsByFrame;
+    optional<uint64_t> maybeLastAnnouncingFrame;
+public:
+    // Ignores a packet whose frame it's already taken cmds from, as the frames following a resync may repeat some.
+    void addFromPacket(FrameEventsPacket *fcp);
+    vector<boost::shared_ptr<AuthdCmd>> takeCmdsForFrame(uint64_t frame);
+    void dropCmdsBefore(uint64_t frame);
+};
+
+// A withdrawal a WithdrawCmd asked for, which the server pays out (as a BalanceUpdateEvent) on the following frame.
+struct WithdrawEvent
+{
+    uint8_t playerId;
+    coinsInt amountInCoins;
+    WithdrawEvent(uint8_t playerId, coinsInt amountInCoins)
+        : playerId(playerId), amountInCoins(amountInCoins) {}
+    boost::shared_ptr<Event> toEventSharedPtr()
+    {
+        return boost::shared_ptr<Event>(new BalanceUpdateEvent(playerId, amountInCoins, false));
+    }
+};
+
+// Runs the game through fcp's frame the way anything following the server's frames has to, to stay in step:
+// fcp's events, then its cmds, then those cmdSchedule holds for the frame, then Game::iterate.
+// fcp must be for game->frame, and already added to cmdSchedule.
+void runFrameAsClient(Game *game, FrameEventsPacket *fcp, CmdSchedule *cmdSchedule);
+// The same, as the server runs it (or replays it): also adds what fcp's WithdrawCmds come to onto withdrawEventsDest.
+void runFrameAsServer(Game *game, FrameEventsPacket *fcp, CmdSchedule *cmdSchedule, vector<WithdrawEvent> *withdrawEventsDest);
+
+// sent by a client to ask for a resync, optionally as a delta against a snapshot it still holds
+struct ResyncRequestPacket : public Packet
+{
+    unsigned char typechar();
+
+    bool hasBaseline;
+    uint64_t baselineFrame;
+    uint64_t baselineHash;
+
+    void pack(vch *dest);
+    void unpackAndMoveIter(vchIter *iter);
+
+    ResyncRequestPacket();
+    ResyncRequestPacket(uint64_t baselineFrame, uint64_t baselineHash);
+    ResyncRequestPacket(vchIter *iter);
+};
+
+// sent by a client after the handshake to say which optional features it supports (CONNECTION_OPTION_*)
+struct ConnectionOptionsPacket : public Packet
+{
+    unsigned char typechar();
+
+    unsigned char flags;
+
+    void pack(vch *dest);
+    void unpackAndMoveIter(vchIter *iter);
+
+    ConnectionOptionsPacket(unsigned char flags);
+    ConnectionOptionsPacket(vchIter *iter);
+};
+
+// The body of a PACKET_FRAMEBUNDLE_CHAR packet: a run of consecutive frames, sent to a client that's fallen behind.
+// Empty frames aren't packed at all; each non-empty frame is preceded by how many empty ones came before it.
+// Built straight from frame packets as the server packed them (header included, uncompressed), so no frame gets packed twice.
+void packFrameBundle(vch *dest, const vector<boost::shared_ptr<const vch>> &framePackets);
+// Appends every frame in the bundle to dest, empty ones included.
+void unpackFrameBundleAndMoveIter(vchIter *iter, vector<FrameEventsPacket> *dest);
+
+// sent by a client in reply to a PACKET_PING_CHAR, echoing the frame the ping was sent on
+struct PongPacket : public Packet
+{
+    unsigned char typechar();
+
+    uint64_t pingFrame;
+
+    void pack(vch *dest);
+    void unpackAndMoveIter(vchIter *iter);
+
+    PongPacket(uint64_t pingFrame);
+    PongPacket(vchIter *iter);
+};
+
 #endif // PACKETS_H
\ No newline at end of file
@@ -0,0 +1,443 @@
+#include <iostream>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <vector>
+#include <deque>
+#include <string>
+#include "config.h"
+#include "cmds.h"
+#include "engine.h"
+#include "common.h"
+#include "packets.h"
+#include "events.h"
+#include "snapshots.h"
+#include "compression.h"
+
+using namespace std;
+using namespace boost::asio::ip;
+
+// Re-serves a game to spectators, so they don't each cost the server a ClientChannel.
+// The relay logs in upstream (to the server, or to another relay) as a spectator, and keeps a replica of the game
+// from what it's sent, so it can pack a resync for each spectator that joins.
+// Everything else from upstream goes out to every spectator as it came, without being packed again.
+// Spectators get the same handshake as from the server, so relays can be chained.
+// Everything runs on one thread.
+
+Game game;
+bool haveGame = false;
+CmdSchedule cmdSchedule;
+
+// The packets for the latest frames, as upstream sent them.
+// A resync for a new spectator is followed by those from before its frame, which announced any cmds already scheduled past it.
+deque<pair<uint64_t, boost::shared_ptr<const vch>>> recentFramePackets;
+
+class Spectator;
+// only those that have made it through the handshake
+vector<boost::shared_ptr<Spectator>> spectators;
+
+void clearVchAndPackResyncPacket(vch *dest)
+{
+    dest->clear();
+
+    game.pack(dest);
+
+    vch prepended;
+    packToVch(&prepended, "C", PACKET_RESYNC_CHAR);
+    packToVch(&prepended, "Q", (uint64_t)(dest->size()));
+
+    dest->insert(dest->begin(), prepended.begin(), prepended.end());
+}
+
+void clearVchAndBuildClientPacket(vch *dest, Packet *packet)
+{
+    dest->clear();
+
+    packTypechar(dest, packet->typechar());
+    packet->pack(dest);
+
+    vch prepended;
+    packToVch(&prepended, "H", (uint16_t)(dest->size()));
+
+    dest->insert(dest->begin(), prepended.begin(), prepended.end());
+}
+
+class Spectator : public boost::enable_shared_from_this<Spectator>
+{
+    boost::shared_ptr<tcp::socket> socket;
+    boost::asio::streambuf receivedHandshakeLine;
+    vch receivedBytes;
+
+    // everything queued goes out in one gather write; the first numPacketsSending are in flight
+    deque<boost::shared_ptr<const vch>> packetsToSend;
+    size_t numPacketsSending;
+    size_t numQueuedBytes;
+
+    void sendNextPacketsIfNotBusy()
+    {
+        if (closed || numPacketsSending > 0 || packetsToSend.size() == 0)
+            return;
+
+        vector<boost::asio::const_buffer> buffers;
+        for (unsigned int i = 0; i < packetsToSend.size(); i++)
+        {
+            buffers.push_back(boost::asio::buffer(*packetsToSend[i]));
+        }
+        numPacketsSending = packetsToSend.size();
+
+        boost::asio::async_write(*socket,
+                                 buffers,
+                                 boost::bind(&Spectator::wrapUpSendingPackets,
+                                             shared_from_this(),
+                                             boost::asio::placeholders::error,
+                                             boost::asio::placeholders::bytes_transferred));
+    }
+
+    void wrapUpSendingPackets(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            close();
+            return;
+        }
+
+        for (unsigned int i = 0; i < numPacketsSending; i++)
+        {
+            numQueuedBytes -= packetsToSend.front()->size();
+            packetsToSend.pop_front();
+        }
+        numPacketsSending = 0;
+
+        sendNextPacketsIfNotBusy();
+    }
+
+    void handshakeLineReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            close();
+            return;
+        }
+
+        // whatever the answer, they're spectating
+        boost::system::error_code writeError;
+        boost::asio::write(*socket, boost::asio::buffer(string(SPECTATOR_ADDRESS)), writeError);
+        if (writeError)
+        {
+            close();
+            return;
+        }
+
+        spectators.push_back(shared_from_this());
+        sendResync();
+        receiveNextPacketSize();
+    }
+
+    void receiveNextPacketSize()
+    {
+        receivedBytes = vch(2);
+        boost::asio::async_read(*socket,
+                                boost::asio::buffer(receivedBytes),
+                                boost::bind(&Spectator::packetSizeReceived,
+                                            shared_from_this(),
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void packetSizeReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            close();
+            return;
+        }
+
+        uint16_t size;
+        unpackFromIter(receivedBytes.begin(), "H", &size);
+
+        receivedBytes = vch(size);
+        boost::asio::async_read(*socket,
+                                boost::asio::buffer(receivedBytes),
+                                boost::bind(&Spectator::packetReceived,
+                                            shared_from_this(),
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void packetReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+        {
+            close();
+            return;
+        }
+
+        // a spectator can't act, so the only thing worth answering is a request to start over.
+        // Any baseline it names is ignored, since the relay doesn't keep snapshots.
+        if (receivedBytes.size() > 0 && receivedBytes[0] == CLIENT_PACKET_RESYNCREQUEST_CHAR)
+            sendResync();
+
+        receiveNextPacketSize();
+    }
+
+public:
+    bool closed;
+
+    // The game as it stands, then the frames from before it that announced cmds still to come.
+    // The frames after it get here from upstream as they arrive.
+    void sendResync()
+    {
+        boost::shared_ptr<vch> resyncPacket(new vch);
+        clearVchAndPackResyncPacket(resyncPacket.get());
+        queuePacket(resyncPacket);
+
+        for (unsigned int i = 0; i < recentFramePackets.size(); i++)
+        {
+            if (recentFramePackets[i].first < game.frame)
+                queuePacket(recentFramePackets[i].second);
+        }
+    }
+
+    // A spectator that lets SEND_QUEUE_MAX_PACKETS or SEND_QUEUE_MAX_BYTES pile up is dropped.
+    // It can always connect again for a fresh resync.
+    void queuePacket(boost::shared_ptr<const vch> packet)
+    {
+        if (closed)
+            return;
+
+        packetsToSend.push_back(packet);
+        numQueuedBytes += packet->size();
+        if (packetsToSend.size() > SEND_QUEUE_MAX_PACKETS || numQueuedBytes > SEND_QUEUE_MAX_BYTES)
+        {
+            cout << "Dropping a spectator that's fallen " << packetsToSend.size() << " packets (" << numQueuedBytes << " bytes) behind." << endl;
+            close();
+            return;
+        }
+
+        sendNextPacketsIfNotBusy();
+    }
+
+    void close()
+    {
+        closed = true;
+        boost::system::error_code ignored;
+        socket->close(ignored);
+    }
+
+    void startHandshake()
+    {
+        string challenge(50, '-');
+        boost::system::error_code writeError;
+        boost::asio::write(*socket, boost::asio::buffer(challenge), writeError);
+        if (writeError)
+            return;
+
+        boost::asio::async_read_until(*socket,
+                                      receivedHandshakeLine,
+                                      '\n',
+                                      boost::bind(&Spectator::handshakeLineReceived,
+                                                  shared_from_this(),
+                                                  boost::asio::placeholders::error,
+                                                  boost::asio::placeholders::bytes_transferred));
+    }
+
+    Spectator(boost::shared_ptr<tcp::socket> socket)
+        : socket(socket), receivedHandshakeLine(256), numPacketsSending(0), numQueuedBytes(0), closed(false) {}
+};
+
+void sendToAllSpectators(boost::shared_ptr<const vch> packet)
+{
+    for (unsigned int i = 0; i < spectators.size(); i++)
+    {
+        spectators[i]->queuePacket(packet);
+        if (spectators[i]->closed)
+        {
+            spectators.erase(spectators.begin() + i);
+            i--;
+        }
+    }
+}
+
+class Listener
+{
+    boost::asio::io_service &ioService;
+    tcp::acceptor acceptor;
+
+public:
+    Listener(boost::asio::io_service &ioService_, unsigned short port)
+        : ioService(ioService_), acceptor(ioService_, tcp::endpoint(tcp::v4(), port))
+    {
+    }
+    void startAccept()
+    {
+        boost::shared_ptr<tcp::socket> socket(new tcp::socket(ioService));
+
+        acceptor.async_accept(*socket, boost::bind(&Listener::handleAccept, this, socket, boost::asio::placeholders::error));
+    }
+    void handleAccept(boost::shared_ptr<tcp::socket> socket, const boost::system::error_code &error)
+    {
+        if (error)
+        {
+            throw runtime_error("Listener error accepting: " + error.message());
+        }
+
+        boost::shared_ptr<Spectator> spectator(new Spectator(socket));
+        spectator->startHandshake();
+        startAccept();
+    }
+};
+
+// The relay's own connection to whoever it's relaying, spectating like anyone else.
+// It asks for none of the connection options, so everything it passes on is plain enough for any spectator.
+class Upstream
+{
+    tcp::socket &socket;
+    vch receivedBytes;
+    unsigned char receivedTypechar;
+    bool receivedCompressed;
+
+    void receiveNextPacketHeader()
+    {
+        receivedBytes = vch(PACKET_HEADER_SIZE);
+        boost::asio::async_read(socket,
+                                boost::asio::buffer(receivedBytes),
+                                boost::bind(&Upstream::packetHeaderReceived,
+                                            this,
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void packetHeaderReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+            throw runtime_error("Lost the connection upstream: " + error.message());
+
+        uint64_t size;
+        unpackFromIter(receivedBytes.begin(), "CQ", &receivedTypechar, &size);
+        receivedCompressed = receivedTypechar & PACKET_COMPRESSED_FLAG;
+        receivedTypechar &= ~PACKET_COMPRESSED_FLAG;
+
+        // kept whole, header included, to pass on as it is
+        receivedBytes.resize(PACKET_HEADER_SIZE + size);
+        boost::asio::async_read(socket,
+                                boost::asio::buffer(receivedBytes.data() + PACKET_HEADER_SIZE, size),
+                                boost::bind(&Upstream::packetBodyReceived,
+                                            this,
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void packetBodyReceived(const boost::system::error_code &error, size_t transferred)
+    {
+        if (error)
+            throw runtime_error("Lost the connection upstream: " + error.message());
+
+        boost::shared_ptr<const vch> packet(new vch(receivedBytes));
+
+        vch body(receivedBytes.begin() + PACKET_HEADER_SIZE, receivedBytes.end());
+        if (receivedCompressed)
+        {
+            vch decompressed;
+            if (!decompressToVch(&decompressed, body.data(), body.size()))
+                throw runtime_error("Received a compressed packet from upstream that didn't decompress");
+            body.swap(decompressed);
+        }
+        vchIter place = body.begin();
+
+        switch (receivedTypechar)
+        {
+        case PACKET_RESYNC_CHAR:
+            game = Game(&place);
+            game.reassignEntityGamePointers();
+            haveGame = true;
+            // the frames that follow it include any it needs from before
+            recentFramePackets.clear();
+            sendToAllSpectators(packet);
+            break;
+
+        case PACKET_FRAMECMDS_CHAR:
+        {
+            FrameEventsPacket fcp(&place);
+            cmdSchedule.addFromPacket(&fcp);
+
+            // the frames following a resync start before it, just to announce cmds
+            if (fcp.frame == game.frame)
+            {
+                runFrameAsClient(&game, &fcp, &cmdSchedule);
+                cmdSchedule.dropCmdsBefore(game.frame);
+            }
+            else if (fcp.frame > game.frame)
+            {
+                throw runtime_error("Upstream skipped from frame " + to_string(game.frame) + " to " + to_string(fcp.frame));
+            }
+
+            recentFramePackets.push_back({fcp.frame, packet});
+            while (recentFramePackets.size() > CMD_DELAY_MAX_FRAMES)
+                recentFramePackets.pop_front();
+
+            sendToAllSpectators(packet);
+            break;
+        }
+
+        // the rest are for the relay's own connection (pings) or not asked for
+        default:
+            break;
+        }
+
+        receiveNextPacketHeader();
+    }
+
+public:
+    Upstream(tcp::socket &socket)
+        : socket(socket) {}
+
+    void connectAndStartReceiving(tcp::endpoint endpoint)
+    {
+        socket.connect(endpoint);
+
+        vch challenge(50);
+        boost::asio::read(socket, boost::asio::buffer(challenge));
+        boost::asio::write(socket, boost::asio::buffer(string("spectate\n")));
+        vch address(42);
+        boost::asio::read(socket, boost::asio::buffer(address));
+
+        vch optionsPacket;
+        ConnectionOptionsPacket options((unsigned char)0);
+        clearVchAndBuildClientPacket(&optionsPacket, &options);
+        boost::asio::write(socket, boost::asio::buffer(optionsPacket));
+
+        receiveNextPacketHeader();
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: relay <upstream ip> [<upstream port> [<port to serve spectators on>]]" << endl;
+        return 1;
+    }
+    string upstreamIp = argv[1];
+    unsigned short upstreamPort = argc > 2 ? atoi(argv[2]) : 8473;
+    unsigned short listenPort = argc > 3 ? atoi(argv[3]) : 8473;
+
+    boost::asio::io_service io_service;
+
+    tcp::socket upstreamSocket(io_service);
+    Upstream upstream(upstreamSocket);
+    cout << "Connecting upstream to " << upstreamIp << ":" << upstreamPort << "..." << endl;
+    upstream.connectAndStartReceiving(tcp::endpoint(boost::asio::ip::address::from_string(upstreamIp), upstreamPort));
+
+    // spectators can't be served until there's a game to resync them to
+    while (!haveGame)
+        io_service.run_one();
+
+    Listener listener(io_service, listenPort);
+    listener.startAccept();
+    cout << "Relaying frame " << game.frame << " onward to spectators on port " << listenPort << endl;
+
+    io_service.run();
+
+    return 0;
+}
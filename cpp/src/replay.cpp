@@ -0,0 +1,343 @@
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+#include "config.h"
+#include "cmds.h"
+#include "engine.h"
+#include "common.h"
+#include "packets.h"
+#include "events.h"
+#include "compression.h"
+#include "snapshots.h"
+#include "replaylog.h"
+
+using namespace std;
+
+// Re-runs a replay log the server wrote (see replaylog.h) through Game::iterate, the same way a client would have,
+// for post-mortems and as a benchmark made of real games.
+// Usage: replay <log> [options]
+//   --from F      start from the latest keyframe at or before frame F, found through the log's index
+//   --to F        stop once the game reaches frame F
+//   --free-run    keep running the replayed game past later keyframes, rather than continuing from each one
+// Each keyframe reached is checked against the replayed game, and any difference reported.
+// Frames are timed one by one; keyframe checks and unpacking the log aren't counted.
+
+template<class T> T percentile(vector<T> *sorted, unsigned int percent)
+{
+    if (sorted->empty())
+        return 0;
+    return (*sorted)[min(sorted->size() - 1, (sorted->size() * percent) / 100)];
+}
+
+// Reads the header of the packet at offset. Returns false if the log ends before the packet does.
+bool readPacketHeaderAt(const unsigned char *base, uint64_t logSize, uint64_t offset, unsigned char *typechar, uint64_t *bodySize)
+{
+    if (offset + PACKET_HEADER_SIZE > logSize)
+        return false;
+    vch header(base + offset, base + offset + PACKET_HEADER_SIZE);
+    unpackFromIter(header.begin(), "CQ", typechar, bodySize);
+    return *bodySize <= logSize - offset - PACKET_HEADER_SIZE;
+}
+
+vector<ReplayIndexEntry> loadOrRebuildIndex(string logPath, const unsigned char *base, uint64_t logSize)
+{
+    vector<ReplayIndexEntry> index;
+
+    ifstream indexFile(replayIndexPath(logPath), ios::binary);
+    if (indexFile)
+    {
+        ReplayIndexEntry entry;
+        while (indexFile.read((char*)&entry, sizeof(entry)))
+        {
+            // the log may have been cut short of where the index says
+            if (entry.offset < logSize)
+                index.push_back(entry);
+        }
+        return index;
+    }
+
+    cout << "No index for " << logPath << "; finding keyframes by reading through it." << endl;
+    uint64_t offset = sizeof(ReplayFileHeader);
+    unsigned char typechar;
+    uint64_t bodySize;
+    while (readPacketHeaderAt(base, logSize, offset, &typechar, &bodySize))
+    {
+        if ((typechar & ~PACKET_COMPRESSED_FLAG) == PACKET_RESYNC_CHAR)
+        {
+            vch body(base + offset + PACKET_HEADER_SIZE, base + offset + PACKET_HEADER_SIZE + bodySize);
+            if (typechar & PACKET_COMPRESSED_FLAG)
+            {
+                vch decompressed;
+                if (!decompressToVch(&decompressed, body.data(), body.size()))
+                    break;
+                body.swap(decompressed);
+            }
+            // Game::pack leads with the state, then the frame
+            unsigned char state;
+            uint64_t frame;
+            unpackFromIter(body.begin(), "CQ", &state, &frame);
+
+            ReplayIndexEntry entry;
+            entry.frame = frame;
+            entry.offset = offset;
+            index.push_back(entry);
+        }
+        offset += PACKET_HEADER_SIZE + bodySize;
+    }
+    return index;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: replay <log> [--from F] [--to F] [--free-run]" << endl;
+        return 1;
+    }
+    string logPath = argv[1];
+    optional<uint64_t> maybeFromFrame;
+    optional<uint64_t> maybeToFrame;
+    bool freeRun = false;
+
+    for (int i = 2; i < argc; i++)
+    {
+        string flag = argv[i];
+        if (flag == "--free-run")
+            freeRun = true;
+        else if (flag == "--from" && i + 1 < argc)
+            maybeFromFrame = stoull(argv[++i]);
+        else if (flag == "--to" && i + 1 < argc)
+            maybeToFrame = stoull(argv[++i]);
+        else
+        {
+            cout << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    int fd = open(logPath.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        cout << "Couldn't open " << logPath << endl;
+        return 1;
+    }
+    uint64_t logSize = st.st_size;
+    if (logSize < sizeof(ReplayFileHeader))
+    {
+        cout << logPath << " is too small to be a replay log." << endl;
+        return 1;
+    }
+
+    void *mapped = mmap(NULL, logSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        cout << "Couldn't map " << logPath << endl;
+        return 1;
+    }
+    madvise(mapped, logSize, MADV_SEQUENTIAL);
+    const unsigned char *base = (const unsigned char*)mapped;
+
+    const ReplayFileHeader *header = (const ReplayFileHeader*)base;
+    if (memcmp(header->magic, REPLAY_FILE_MAGIC, sizeof(header->magic)) != 0
+     || header->version != REPLAY_FILE_VERSION
+     || header->byteOrderMark != REPLAY_FILE_BYTE_ORDER_MARK)
+    {
+        cout << logPath << " has an unrecognized header." << endl;
+        return 1;
+    }
+
+    // Where the game starts, and where to start reading from: a keyframe partway through is preceded by
+    // frames that announced cmds due after it, so reading starts a keyframe earlier, only to pick those up.
+    uint64_t startOffset = sizeof(ReplayFileHeader);
+    uint64_t readFromOffset = startOffset;
+    if (maybeFromFrame)
+    {
+        vector<ReplayIndexEntry> index = loadOrRebuildIndex(logPath, base, logSize);
+        int startEntry = -1;
+        for (unsigned int i = 0; i < index.size(); i++)
+        {
+            if (index[i].frame <= *maybeFromFrame)
+                startEntry = i;
+        }
+        if (startEntry == -1)
+        {
+            cout << "No keyframe at or before frame " << *maybeFromFrame << "; starting from the beginning." << endl;
+        }
+        else
+        {
+            startOffset = index[startEntry].offset;
+            readFromOffset = startEntry > 0 ? index[startEntry - 1].offset : sizeof(ReplayFileHeader);
+        }
+    }
+
+    Game game;
+    bool haveGame = false;
+    CmdSchedule cmdSchedule;
+
+    uint64_t firstFrame = 0;
+    uint64_t packetsRead = 0;
+    uint64_t cmdsRun = 0, eventsRun = 0;
+    unsigned int keyframesMatched = 0, keyframesDiffered = 0;
+    vector<double> frameTimesUs;
+    chrono::steady_clock::time_point replayStart = chrono::steady_clock::now();
+
+    auto runFrame = [&](FrameEventsPacket *fcp)
+    {
+        chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+        runFrameAsClient(&game, fcp, &cmdSchedule);
+        cmdSchedule.dropCmdsBefore(game.frame);
+        frameTimesUs.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - frameStart).count());
+    };
+    auto reachedEnd = [&]()
+    {
+        return haveGame && maybeToFrame && game.frame >= *maybeToFrame;
+    };
+    // empty frames during a match weren't logged
+    auto runEmptyFramesBefore = [&](uint64_t frame)
+    {
+        while (game.state == Game::Active && game.frame < frame && !reachedEnd())
+        {
+            FrameEventsPacket emptyFrame(game.frame, {}, {});
+            runFrame(&emptyFrame);
+        }
+    };
+
+    uint64_t offset = readFromOffset;
+    while (offset < logSize && !reachedEnd())
+    {
+        unsigned char typechar;
+        uint64_t bodySize;
+        if (!readPacketHeaderAt(base, logSize, offset, &typechar, &bodySize))
+        {
+            cout << "The log ends partway through a packet at offset " << offset << "; stopping there." << endl;
+            break;
+        }
+        uint64_t packetOffset = offset;
+        offset += PACKET_HEADER_SIZE + bodySize;
+        packetsRead++;
+
+        vch body(base + packetOffset + PACKET_HEADER_SIZE, base + offset);
+        if (typechar & PACKET_COMPRESSED_FLAG)
+        {
+            vch decompressed;
+            if (!decompressToVch(&decompressed, body.data(), body.size()))
+            {
+                cout << "Packet at offset " << packetOffset << " didn't decompress; stopping there." << endl;
+                break;
+            }
+            body.swap(decompressed);
+            typechar &= ~PACKET_COMPRESSED_FLAG;
+        }
+        vchIter place = body.begin();
+
+        switch (typechar)
+        {
+        case PACKET_RESYNC_CHAR:
+        {
+            // keyframes before the one we're starting from are only passed over for the frames after them
+            if (packetOffset < startOffset)
+                break;
+
+            Game keyframe(&place);
+            if (haveGame)
+                runEmptyFramesBefore(keyframe.frame);
+            if (reachedEnd())
+                break;
+
+            if (haveGame && game.frame == keyframe.frame)
+            {
+                GameSnapshot replayedSnapshot(&game);
+                GameSnapshot keyframeSnapshot(&keyframe);
+                if (replayedSnapshot.hash == keyframeSnapshot.hash)
+                {
+                    keyframesMatched++;
+                }
+                else
+                {
+                    keyframesDiffered++;
+                    unsigned int numEntities = min(replayedSnapshot.getNumEntities(), keyframeSnapshot.getNumEntities());
+                    unsigned int entitiesDiffering = max(replayedSnapshot.getNumEntities(), keyframeSnapshot.getNumEntities()) - numEntities;
+                    for (unsigned int i = 0; i < numEntities; i++)
+                    {
+                        if (!replayedSnapshot.entityBytesEqual(i, &keyframeSnapshot))
+                            entitiesDiffering++;
+                    }
+                    cout << "Frame " << keyframe.frame << ": the replayed game differs from the server's keyframe in "
+                         << entitiesDiffering << " of " << keyframeSnapshot.getNumEntities() << " entities." << endl;
+                }
+                if (freeRun)
+                    break;
+            }
+            else if (haveGame)
+            {
+                // the server restarted, from its snapshot file
+                cout << "Keyframe jumps from frame " << game.frame << " to " << keyframe.frame << "." << endl;
+            }
+            else
+            {
+                firstFrame = keyframe.frame;
+            }
+
+            game = keyframe;
+            game.reassignEntityGamePointers();
+            haveGame = true;
+            cmdSchedule.dropCmdsBefore(game.frame);
+            break;
+        }
+
+        case PACKET_FRAMECMDS_CHAR:
+        {
+            FrameEventsPacket fcp(&place);
+            cmdSchedule.addFromPacket(&fcp);
+            if (!haveGame)
+                break;
+
+            runEmptyFramesBefore(fcp.frame);
+            if (fcp.frame == game.frame && !reachedEnd())
+            {
+                cmdsRun += fcp.authdCmds.size() + fcp.scheduledCmds.size();
+                eventsRun += fcp.events.size();
+                runFrame(&fcp);
+            }
+            break;
+        }
+
+        default:
+            cout << "Unexpected packet type " << (int)typechar << " at offset " << packetOffset << "; stopping there." << endl;
+            offset = logSize;
+            break;
+        }
+    }
+
+    double replaySeconds = chrono::duration<double>(chrono::steady_clock::now() - replayStart).count();
+    munmap(mapped, logSize);
+
+    if (!haveGame)
+    {
+        cout << "The log has no keyframe to start from." << endl;
+        return 1;
+    }
+
+    sort(frameTimesUs.begin(), frameTimesUs.end());
+    printf("Replayed frames %lu to %lu: %lu frames run from %lu packets in %.2fs (%.0f frames/s)\n",
+           firstFrame, game.frame, frameTimesUs.size(), packetsRead, replaySeconds, frameTimesUs.size() / replaySeconds);
+    printf("  %lu cmds, %lu events\n", cmdsRun, eventsRun);
+    printf("  time per frame (us):  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f\n",
+           percentile(&frameTimesUs, 50), percentile(&frameTimesUs, 90), percentile(&frameTimesUs, 99),
+           frameTimesUs.empty() ? 0 : frameTimesUs.back());
+    printf("  keyframes checked: %u matched, %u differed\n", keyframesMatched, keyframesDiffered);
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "replaylog.h"
+#include "snapshotfile.h"
+#include "vchpack.h"
+#include "config.h"
+
+using namespace std;
+
+string replayIndexPath(string logPath)
+{
+    return logPath + ".idx";
+}
+
+bool ReplayLogWriter::writeRecord(const QueuedRecord &record)
+{
+    if (record.framePacketOrNull)
+    {
+        if (!writeAll(logFd, record.framePacketOrNull->data(), record.framePacketOrNull->size()))
+            return false;
+        logSize += record.framePacketOrNull->size();
+        return true;
+    }
+
+    // the same bytes a full resync would carry, without copying the snapshot into a packet first
+    GameSnapshot *keyframe = record.keyframeOrNull.get();
+    vch packetHeader;
+    packToVch(&packetHeader, "C", PACKET_RESYNC_CHAR);
+    packToVch(&packetHeader, "Q", (uint64_t)(keyframe->packed.size()));
+
+    ReplayIndexEntry indexEntry;
+    indexEntry.frame = keyframe->frame;
+    indexEntry.offset = logSize;
+
+    if (!writeAll(logFd, packetHeader.data(), packetHeader.size())
+     || !writeAll(logFd, keyframe->packed.data(), keyframe->packed.size()))
+        return false;
+    logSize += packetHeader.size() + keyframe->packed.size();
+
+    // only indexed once it's all in the log
+    return writeAll(indexFd, &indexEntry, sizeof(indexEntry));
+}
+
+void ReplayLogWriter::writerLoop()
+{
+    while (true)
+    {
+        deque<QueuedRecord> records;
+        {
+            unique_lock<mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || queuedRecords.size() > 0; });
+
+            if (queuedRecords.size() == 0)
+                return;
+
+            records.swap(queuedRecords);
+        }
+
+        if (failed)
+            continue;
+        for (unsigned int i = 0; i < records.size(); i++)
+        {
+            if (!writeRecord(records[i]))
+            {
+                cout << "Couldn't write to replay log " << path << "; not recording any more of this game." << endl;
+                failed = true;
+                break;
+            }
+        }
+    }
+}
+
+void ReplayLogWriter::queueRecord(QueuedRecord record)
+{
+    if (failed)
+        return;
+    {
+        lock_guard<mutex> lock(mtx);
+        queuedRecords.push_back(record);
+    }
+    cv.notify_one();
+}
+
+void ReplayLogWriter::appendKeyframe(boost::shared_ptr<GameSnapshot> snapshot)
+{
+    QueuedRecord record;
+    record.keyframeOrNull = snapshot;
+    queueRecord(record);
+}
+
+void ReplayLogWriter::appendFramePacket(boost::shared_ptr<const vch> packet)
+{
+    QueuedRecord record;
+    record.framePacketOrNull = packet;
+    queueRecord(record);
+}
+
+ReplayLogWriter::ReplayLogWriter(string path)
+    : path(path), logFd(-1), indexFd(-1), logSize(0), failed(false), stopping(false)
+{
+    logFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    indexFd = open(replayIndexPath(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+    ReplayFileHeader header;
+    memcpy(header.magic, REPLAY_FILE_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_FILE_VERSION;
+    header.byteOrderMark = REPLAY_FILE_BYTE_ORDER_MARK;
+
+    if (logFd < 0 || indexFd < 0 || !writeAll(logFd, &header, sizeof(header)))
+    {
+        cout << "Couldn't create replay log " << path << "; this game won't be recorded." << endl;
+        failed = true;
+    }
+    logSize = sizeof(header);
+
+    writerThread = thread(&ReplayLogWriter::writerLoop, this);
+}
+
+ReplayLogWriter::~ReplayLogWriter()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_one();
+    writerThread.join();
+
+    if (logFd >= 0)
+        close(logFd);
+    if (indexFd >= 0)
+        close(indexFd);
+}
@@ -0,0 +1,82 @@
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+#include "common.h"
+#include "snapshots.h"
+
+#ifndef REPLAYLOG_H
+#define REPLAYLOG_H
+
+using namespace std;
+
+// Layout of a replay log, meant to be mmap'd by the replay tool:
+//   ReplayFileHeader
+//   then server packets back to back, just as a client would get them (header included, uncompressed):
+//     PACKET_RESYNC_CHAR keyframes, each the game as it stood at the start of its frame;
+//       one for wherever the server started, then one every REPLAY_KEYFRAME_INTERVAL frames of a match
+//     PACKET_FRAMECMDS_CHAR packets for every frame in order, except empty ones during a match (as with implicit frames)
+// A keyframe comes right before the packet for its own frame.
+// Next to it, <path>.idx is a bare array of ReplayIndexEntry, one per keyframe, so a replay can start from any of them.
+// Both are only ever appended to, so a crash costs at most a partly written last packet, which the replay tool stops short of.
+struct ReplayFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+};
+
+struct ReplayIndexEntry
+{
+    uint64_t frame;
+    uint64_t offset; // of the keyframe's packet header, from the start of the log
+};
+
+const char REPLAY_FILE_MAGIC[8] = {'C', 'F', 'R', 'E', 'P', 'L', 'A', 'Y'};
+const uint32_t REPLAY_FILE_VERSION = 2;
+const uint32_t REPLAY_FILE_BYTE_ORDER_MARK = 0x01020304;
+
+string replayIndexPath(string logPath);
+
+// Appends to a replay log on its own thread. The tick thread only hands over packets and snapshots it already has.
+// Unlike SnapshotFileWriter nothing is ever skipped; if the disk falls behind, the queue grows.
+// If a write fails, the writer says so once and stops recording.
+class ReplayLogWriter
+{
+    string path;
+    int logFd;
+    int indexFd;
+    uint64_t logSize;
+    atomic<bool> failed;
+
+    // one or the other is set
+    struct QueuedRecord
+    {
+        boost::shared_ptr<const vch> framePacketOrNull;
+        boost::shared_ptr<GameSnapshot> keyframeOrNull;
+    };
+
+    thread writerThread;
+    mutex mtx;
+    condition_variable cv;
+    deque<QueuedRecord> queuedRecords;
+    bool stopping;
+
+    bool writeRecord(const QueuedRecord &record);
+    void writerLoop();
+    void queueRecord(QueuedRecord record);
+public:
+    void appendKeyframe(boost::shared_ptr<GameSnapshot> snapshot);
+    // a PACKET_FRAMECMDS_CHAR packet, exactly as packed for clients
+    void appendFramePacket(boost::shared_ptr<const vch> packet);
+
+    // Creates the log (and its index) at path; if it can't, the writer is failed from the start.
+    ReplayLogWriter(string path);
+    // writes out anything still queued first
+    ~ReplayLogWriter();
+};
+
+#endif // REPLAYLOG_H
@@ -0,0 +1,452 @@
+#include "secp256k1.h"
+#include "keccak.h"
+
+using namespace std;
+
+using uint128 = unsigned __int128;
+
+// little-endian 64-bit limbs
+struct U256
+{
+    uint64_t limb[4];
+};
+
+// Both moduli sit just under 2^256, so 2^256 is congruent to a small complement,
+// and a wide product reduces by folding its high limbs back in multiplied by that.
+struct Modulus
+{
+    U256 m;
+    uint64_t complement[3];
+    size_t complementLen;
+};
+
+const Modulus FIELD_P = {
+    {{0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL}},
+    {0x00000001000003D1ULL, 0, 0}, 1
+};
+const Modulus GROUP_N = {
+    {{0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL}},
+    {0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 0x0000000000000001ULL}, 3
+};
+
+const U256 GENERATOR_X = {{0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL, 0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL}};
+const U256 GENERATOR_Y = {{0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL, 0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL}};
+
+U256 u256FromBytes(const unsigned char *bigEndian)
+{
+    U256 a;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        uint64_t limb = 0;
+        for (unsigned int b = 0; b < 8; b++)
+            limb = (limb << 8) | bigEndian[(3 - i) * 8 + b];
+        a.limb[i] = limb;
+    }
+    return a;
+}
+
+void packU256(vch *dest, const U256 &a)
+{
+    for (int i = 3; i >= 0; i--)
+        for (int b = 7; b >= 0; b--)
+            dest->push_back((unsigned char)(a.limb[i] >> (8 * b)));
+}
+
+U256 u256FromSmall(uint64_t v)
+{
+    return {{v, 0, 0, 0}};
+}
+
+bool isZero(const U256 &a)
+{
+    return (a.limb[0] | a.limb[1] | a.limb[2] | a.limb[3]) == 0;
+}
+
+int compare(const U256 &a, const U256 &b)
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a.limb[i] != b.limb[i])
+            return a.limb[i] < b.limb[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+bool testBit(const U256 &a, unsigned int bit)
+{
+    return (a.limb[bit / 64] >> (bit % 64)) & 1;
+}
+
+uint64_t addWithCarry(U256 *dest, const U256 &a, const U256 &b)
+{
+    uint64_t carry = 0;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        uint128 acc = (uint128)a.limb[i] + b.limb[i] + carry;
+        dest->limb[i] = (uint64_t)acc;
+        carry = (uint64_t)(acc >> 64);
+    }
+    return carry;
+}
+
+uint64_t subWithBorrow(U256 *dest, const U256 &a, const U256 &b)
+{
+    uint64_t borrow = 0;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        uint128 acc = (uint128)a.limb[i] - b.limb[i] - borrow;
+        dest->limb[i] = (uint64_t)acc;
+        borrow = (uint64_t)(acc >> 64) & 1;
+    }
+    return borrow;
+}
+
+// wide has len limbs, at most 8
+U256 reduceWide(const uint64_t *wide, size_t len, const Modulus &mod)
+{
+    uint64_t t[9] = {0};
+    for (size_t i = 0; i < len; i++)
+        t[i] = wide[i];
+
+    while (len > 4)
+    {
+        uint64_t folded[9] = {t[0], t[1], t[2], t[3], 0, 0, 0, 0, 0};
+        for (size_t i = 0; i < len - 4; i++)
+        {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < mod.complementLen; j++)
+            {
+                uint128 acc = (uint128)t[4 + i] * mod.complement[j] + folded[i + j] + carry;
+                folded[i + j] = (uint64_t)acc;
+                carry = (uint64_t)(acc >> 64);
+            }
+            for (size_t k = i + mod.complementLen; carry; k++)
+            {
+                uint128 acc = (uint128)folded[k] + carry;
+                folded[k] = (uint64_t)acc;
+                carry = (uint64_t)(acc >> 64);
+            }
+        }
+
+        len = 9;
+        while (len > 4 && folded[len - 1] == 0)
+            len--;
+        for (size_t i = 0; i < 9; i++)
+            t[i] = folded[i];
+    }
+
+    U256 result = {{t[0], t[1], t[2], t[3]}};
+    while (compare(result, mod.m) >= 0)
+        subWithBorrow(&result, result, mod.m);
+    return result;
+}
+
+// a and b are already reduced, so the sum is under 2m and one subtraction is enough
+U256 modAdd(const U256 &a, const U256 &b, const Modulus &mod)
+{
+    U256 sum;
+    uint64_t carry = addWithCarry(&sum, a, b);
+    if (carry || compare(sum, mod.m) >= 0)
+        subWithBorrow(&sum, sum, mod.m);
+    return sum;
+}
+
+U256 modSub(const U256 &a, const U256 &b, const Modulus &mod)
+{
+    U256 diff;
+    if (subWithBorrow(&diff, a, b))
+        addWithCarry(&diff, diff, mod.m);
+    return diff;
+}
+
+// The field's complement fits in one limb, so two folds always do it; this is most of the work in a recovery.
+U256 reduceFieldWide(const uint64_t wide[8])
+{
+    const uint64_t c = FIELD_P.complement[0];
+    U256 t;
+    uint64_t carry = 0;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        uint128 acc = (uint128)wide[i + 4] * c + wide[i] + carry;
+        t.limb[i] = (uint64_t)acc;
+        carry = (uint64_t)(acc >> 64);
+    }
+
+    uint128 acc = (uint128)carry * c + t.limb[0];
+    t.limb[0] = (uint64_t)acc;
+    carry = (uint64_t)(acc >> 64);
+    for (unsigned int i = 1; i < 4 && carry; i++)
+    {
+        acc = (uint128)t.limb[i] + carry;
+        t.limb[i] = (uint64_t)acc;
+        carry = (uint64_t)(acc >> 64);
+    }
+    // wrapped past 2^256 once more, which is only possible if t is now tiny
+    if (carry)
+        t.limb[0] += c;
+
+    if (compare(t, FIELD_P.m) >= 0)
+        subWithBorrow(&t, t, FIELD_P.m);
+    return t;
+}
+
+U256 modMul(const U256 &a, const U256 &b, const Modulus &mod)
+{
+    uint64_t wide[8] = {0};
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        uint64_t carry = 0;
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            uint128 acc = (uint128)a.limb[i] * b.limb[j] + wide[i + j] + carry;
+            wide[i + j] = (uint64_t)acc;
+            carry = (uint64_t)(acc >> 64);
+        }
+        wide[i + 4] = carry;
+    }
+    if (&mod == &FIELD_P)
+        return reduceFieldWide(wide);
+    return reduceWide(wide, 8, mod);
+}
+
+U256 modPow(const U256 &base, const U256 &exponent, const Modulus &mod)
+{
+    U256 result = u256FromSmall(1);
+    for (int bit = 255; bit >= 0; bit--)
+    {
+        result = modMul(result, result, mod);
+        if (testBit(exponent, bit))
+            result = modMul(result, base, mod);
+    }
+    return result;
+}
+
+// both moduli are prime, so a^(m-2) is a's inverse
+U256 modInverse(const U256 &a, const Modulus &mod)
+{
+    U256 exponent;
+    subWithBorrow(&exponent, mod.m, u256FromSmall(2));
+    return modPow(a, exponent, mod);
+}
+
+// Jacobian coordinates: (x, y) = (X/Z^2, Y/Z^3)
+struct JacobianPoint
+{
+    U256 x, y, z;
+    bool infinity;
+};
+
+JacobianPoint pointFromAffine(const U256 &x, const U256 &y)
+{
+    return {x, y, u256FromSmall(1), false};
+}
+
+JacobianPoint pointAtInfinity()
+{
+    return {u256FromSmall(0), u256FromSmall(0), u256FromSmall(0), true};
+}
+
+JacobianPoint pointDouble(const JacobianPoint &p)
+{
+    if (p.infinity || isZero(p.y))
+        return pointAtInfinity();
+
+    const Modulus &f = FIELD_P;
+    U256 a = modMul(p.x, p.x, f);
+    U256 b = modMul(p.y, p.y, f);
+    U256 c = modMul(b, b, f);
+    U256 xPlusB = modAdd(p.x, b, f);
+    U256 d = modSub(modSub(modMul(xPlusB, xPlusB, f), a, f), c, f);
+    d = modAdd(d, d, f);
+    U256 e = modAdd(modAdd(a, a, f), a, f);
+    U256 eSquared = modMul(e, e, f);
+
+    JacobianPoint result;
+    result.infinity = false;
+    result.x = modSub(eSquared, modAdd(d, d, f), f);
+    U256 eightC = modAdd(c, c, f);
+    eightC = modAdd(eightC, eightC, f);
+    eightC = modAdd(eightC, eightC, f);
+    result.y = modSub(modMul(e, modSub(d, result.x, f), f), eightC, f);
+    U256 yz = modMul(p.y, p.z, f);
+    result.z = modAdd(yz, yz, f);
+    return result;
+}
+
+JacobianPoint pointAdd(const JacobianPoint &p, const JacobianPoint &q)
+{
+    if (p.infinity)
+        return q;
+    if (q.infinity)
+        return p;
+
+    const Modulus &f = FIELD_P;
+    U256 pzSquared = modMul(p.z, p.z, f);
+    U256 qzSquared = modMul(q.z, q.z, f);
+    U256 u1 = modMul(p.x, qzSquared, f);
+    U256 u2 = modMul(q.x, pzSquared, f);
+    U256 s1 = modMul(p.y, modMul(q.z, qzSquared, f), f);
+    U256 s2 = modMul(q.y, modMul(p.z, pzSquared, f), f);
+    U256 h = modSub(u2, u1, f);
+    U256 r = modSub(s2, s1, f);
+
+    if (isZero(h))
+    {
+        if (isZero(r))
+            return pointDouble(p);
+        else
+            return pointAtInfinity();
+    }
+
+    U256 hSquared = modMul(h, h, f);
+    U256 hCubed = modMul(h, hSquared, f);
+    U256 v = modMul(u1, hSquared, f);
+
+    JacobianPoint result;
+    result.infinity = false;
+    result.x = modSub(modSub(modMul(r, r, f), hCubed, f), modAdd(v, v, f), f);
+    result.y = modSub(modMul(r, modSub(v, result.x, f), f), modMul(s1, hCubed, f), f);
+    result.z = modMul(modMul(p.z, q.z, f), h, f);
+    return result;
+}
+
+void toAffine(const JacobianPoint &p, U256 *x, U256 *y)
+{
+    const Modulus &f = FIELD_P;
+    U256 zInverse = modInverse(p.z, f);
+    U256 zInverseSquared = modMul(zInverse, zInverse, f);
+    *x = modMul(p.x, zInverseSquared, f);
+    *y = modMul(p.y, modMul(zInverseSquared, zInverse, f), f);
+}
+
+// a*p + b*q, sharing the doublings between the two (Shamir's trick)
+JacobianPoint pointMulAdd(const U256 &a, const JacobianPoint &p, const U256 &b, const JacobianPoint &q)
+{
+    JacobianPoint pPlusQ = pointAdd(p, q);
+    JacobianPoint result = pointAtInfinity();
+    for (int bit = 255; bit >= 0; bit--)
+    {
+        result = pointDouble(result);
+        bool aBit = testBit(a, bit);
+        bool bBit = testBit(b, bit);
+        if (aBit && bBit)
+            result = pointAdd(result, pPlusQ);
+        else if (aBit)
+            result = pointAdd(result, p);
+        else if (bBit)
+            result = pointAdd(result, q);
+    }
+    return result;
+}
+
+optional<vch> recoverPubKey(const vch &hash, const vch &sig, unsigned char recoveryId)
+{
+    if (hash.size() != 32 || sig.size() != 64 || recoveryId > 1)
+        return {};
+
+    U256 r = u256FromBytes(sig.data());
+    U256 s = u256FromBytes(sig.data() + 32);
+    if (isZero(r) || isZero(s) || compare(r, GROUP_N.m) >= 0 || compare(s, GROUP_N.m) >= 0)
+        return {};
+
+    // the point r is the x of, with y picked out by the recovery id; y = sqrt(x^3 + 7), using p = 3 mod 4
+    const Modulus &f = FIELD_P;
+    U256 alpha = modAdd(modMul(modMul(r, r, f), r, f), u256FromSmall(7), f);
+    U256 sqrtExponent;
+    addWithCarry(&sqrtExponent, f.m, u256FromSmall(1));
+    for (unsigned int i = 0; i < 4; i++)
+        sqrtExponent.limb[i] = (sqrtExponent.limb[i] >> 2) | (i < 3 ? sqrtExponent.limb[i + 1] << 62 : 0);
+    U256 beta = modPow(alpha, sqrtExponent, f);
+    if (compare(modMul(beta, beta, f), alpha) != 0)
+        return {};
+    U256 y = ((beta.limb[0] & 1) == recoveryId) ? beta : modSub(u256FromSmall(0), beta, f);
+
+    // Q = r^-1 * (s*R - e*G)
+    uint64_t hashLimbs[4];
+    U256 hashInt = u256FromBytes(hash.data());
+    for (unsigned int i = 0; i < 4; i++)
+        hashLimbs[i] = hashInt.limb[i];
+    U256 e = reduceWide(hashLimbs, 4, GROUP_N);
+    U256 rInverse = modInverse(r, GROUP_N);
+    U256 u1 = modMul(modSub(u256FromSmall(0), e, GROUP_N), rInverse, GROUP_N);
+    U256 u2 = modMul(s, rInverse, GROUP_N);
+
+    JacobianPoint q = pointMulAdd(u1, pointFromAffine(GENERATOR_X, GENERATOR_Y), u2, pointFromAffine(r, y));
+    if (q.infinity)
+        return {};
+
+    U256 x, qy;
+    toAffine(q, &x, &qy);
+
+    vch pubKey;
+    packU256(&pubKey, x);
+    packU256(&pubKey, qy);
+    return pubKey;
+}
+
+optional<U256> privKeyToScalar(const vch &privKey)
+{
+    if (privKey.size() != 32)
+        return {};
+    U256 d = u256FromBytes(privKey.data());
+    if (isZero(d) || compare(d, GROUP_N.m) >= 0)
+        return {};
+    return d;
+}
+
+optional<vch> pubKeyFromPrivKey(const vch &privKey)
+{
+    optional<U256> maybeD = privKeyToScalar(privKey);
+    if (!maybeD)
+        return {};
+
+    JacobianPoint g = pointFromAffine(GENERATOR_X, GENERATOR_Y);
+    U256 x, y;
+    toAffine(pointMulAdd(*maybeD, g, u256FromSmall(0), g), &x, &y);
+
+    vch pubKey;
+    packU256(&pubKey, x);
+    packU256(&pubKey, y);
+    return pubKey;
+}
+
+optional<vch> signHash(const vch &hash, const vch &privKey, unsigned char *recoveryId)
+{
+    optional<U256> maybeD = privKeyToScalar(privKey);
+    if (hash.size() != 32 || !maybeD)
+        return {};
+
+    uint64_t hashLimbs[4];
+    U256 hashInt = u256FromBytes(hash.data());
+    for (unsigned int i = 0; i < 4; i++)
+        hashLimbs[i] = hashInt.limb[i];
+    U256 e = reduceWide(hashLimbs, 4, GROUP_N);
+
+    JacobianPoint g = pointFromAffine(GENERATOR_X, GENERATOR_Y);
+    // the nonce is a MAC of the hash under the key, so the same message always gets the same signature;
+    // the counter only moves on in the astronomically unlikely case a nonce doesn't work out
+    for (unsigned char counter = 0; ; counter++)
+    {
+        vch nonceInput(hash);
+        nonceInput.push_back(counter);
+        vch nonceBytes = hmacKeccak256(privKey, nonceInput);
+        U256 k = u256FromBytes(nonceBytes.data());
+        if (isZero(k) || compare(k, GROUP_N.m) >= 0)
+            continue;
+
+        // s = k^-1 * (e + r*d); r is R's x, and is only usable for recovery if it was already under n
+        U256 rx, ry;
+        toAffine(pointMulAdd(k, g, u256FromSmall(0), g), &rx, &ry);
+        if (compare(rx, GROUP_N.m) >= 0)
+            continue;
+        U256 s = modMul(modInverse(k, GROUP_N), modAdd(e, modMul(rx, *maybeD, GROUP_N), GROUP_N), GROUP_N);
+        if (isZero(rx) || isZero(s))
+            continue;
+
+        *recoveryId = ry.limb[0] & 1;
+        vch sig;
+        packU256(&sig, rx);
+        packU256(&sig, s);
+        return sig;
+    }
+}
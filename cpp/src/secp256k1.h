@@ -0,0 +1,20 @@
+#include <optional>
+#include "common.h"
+
+#ifndef SECP256K1_H
+#define SECP256K1_H
+
+using namespace std;
+
+// Recovers the public key that made an ECDSA signature over a 32-byte hash on secp256k1.
+// sig is r then s, each 32 bytes big-endian; recoveryId is 0 or 1, the parity of the y of the point r came from.
+// Returns the uncompressed key as 64 bytes (x then y, big-endian), or nothing if the signature can't have come from any key.
+optional<vch> recoverPubKey(const vch &hash, const vch &sig, unsigned char recoveryId);
+
+// The other direction, for test keys like those of loadgen's bots.
+// Not constant time, so not for keys that guard anything.
+// privKey is 32 bytes big-endian; the results are in the same forms as above.
+optional<vch> pubKeyFromPrivKey(const vch &privKey);
+optional<vch> signHash(const vch &hash, const vch &privKey, unsigned char *recoveryId);
+
+#endif // SECP256K1_H
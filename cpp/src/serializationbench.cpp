@@ -0,0 +1,250 @@
+#include <iostream>
+#include <functional>
+#include <stdio.h>
+#include "benchcommon.h"
+#include "engine.h"
+#include "packets.h"
+#include "cmds.h"
+#include "common.h"
+
+using namespace std;
+
+// Times the serializers at realistic scales, so changes to them can be judged on numbers.
+// For each case it reports, for encode and decode:
+//   ns per unit (entity or cmd), bytes per unit, and heap allocations per unit.
+// Usage: serializationbench [quick]
+
+struct BenchResult
+{
+    double secondsPerRep;
+    double allocationsPerRep;
+};
+
+// Runs f for about minSeconds (and at least 3 times), after one untimed warmup.
+BenchResult runBench(function<void()> f, double minSeconds)
+{
+    f();
+
+    int reps = 0;
+    uint64_t allocationsBefore = getAllocationCount();
+    auto start = chrono::steady_clock::now();
+    do
+    {
+        f();
+        reps++;
+    } while (reps < 3 || secondsSince(start) < minSeconds);
+    double seconds = secondsSince(start);
+
+    BenchResult result;
+    result.secondsPerRep = seconds / reps;
+    result.allocationsPerRep = (double)(getAllocationCount() - allocationsBefore) / reps;
+    return result;
+}
+
+void printHeader(string unitName)
+{
+    printf("\n%-36s %12s %12s %12s %12s %12s\n",
+           "case", ("ns/" + unitName + " enc").c_str(), ("ns/" + unitName + " dec").c_str(), ("B/" + unitName).c_str(), "allocs enc", "allocs dec");
+}
+void printRow(string label, unsigned int numUnits, unsigned long numBytes, BenchResult encode, BenchResult decode)
+{
+    printf("%-36s %12.1f %12.1f %12.2f %12.2f %12.2f\n",
+           label.c_str(),
+           encode.secondsPerRep * 1e9 / numUnits,
+           decode.secondsPerRep * 1e9 / numUnits,
+           (double)numBytes / numUnits,
+           encode.allocationsPerRep / numUnits,
+           decode.allocationsPerRep / numUnits);
+}
+
+void benchGame(unsigned int numEntities, unsigned int numPlayers, double minSeconds)
+{
+    Game game;
+    fillSyntheticGame(&game, numEntities, numPlayers);
+
+    vch packed;
+    BenchResult encode = runBench([&]() {
+        packed.clear();
+        game.pack(&packed);
+    }, minSeconds);
+
+    BenchResult decode = runBench([&]() {
+        vchIter place = packed.begin();
+        Game unpacked(&place);
+    }, minSeconds);
+
+    printRow("Game, " + to_string(numEntities) + " ents, " + to_string(numPlayers) + " players", game.entities.size(), packed.size(), encode, decode);
+}
+
+// Game::packInParallelAndRecordEntityOffsets and Game::unpackInParallelWithEntityOffsets on the same game, with more and more threads.
+void benchGameParallel(unsigned int numEntities, double minSeconds)
+{
+    Game game;
+    fillSyntheticGame(&game, numEntities, 32);
+
+    vch sequential;
+    game.pack(&sequential);
+
+    printf("\n%-36s %12s %12s %12s %12s\n", "case", "ns/entity enc", "ns/entity dec", "speedup enc", "speedup dec");
+    double baseEncode = 0, baseDecode = 0;
+    unsigned int threadCounts[] = {1, 2, 4, 8, 16};
+    for (unsigned int numThreads : threadCounts)
+    {
+        vch packed;
+        vector<uint32_t> entityOffsets;
+        BenchResult encode = runBench([&]() {
+            packed.clear();
+            entityOffsets.clear();
+            game.packInParallelAndRecordEntityOffsets(&packed, &entityOffsets, numThreads);
+        }, minSeconds);
+
+        if (packed != sequential)
+        {
+            fprintf(stderr, "packInParallelAndRecordEntityOffsets with %u threads doesn't match Game::pack!\n", numThreads);
+            exit(1);
+        }
+
+        BenchResult decode = runBench([&]() {
+            Game unpacked;
+            unpacked.unpackInParallelWithEntityOffsets(packed.begin(), entityOffsets, numThreads);
+        }, minSeconds);
+
+        if (numThreads == 1)
+        {
+            baseEncode = encode.secondsPerRep;
+            baseDecode = decode.secondsPerRep;
+        }
+
+        printf("%-36s %12.1f %12.1f %12.2f %12.2f\n",
+               ("Game, " + to_string(numEntities) + " ents, " + to_string(numThreads) + " threads").c_str(),
+               encode.secondsPerRep * 1e9 / game.entities.size(),
+               decode.secondsPerRep * 1e9 / game.entities.size(),
+               baseEncode / encode.secondsPerRep,
+               baseDecode / decode.secondsPerRep);
+    }
+}
+
+void benchFramePacket(unsigned int numCmds, unsigned int unitsPerCmd, double minSeconds)
+{
+    Game game;
+    fillSyntheticGame(&game, 1000, 8);
+    FrameEventsPacket fcp = makeSyntheticFramePacket(&game, numCmds, unitsPerCmd);
+
+    vch packed;
+    BenchResult encode = runBench([&]() {
+        packed.clear();
+        fcp.pack(&packed);
+    }, minSeconds);
+
+    BenchResult decode = runBench([&]() {
+        vchIter place = packed.begin();
+        FrameEventsPacket unpacked(&place);
+    }, minSeconds);
+
+    printRow("FrameEventsPacket, " + to_string(numCmds) + " cmds x " + to_string(unitsPerCmd) + " units", numCmds, packed.size(), encode, decode);
+}
+
+void benchCmds(unsigned int unitsPerCmd, double minSeconds)
+{
+    Game game;
+    fillSyntheticGame(&game, 1000, 8);
+    FrameEventsPacket fcp = makeSyntheticFramePacket(&game, 200, unitsPerCmd);
+
+    // cmds as the server receives them: typechar then body
+    vch packed;
+    BenchResult encode = runBench([&]() {
+        packed.clear();
+        for (unsigned int i = 0; i < fcp.authdCmds.size(); i++)
+        {
+            packTypechar(&packed, fcp.authdCmds[i]->cmd->getTypechar());
+            fcp.authdCmds[i]->cmd->pack(&packed);
+        }
+    }, minSeconds);
+
+    BenchResult decode = runBench([&]() {
+        vchIter place = packed.begin();
+        for (unsigned int i = 0; i < fcp.authdCmds.size(); i++)
+        {
+            boost::shared_ptr<Cmd> cmd = unpackFullCmdAndMoveIter(&place);
+        }
+    }, minSeconds);
+
+    printRow("unpackFullCmdAndMoveIter, " + to_string(unitsPerCmd) + " units", fcp.authdCmds.size(), packed.size(), encode, decode);
+}
+
+void benchStrings(double minSeconds)
+{
+    unsigned int numStrings = 1000;
+    vector<string> addresses;
+    for (unsigned int i = 0; i < numStrings; i++)
+    {
+        addresses.push_back(randomPlayerAddress());
+    }
+
+    vch packed;
+    BenchResult encode = runBench([&]() {
+        packed.clear();
+        for (unsigned int i = 0; i < numStrings; i++)
+        {
+            packStringToVch(&packed, addresses[i]);
+        }
+    }, minSeconds);
+
+    BenchResult decode = runBench([&]() {
+        vchIter place = packed.begin();
+        string s;
+        for (unsigned int i = 0; i < numStrings; i++)
+        {
+            place = unpackStringFromIter(place, 50, &s);
+        }
+    }, minSeconds);
+
+    printRow("packStringToVch, 42-char addresses", numStrings, packed.size(), encode, decode);
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    bool quick = (argc > 1 && string(argv[1]) == "quick");
+    double minSeconds = quick ? 0.05 : 0.5;
+
+    // Game::iterate prints balances and the like; keep stdout for results
+    cout.setstate(ios::failbit);
+
+    printHeader("entity");
+    unsigned int entityCounts[] = {100, 1000, 10000, 50000};
+    unsigned int playerCounts[] = {2, 32, 255};
+    for (unsigned int numEntities : entityCounts)
+    {
+        for (unsigned int numPlayers : playerCounts)
+        {
+            // every player starts with a Gateway and a Prime
+            if (numPlayers * 2 > numEntities)
+                continue;
+            benchGame(numEntities, numPlayers, minSeconds);
+        }
+    }
+
+    benchGameParallel(50000, minSeconds);
+
+    printHeader("cmd");
+    unsigned int cmdCounts[] = {10, 100, 255};
+    unsigned int unitCounts[] = {1, 20};
+    for (unsigned int numCmds : cmdCounts)
+    {
+        for (unsigned int unitsPerCmd : unitCounts)
+        {
+            benchFramePacket(numCmds, unitsPerCmd, minSeconds);
+        }
+    }
+    for (unsigned int unitsPerCmd : unitCounts)
+    {
+        benchCmds(unitsPerCmd, minSeconds);
+    }
+
+    printHeader("string");
+    benchStrings(minSeconds);
+
+    return 0;
+}
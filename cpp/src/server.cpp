@@ -2,33 +2,74 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
-#include <filesystem>
 #include <vector>
+#include <deque>
 #include <string>
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <sstream>
 #include "cmds.h"
 #include "engine.h"
 #include "config.h"
 #include "packets.h"
 #include "sigWrapper.h"
+#include "sessiontokens.h"
 #include "events.h"
+#include "snapshots.h"
+#include "compression.h"
+#include "snapshotfile.h"
+#include "replaylog.h"
+#include "writeaheadlog.h"
+#include "framescheduler.h"
+#include "mpscqueue.h"
 
 using namespace std;
 using namespace boost::asio::ip;
 
 class ClientChannel;
 
-vector<ClientChannel *> clientChannels;
+// only touched by the sim thread
+vector<boost::shared_ptr<ClientChannel>> clientChannels;
+
+// A token bucket: lets a player's cmds through at CMD_RATE_LIMIT_PER_SECOND on average, in bursts of up to CMD_RATE_LIMIT_BURST.
+struct CmdRateLimiter
+{
+    double tokens;
+    chrono::steady_clock::time_point lastRefill;
+    uint64_t droppedSinceBackingOff;
+
+    bool tryTake()
+    {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        tokens = min(CMD_RATE_LIMIT_BURST, tokens + chrono::duration<double>(now - lastRefill).count() * CMD_RATE_LIMIT_PER_SECOND);
+        lastRefill = now;
+
+        if (tokens < 1)
+            return false;
+        tokens -= 1;
+        return true;
+    }
+
+    CmdRateLimiter()
+        : tokens(CMD_RATE_LIMIT_BURST), lastRefill(chrono::steady_clock::now()), droppedSinceBackingOff(0) {}
+};
+// indexed by playerId, so shared by all of a player's connections; only touched by the sim thread
+vector<CmdRateLimiter> cmdRateLimiters;
 
 class Listener
 {
     boost::asio::io_service &ioService;
+    SigVerifier *sigVerifier;
+    SessionTokens *sessionTokens;
     tcp::acceptor acceptor;
 
 public:
-    Listener(boost::asio::io_service &ioService_)
-        : ioService(ioService_), acceptor(ioService_, tcp::endpoint(tcp::v4(), 8473))
+    Listener(boost::asio::io_service &ioService_, SigVerifier *sigVerifier, SessionTokens *sessionTokens)
+        : ioService(ioService_), sigVerifier(sigVerifier), sessionTokens(sessionTokens), acceptor(ioService_, tcp::endpoint(tcp::v4(), 8473))
     {
     }
     void startAccept()
@@ -41,7 +82,8 @@ public:
 };
 
 Game game;
-bool adminRoleTaken(false);
+SnapshotHistory snapshotHistory;
+atomic<bool> adminRoleTaken(false);
 
 void testHandler(const boost::system::error_code &error, size_t numSent)
 {
@@ -55,22 +97,38 @@ void testHandler(const boost::system::error_code &error, size_t numSent)
     }
 }
 
-void clearVchAndPackResyncPacket(vch *dest)
+// Only reads the snapshots, so it's safe to call off the sim thread.
+// Sends only what's changed since baselineOrNull, if given.
+void clearVchAndPackResyncPacket(vch *dest, GameSnapshot *baselineOrNull, GameSnapshot *snapshot, bool compress)
 {
     dest->clear();
-    game.pack(dest);
+
+    unsigned char typechar;
+    if (baselineOrNull)
+    {
+        packDeltaResync(dest, baselineOrNull, snapshot);
+        typechar = PACKET_DELTARESYNC_CHAR;
+    }
+    else
+    {
+        dest->insert(dest->end(), snapshot->packed.begin(), snapshot->packed.end());
+        typechar = PACKET_RESYNC_CHAR;
+    }
 
     vch prepended;
-    packToVch(&prepended, "C", PACKET_RESYNC_CHAR);
+    packToVch(&prepended, "C", typechar);
     packToVch(&prepended, "Q", (uint64_t)(dest->size()));
 
     dest->insert(dest->begin(), prepended.begin(), prepended.end());
+
+    if (compress)
+        compressPacketIfSmaller(dest);
 }
-void clearVchAndPackFrameCmdsPacket(vch *dest, FrameEventsPacket fcp)
+void clearVchAndPackFrameCmdsPacket(vch *dest, FrameEventsPacket *fcp)
 {
     dest->clear();
 
-    fcp.pack(dest);
+    fcp->pack(dest);
 
     vch prepended;
     packToVch(&prepended, "C", PACKET_FRAMECMDS_CHAR);
@@ -79,20 +137,134 @@ void clearVchAndPackFrameCmdsPacket(vch *dest, FrameEventsPacket fcp)
     dest->insert(dest->begin(), prepended.begin(), prepended.end());
 }
 
-vector<boost::shared_ptr<AuthdCmd>> pendingCmds;
+// A frame's packet, packed once and then queued by reference on every channel.
+// The compressed version and the tick are only built if some channel wants them.
+struct SharedFramePacket
+{
+    uint64_t frame;
+    // empty and in a match, so a client with implicit frames can go without it
+    bool canBeElided;
+
+    boost::shared_ptr<const vch> plain;
+    boost::shared_ptr<const vch> compressedOrPlain;
+    boost::shared_ptr<const vch> tickOrNull;
+
+    boost::shared_ptr<const vch> getForChannel(bool compressionEnabled)
+    {
+        if (!compressionEnabled || plain->size() < COMPRESSION_MIN_FRAME_PACKET_SIZE)
+            return plain;
+
+        if (!compressedOrPlain)
+        {
+            boost::shared_ptr<vch> compressed(new vch(*plain));
+            compressPacketIfSmaller(compressed.get());
+            compressedOrPlain = compressed;
+        }
+        return compressedOrPlain;
+    }
+
+    // tells a client with implicit frames that every frame up to and including this one was empty
+    boost::shared_ptr<const vch> getTick()
+    {
+        if (!tickOrNull)
+        {
+            boost::shared_ptr<vch> tick(new vch);
+            packToVch(tick.get(), "C", PACKET_FRAMETICK_CHAR);
+            packToVch(tick.get(), "Q", (uint64_t)8);
+            packToVch(tick.get(), "Q", frame);
+            tickOrNull = tick;
+        }
+        return tickOrNull;
+    }
+
+    SharedFramePacket(FrameEventsPacket *fcp)
+        : frame(fcp->frame)
+    {
+        canBeElided = fcp->authdCmds.size() == 0 && fcp->events.size() == 0 && fcp->scheduledCmds.size() == 0 && game.state == Game::Active;
 
-class ClientChannel
+        boost::shared_ptr<vch> packed(new vch);
+        clearVchAndPackFrameCmdsPacket(packed.get(), fcp);
+        plain = packed;
+    }
+};
+
+// What ClientChannels hand over to the sim thread. Only the fields relevant to the kind are set.
+struct ChannelMessage
+{
+    enum Kind {
+        Authenticated,
+        ReceivedCmd,
+        ReceivedResyncRequest,
+        ReceivedConnectionOptions,
+        ReceivedPong,
+        Disconnected,
+        ResyncPacked
+    } kind;
+    boost::shared_ptr<ClientChannel> channel;
+
+    boost::shared_ptr<Cmd> cmd;
+    ResyncRequestPacket resyncRequest;
+    ConnectionOptionsPacket connectionOptions;
+    uint64_t pingFrame;
+    boost::shared_ptr<const vch> resyncPacket;
+    // for Authenticated: the token to hand the client (if any), and where a resuming client's frames left off
+    string sessionToken;
+    optional<uint64_t> maybeResumeFromFrame;
+
+    ChannelMessage(Kind kind, boost::shared_ptr<ClientChannel> channel)
+        : kind(kind), channel(channel), connectionOptions((unsigned char)0), pingFrame(0) {}
+};
+
+// pushed to from the I/O thread, drained by the sim thread at the start of each frame
+MPSCQueue<ChannelMessage> channelMessages;
+
+// resync packets get built on this service's thread, from snapshots that were already packed
+boost::asio::io_service resyncWorkService;
+
+// the packets for each frame since the latest snapshot, to follow a resync built from it
+using RecentFramePackets = deque<pair<uint64_t, boost::shared_ptr<SharedFramePacket>>>;
+
+// the earliest frame whose packet could have announced a cmd executing on or after this one
+uint64_t firstFrameAnnouncingCmdsFor(uint64_t frame)
+{
+    return frame > CMD_DELAY_MAX_FRAMES ? frame - CMD_DELAY_MAX_FRAMES : 0;
+}
+
+// Handlers run on the I/O thread, serialized through the channel's strand.
+// The sim thread only touches the members marked as its own, and hands packets over through outbox.
+class ClientChannel : public boost::enable_shared_from_this<ClientChannel>
 {
     boost::asio::io_service &ioService;
+    boost::asio::io_service::strand strand;
+    SigVerifier *sigVerifier;
+    SessionTokens *sessionTokens;
     boost::shared_ptr<tcp::socket> socket;
 
-    vector<vch *> packetsToSend;
-    bool sending;
+    // a null packet in the outbox means "drop everything queued before this that isn't already being written"
+    MPSCQueue<boost::shared_ptr<const vch>> outbox;
+    atomic<bool> flushScheduled;
+
+    // everything queued goes out in one gather write; the first numPacketsSending are in flight
+    deque<boost::shared_ptr<const vch>> packetsToSend;
+    size_t numPacketsSending;
+    // the I/O thread's copy of the client's ConnectionOptionsPacket flags
+    unsigned char connectionOptionFlags;
 
     vch receivedBytes;
     boost::asio::streambuf receivedSig;
 
     string sentChallenge;
+    string connectionAuthdUserAddress;
+    // logged in with "spectate": gets the game like anyone else, but nothing it sends affects it
+    bool spectating;
+    optional<uint64_t> maybeResumeFromFrame;
+    ResyncRequestPacket resumeResyncRequest;
+
+    void dequeuedPackets(size_t numPackets, size_t numBytes)
+    {
+        numQueuedPackets -= numPackets;
+        numQueuedBytes -= numBytes;
+    }
 
     string genRandomString(int len)
     {
@@ -112,19 +284,51 @@ class ClientChannel
         return s;
     }
 
+    void postMessage(ChannelMessage::Kind kind)
+    {
+        channelMessages.push(ChannelMessage(kind, shared_from_this()));
+    }
+
 public:
+    // everything queued from the sim thread and not yet written, whether still in outbox or in packetsToSend
+    atomic<size_t> numQueuedPackets;
+    atomic<size_t> numQueuedBytes;
+
+    // the sim thread's own
     enum State {
         DoingHandshake,
         ReadyForFirstSync,
+        AwaitingResync,
         UpToDate,
+        WaitingForSendQueueToDrain,
         Closed
     } state;
-    string connectionAuthdUserAddress;
-    ClientChannel(boost::asio::io_service &ioService_, boost::shared_ptr<tcp::socket> socket_)
-        : ioService(ioService_), socket(socket_), receivedSig(150)
+    string simAuthdUserAddress;
+    optional<ResyncRequestPacket> maybeResyncRequest;
+    // set for a client that resumed a session, to the first frame it hasn't heard about
+    optional<uint64_t> maybeCatchUpFromFrame;
+    bool compressionEnabled;
+    bool implicitFramesEnabled;
+    // the first of the empty frames held back from an implicit-frames client that it hasn't heard about yet
+    optional<uint64_t> maybeOldestElidedFrame;
+    optional<double> maybeSmoothedRttFrames;
+    vector<boost::shared_ptr<const vch>> framePacketsHeldForResync;
+    unsigned int framesOverSendQueueLimit;
+    size_t peakQueuedPackets;
+    size_t peakQueuedBytes;
+
+    ClientChannel(boost::asio::io_service &ioService_, boost::shared_ptr<tcp::socket> socket_, SigVerifier *sigVerifier, SessionTokens *sessionTokens)
+        : ioService(ioService_), strand(ioService_), sigVerifier(sigVerifier), sessionTokens(sessionTokens), socket(socket_), flushScheduled(false), receivedSig(256), numQueuedPackets(0), numQueuedBytes(0)
     {
         state = DoingHandshake;
-        sending = false;
+        numPacketsSending = 0;
+        connectionOptionFlags = 0;
+        spectating = false;
+        compressionEnabled = false;
+        implicitFramesEnabled = false;
+        framesOverSendQueueLimit = 0;
+        peakQueuedPackets = 0;
+        peakQueuedBytes = 0;
     }
 
     void startHandshakeAsync()
@@ -149,10 +353,10 @@ public:
         boost::asio::async_read_until(*socket,
                    receivedSig,
                    '\n',
-                   boost::bind(&ClientChannel::sigReceived,
-                               this,
-                               boost::asio::placeholders::error,
-                               boost::asio::placeholders::bytes_transferred));
+                   strand.wrap(boost::bind(&ClientChannel::sigReceived,
+                                           shared_from_this(),
+                                           boost::asio::placeholders::error,
+                                           boost::asio::placeholders::bytes_transferred)));
     }
 
     void sigReceived(const boost::system::error_code &error, size_t transferred)
@@ -161,7 +365,7 @@ public:
         if (error)
         {
             cout << "Error receiving sig from " << connectionAuthdUserAddress << ". Kicking." << endl;
-            state = Closed;
+            postMessage(ChannelMessage::Disconnected);
         }
         else
         {
@@ -171,53 +375,329 @@ public:
 
             if (sig == string("admin"))
             {
-                if (!adminRoleTaken)
+                if (!adminRoleTaken.exchange(true))
                 {
-                    adminRoleTaken = true;
                     connectionAuthdUserAddress = string("0xBB5eb03535FA2bCFe9FE3BBb0F9cC48385818d92");
                 }
+                finishHandshake(false);
+            }
+            else if (sig == string("spectate"))
+            {
+                spectating = true;
+                connectionAuthdUserAddress = string(SPECTATOR_ADDRESS);
+                finishHandshake(false);
+            }
+            else if (boost::starts_with(sig, "resume "))
+            {
+                resumeReceived(sig.substr(7));
             }
             else
             {
-                // now have sig and sentChallenge as strings.
-                string error;
-                if (auto maybeRecoveredAddress = signedMsgToAddress(sentChallenge, sig, &error))
+                // the answer comes back on the verifier's thread; hop back onto the strand to act on it
+                boost::shared_ptr<ClientChannel> self = shared_from_this();
+                sigVerifier->verifyAsync(sentChallenge, sig, [self](optional<string> maybeRecoveredAddress, string error)
                 {
-                    connectionAuthdUserAddress = *maybeRecoveredAddress;
-                }
-                else
-                {
-                    cout << "Error recovering address from connection. Kicking." << endl << "Here's the Python error message:" << endl;
-                    cout << error << endl;
-                    state = Closed;
-                    return;
-                }
+                    self->strand.post(boost::bind(&ClientChannel::sigVerified, self, maybeRecoveredAddress, error));
+                });
             }
+        }
+    }
 
-            cout << "Player authenticated and connected." << endl;
+    void sigVerified(optional<string> maybeRecoveredAddress, string error)
+    {
+        if (maybeRecoveredAddress)
+        {
+            connectionAuthdUserAddress = *maybeRecoveredAddress;
+            finishHandshake(true);
+        }
+        else
+        {
+            cout << "Error recovering address from connection. Kicking: " << error << endl;
+            postMessage(ChannelMessage::Disconnected);
+        }
+    }
 
-            // should really return a fail/success code here. On fail client just hangs atm.
-            boost::asio::write(*socket, boost::asio::buffer(connectionAuthdUserAddress));
+    // "<token> <first frame not heard about> [<baseline frame> <baseline hash>]", in place of a signature
+    void resumeReceived(string resumeLine)
+    {
+        istringstream stream(resumeLine);
+        string token;
+        uint64_t nextFrameExpected;
+        stream >> token >> nextFrameExpected;
+
+        optional<string> maybeAddress;
+        if (stream)
+            maybeAddress = sessionTokens->tokenToAddress(token);
+        if (!maybeAddress)
+        {
+            cout << "Couldn't resume session with a malformed, forged or expired token. Kicking." << endl;
+            postMessage(ChannelMessage::Disconnected);
+            return;
+        }
+
+        // with a baseline, a client that can't be caught up from recent frames can still get a delta resync
+        uint64_t baselineFrame, baselineHash;
+        if (stream >> baselineFrame >> baselineHash)
+            resumeResyncRequest = ResyncRequestPacket(baselineFrame, baselineHash);
 
-            state = ReadyForFirstSync;
-            startReceivingLoop();
+        cout << "Resuming session for " << *maybeAddress << " from frame " << nextFrameExpected << endl;
+        connectionAuthdUserAddress = *maybeAddress;
+        maybeResumeFromFrame = nextFrameExpected;
+        finishHandshake(true);
+    }
+
+    void finishHandshake(bool issueSessionToken)
+    {
+        cout << "Player authenticated and connected." << endl;
+
+        // should really return a fail/success code here. On fail client just hangs atm.
+        boost::asio::write(*socket, boost::asio::buffer(connectionAuthdUserAddress));
+
+        // the sim thread reads simAuthdUserAddress only after it gets this message
+        simAuthdUserAddress = connectionAuthdUserAddress;
+        ChannelMessage message(ChannelMessage::Authenticated, shared_from_this());
+        if (issueSessionToken)
+            message.sessionToken = sessionTokens->issue(connectionAuthdUserAddress);
+        message.maybeResumeFromFrame = maybeResumeFromFrame;
+        message.resyncRequest = resumeResyncRequest;
+        channelMessages.push(message);
+        startReceivingLoop();
+    }
+
+    // Called from the sim thread, before any resync, for a client that resumed a session.
+    // If every frame it hasn't heard about is still in recentFramePackets, those are all it needs,
+    // since its game and cmd schedule are as they were when it dropped; that leaves it UpToDate.
+    // Otherwise it's left to the resync it would have got anyway.
+    void maybeCatchUp(RecentFramePackets *recentFramePackets)
+    {
+        if (!maybeCatchUpFromFrame)
+            return;
+        uint64_t fromFrame = *maybeCatchUpFromFrame;
+        maybeCatchUpFromFrame = {};
+
+        // in Pregame the frame doesn't advance, so there's nothing to go by
+        if (game.state != Game::Active || recentFramePackets->size() == 0
+         || fromFrame < recentFramePackets->front().first || fromFrame > game.frame)
+            return;
+
+        // this frame's packet goes out after these, as usual
+        for (unsigned int i = 0; i < recentFramePackets->size(); i++)
+        {
+            uint64_t frame = (*recentFramePackets)[i].first;
+            if (frame >= fromFrame && frame < game.frame)
+                queuePacketFromSimThread((*recentFramePackets)[i].second->getForChannel(compressionEnabled));
         }
+        maybeResyncRequest = {};
+        state = UpToDate;
+    }
+
+    // called from the sim thread
+    void sendSessionToken(string token)
+    {
+        boost::shared_ptr<vch> packet(new vch);
+        vch body;
+        packStringToVch(&body, token);
+        packToVch(packet.get(), "C", PACKET_SESSIONTOKEN_CHAR);
+        packToVch(packet.get(), "Q", (uint64_t)body.size());
+        packet->insert(packet->end(), body.begin(), body.end());
+        queuePacketFromSimThread(packet);
     }
 
-    void sendResyncPacket()
+    // Called from the sim thread, after this frame's packet has been added to recentFramePackets.
+    // During a match the resync is built on resyncWorkService from the latest snapshot,
+    // and this frame's packet and those until it's done are held back to follow it (see finishResync).
+    // Otherwise it packs the game right away and leaves the channel UpToDate.
+    // Either way the resync is followed by enough earlier frames for the client to pick up cmds already scheduled past it.
+    void startResync(RecentFramePackets *recentFramePackets)
     {
-        packetsToSend.push_back(new vch);
+        // if the client still holds a snapshot we also have, we only need to send what's changed since
+        boost::shared_ptr<GameSnapshot> baseline;
+        if (maybeResyncRequest && maybeResyncRequest->hasBaseline)
+        {
+            baseline = snapshotHistory.getSnapshotOrNull(maybeResyncRequest->baselineFrame, maybeResyncRequest->baselineHash);
+        }
+        maybeResyncRequest = {};
+        // the resync and the frames sent after it cover anything held back
+        maybeOldestElidedFrame = {};
 
-        clearVchAndPackResyncPacket(packetsToSend.back());
+        boost::shared_ptr<GameSnapshot> latest = snapshotHistory.getLatestOrNull();
+        bool haveFramesSinceLatest = latest && recentFramePackets->size() > 0 && recentFramePackets->front().first <= firstFrameAnnouncingCmdsFor(latest->frame);
 
-        sendNextPacketIfNotBusy();
+        // in Pregame the snapshots don't keep up (the frame doesn't advance), but there's also hardly anything to pack
+        if (game.state == Game::Pregame || !haveFramesSinceLatest)
+        {
+            GameSnapshot current(&game);
+            boost::shared_ptr<vch> packet(new vch);
+            clearVchAndPackResyncPacket(packet.get(), baseline.get(), &current, compressionEnabled);
+
+            queuePacketFromSimThread(packet);
+            // this frame's packet goes out after this, as usual
+            for (unsigned int i = 0; i < recentFramePackets->size(); i++)
+            {
+                uint64_t frame = (*recentFramePackets)[i].first;
+                if (frame >= firstFrameAnnouncingCmdsFor(game.frame) && frame < game.frame)
+                    queuePacketFromSimThread((*recentFramePackets)[i].second->getForChannel(compressionEnabled));
+            }
+            state = UpToDate;
+            return;
+        }
+
+        for (unsigned int i = 0; i < recentFramePackets->size(); i++)
+        {
+            if ((*recentFramePackets)[i].first >= firstFrameAnnouncingCmdsFor(latest->frame))
+                framePacketsHeldForResync.push_back((*recentFramePackets)[i].second->getForChannel(compressionEnabled));
+        }
+        state = AwaitingResync;
+
+        boost::shared_ptr<ClientChannel> self = shared_from_this();
+        bool compress = compressionEnabled;
+        resyncWorkService.post([self, baseline, latest, compress]
+        {
+            boost::shared_ptr<vch> packet(new vch);
+            clearVchAndPackResyncPacket(packet.get(), baseline.get(), latest.get(), compress);
+
+            ChannelMessage message(ChannelMessage::ResyncPacked, self);
+            message.resyncPacket = packet;
+            channelMessages.push(message);
+        });
+    }
+
+    // called from the sim thread
+    void holdFramePacketForResync(SharedFramePacket *framePacket)
+    {
+        framePacketsHeldForResync.push_back(framePacket->getForChannel(compressionEnabled));
+    }
+
+    // called from the sim thread, with the packet startResync had built
+    void finishResync(boost::shared_ptr<const vch> resyncPacket)
+    {
+        if (state != AwaitingResync)
+            return;
+
+        queuePacketFromSimThread(resyncPacket);
+        for (unsigned int i = 0; i < framePacketsHeldForResync.size(); i++)
+        {
+            queuePacketFromSimThread(framePacketsHeldForResync[i]);
+        }
+        framePacketsHeldForResync.clear();
+
+        state = UpToDate;
+    }
+
+    // called from the sim thread
+    void sendFrameCmdsPacket(SharedFramePacket *framePacket)
+    {
+        if (implicitFramesEnabled && framePacket->canBeElided)
+        {
+            if (!maybeOldestElidedFrame)
+                maybeOldestElidedFrame = framePacket->frame;
+
+            if (framePacket->frame + 1 - *maybeOldestElidedFrame >= IMPLICIT_FRAMES_MAX_DELAY)
+            {
+                queuePacketFromSimThread(framePacket->getTick());
+                maybeOldestElidedFrame = {};
+            }
+            return;
+        }
+
+        // the client infers any frames held back from this one's frame number
+        queuePacketFromSimThread(framePacket->getForChannel(compressionEnabled));
+        maybeOldestElidedFrame = {};
+    }
+
+    // Called from the sim thread each frame, before packets go out.
+    // Applies SLOW_CLIENT_POLICY if the client has let too much pile up.
+    void checkSendQueueFromSimThread()
+    {
+        size_t queuedPackets = numQueuedPackets;
+        size_t queuedBytes = numQueuedBytes;
+        peakQueuedPackets = max(peakQueuedPackets, queuedPackets);
+        peakQueuedBytes = max(peakQueuedBytes, queuedBytes);
+
+        // what's left once the drop went through is already being written; nothing more goes out until that's done
+        if (state == WaitingForSendQueueToDrain)
+        {
+            if (queuedPackets == 0)
+            {
+                // the client may no longer have whatever baseline it last told us about
+                maybeResyncRequest = ResyncRequestPacket();
+                state = UpToDate;
+            }
+            return;
+        }
+
+        if (queuedPackets <= SEND_QUEUE_MAX_PACKETS && queuedBytes <= SEND_QUEUE_MAX_BYTES)
+        {
+            framesOverSendQueueLimit = 0;
+            return;
+        }
+        framesOverSendQueueLimit++;
+
+        if (SLOW_CLIENT_POLICY == DisconnectSlowClient)
+        {
+            if (framesOverSendQueueLimit >= SLOW_CLIENT_GRACE_FRAMES)
+            {
+                cout << "Kicking " << simAuthdUserAddress << ", who's been over the send queue limit for " << framesOverSendQueueLimit << " frames "
+                     << "(" << queuedPackets << " packets, " << queuedBytes << " bytes)." << endl;
+                kickFromSimThread();
+            }
+        }
+        // a channel awaiting a resync will be followed by a fresh one anyway
+        else if (state == UpToDate)
+        {
+            cout << "Dropping " << queuedPackets << " queued packets (" << queuedBytes << " bytes) for " << simAuthdUserAddress << " and resyncing." << endl;
+            queuePacketFromSimThread(boost::shared_ptr<const vch>());
+            state = WaitingForSendQueueToDrain;
+        }
+    }
+
+    void kickFromSimThread()
+    {
+        state = Closed;
+        boost::shared_ptr<ClientChannel> self = shared_from_this();
+        strand.post([self]
+        {
+            boost::system::error_code ignored;
+            self->socket->close(ignored);
+        });
+    }
+
+    void queuePacketFromSimThread(boost::shared_ptr<const vch> packet)
+    {
+        if (packet)
+        {
+            numQueuedPackets++;
+            numQueuedBytes += packet->size();
+        }
+        outbox.push(packet);
+
+        // one flush on the I/O thread picks up everything pushed before it runs
+        if (!flushScheduled.exchange(true))
+            strand.post(boost::bind(&ClientChannel::flushOutbox, shared_from_this()));
     }
 
-    void sendFrameCmdsPacket(FrameEventsPacket fcp)
+    void flushOutbox()
     {
-        packetsToSend.push_back(new vch);
+        flushScheduled = false;
 
-        clearVchAndPackFrameCmdsPacket(packetsToSend.back(), fcp);
+        vector<boost::shared_ptr<const vch>> packets = outbox.drain();
+        for (unsigned int i = 0; i < packets.size(); i++)
+        {
+            if (packets[i])
+            {
+                packetsToSend.push_back(packets[i]);
+                continue;
+            }
+
+            // the ones being written have to go out whole, or the stream would be left mid-packet
+            size_t numBytesDropped = 0;
+            for (unsigned int j = numPacketsSending; j < packetsToSend.size(); j++)
+            {
+                numBytesDropped += packetsToSend[j]->size();
+            }
+            dequeuedPackets(packetsToSend.size() - numPacketsSending, numBytesDropped);
+            packetsToSend.erase(packetsToSend.begin() + numPacketsSending, packetsToSend.end());
+        }
 
         sendNextPacketIfNotBusy();
     }
@@ -227,36 +707,113 @@ public:
         clearVchAndReceiveNextCmd();
     }
 
+    bool isPlainFramePacket(const vch &packet)
+    {
+        return packet[0] == PACKET_FRAMECMDS_CHAR;
+    }
+    uint64_t framePacketFrame(const vch &packet)
+    {
+        vch frameBytes(packet.begin() + PACKET_HEADER_SIZE, packet.begin() + PACKET_HEADER_SIZE + 8);
+        uint64_t frame;
+        unpackFromIter(frameBytes.begin(), "Q", &frame);
+        return frame;
+    }
+
+    // Replaces each run of queued frame packets for consecutive frames with a single frame bundle.
+    // Only called when nothing's being written, so all of packetsToSend is fair game.
+    void bundleQueuedFramePackets()
+    {
+        deque<boost::shared_ptr<const vch>> bundled;
+        size_t i = 0;
+        while (i < packetsToSend.size())
+        {
+            size_t runEnd = i + 1;
+            if (isPlainFramePacket(*packetsToSend[i]))
+            {
+                while (runEnd < packetsToSend.size()
+                    && runEnd - i < UINT16_MAX
+                    && isPlainFramePacket(*packetsToSend[runEnd])
+                    && framePacketFrame(*packetsToSend[runEnd]) == framePacketFrame(*packetsToSend[runEnd - 1]) + 1)
+                {
+                    runEnd++;
+                }
+            }
+
+            if (runEnd - i < 2)
+            {
+                bundled.push_back(packetsToSend[i]);
+                i = runEnd;
+                continue;
+            }
+
+            vector<boost::shared_ptr<const vch>> run(packetsToSend.begin() + i, packetsToSend.begin() + runEnd);
+            size_t runBytes = 0;
+            for (unsigned int j = 0; j < run.size(); j++)
+            {
+                runBytes += run[j]->size();
+            }
+
+            boost::shared_ptr<vch> bundle(new vch);
+            packFrameBundle(bundle.get(), run);
+
+            vch prepended;
+            packToVch(&prepended, "C", PACKET_FRAMEBUNDLE_CHAR);
+            packToVch(&prepended, "Q", (uint64_t)bundle->size());
+            bundle->insert(bundle->begin(), prepended.begin(), prepended.end());
+
+            if ((connectionOptionFlags & CONNECTION_OPTION_COMPRESSION) && bundle->size() >= COMPRESSION_MIN_FRAME_PACKET_SIZE)
+                compressPacketIfSmaller(bundle.get());
+
+            // the bundle takes the place of the whole run in the queue's accounting
+            dequeuedPackets(run.size() - 1, runBytes - bundle->size());
+
+            bundled.push_back(bundle);
+            i = runEnd;
+        }
+        packetsToSend.swap(bundled);
+    }
+
     void sendNextPacketIfNotBusy()
     {
-        if (!sending && packetsToSend.size() > 0)
+        if (numPacketsSending == 0 && packetsToSend.size() > 0)
         {
-            sending = true;
+            if (connectionOptionFlags & CONNECTION_OPTION_FRAME_BUNDLES)
+                bundleQueuedFramePackets();
+
+            vector<boost::asio::const_buffer> buffers;
+            for (unsigned int i = 0; i < packetsToSend.size(); i++)
+            {
+                buffers.push_back(boost::asio::buffer(*(packetsToSend[i])));
+            }
+            numPacketsSending = packetsToSend.size();
+
             boost::asio::async_write(*socket,
-                                     boost::asio::buffer(*(packetsToSend[0])),
-                                     boost::bind(&ClientChannel::wrapUpSendingPacket,
-                                                 this,
-                                                 packetsToSend[0],
-                                                 boost::asio::placeholders::error,
-                                                 boost::asio::placeholders::bytes_transferred));
+                                     buffers,
+                                     strand.wrap(boost::bind(&ClientChannel::wrapUpSendingPackets,
+                                                             shared_from_this(),
+                                                             boost::asio::placeholders::error,
+                                                             boost::asio::placeholders::bytes_transferred)));
         }
     }
 
-    void wrapUpSendingPacket(vch *sourceToDispose, const boost::system::error_code &error, size_t bytes_transferred)
+    void wrapUpSendingPackets(const boost::system::error_code &error, size_t bytes_transferred)
     {
         if (error)
         {
             cout << "Error sending packet to " << connectionAuthdUserAddress << ". Kicking." << endl;
-            state = Closed;
+            postMessage(ChannelMessage::Disconnected);
         }
         else
         {
-            assert(packetsToSend[0] == sourceToDispose);
-
-            delete packetsToSend[0];
-            packetsToSend.erase(packetsToSend.begin());
+            size_t numBytesSent = 0;
+            for (unsigned int i = 0; i < numPacketsSending; i++)
+            {
+                numBytesSent += packetsToSend[i]->size();
+            }
+            dequeuedPackets(numPacketsSending, numBytesSent);
 
-            sending = false;
+            packetsToSend.erase(packetsToSend.begin(), packetsToSend.begin() + numPacketsSending);
+            numPacketsSending = 0;
 
             sendNextPacketIfNotBusy();
         }
@@ -268,17 +825,17 @@ public:
 
         async_read(*socket,
                    boost::asio::buffer(receivedBytes),
-                   boost::bind(&ClientChannel::sizeReceived,
-                               this,
-                               boost::asio::placeholders::error,
-                               boost::asio::placeholders::bytes_transferred));
+                   strand.wrap(boost::bind(&ClientChannel::sizeReceived,
+                                           shared_from_this(),
+                                           boost::asio::placeholders::error,
+                                           boost::asio::placeholders::bytes_transferred)));
     }
     void sizeReceived(const boost::system::error_code &error, size_t transferred)
     {
         if (error)
         {
             cout << "Error receiving cmd size from " << connectionAuthdUserAddress << ". Kicking." << endl;
-            state = Closed;
+            postMessage(ChannelMessage::Disconnected);
         }
         else
         {
@@ -296,82 +853,154 @@ public:
 
         async_read(*socket,
                    boost::asio::buffer(receivedBytes),
-                   boost::bind(&ClientChannel::cmdBodyReceived,
-                               this,
-                               boost::asio::placeholders::error,
-                               boost::asio::placeholders::bytes_transferred));
+                   strand.wrap(boost::bind(&ClientChannel::cmdBodyReceived,
+                                           shared_from_this(),
+                                           boost::asio::placeholders::error,
+                                           boost::asio::placeholders::bytes_transferred)));
     }
     void cmdBodyReceived(const boost::system::error_code &error, size_t transferred)
     {
         if (error)
         {
             cout << "Error receiving cmd body from " << connectionAuthdUserAddress << ". Kicking." << endl;
-            state = Closed;
+            postMessage(ChannelMessage::Disconnected);
         }
         else
         {
             vchIter place = receivedBytes.begin();
 
-            boost::shared_ptr<Cmd> cmd = unpackFullCmdAndMoveIter(&place);
-            boost::shared_ptr<AuthdCmd> authdCmd = boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, this->connectionAuthdUserAddress));
+            unsigned char packetTypechar;
+            place = unpackTypecharFromIter(place, &packetTypechar);
 
-            pendingCmds.push_back(authdCmd);
+            ChannelMessage message(ChannelMessage::Disconnected, shared_from_this());
+            switch (packetTypechar)
+            {
+            case CLIENT_PACKET_CMD_CHAR:
+                // the sim thread will work out which player this is
+                message.kind = ChannelMessage::ReceivedCmd;
+                try
+                {
+                    message.cmd = unpackFullCmdAndMoveIter(&place);
+                }
+                catch (runtime_error &e)
+                {
+                    cout << "Unrecognized cmd from " << connectionAuthdUserAddress << ". Kicking." << endl;
+                    postMessage(ChannelMessage::Disconnected);
+                    return;
+                }
+                break;
+
+            case CLIENT_PACKET_RESYNCREQUEST_CHAR:
+                // will get served next time the main loop sends out packets
+                message.kind = ChannelMessage::ReceivedResyncRequest;
+                message.resyncRequest = ResyncRequestPacket(&place);
+                break;
+
+            case CLIENT_PACKET_PONG_CHAR:
+                message.kind = ChannelMessage::ReceivedPong;
+                message.pingFrame = PongPacket(&place).pingFrame;
+                break;
+
+            case CLIENT_PACKET_CONNECTIONOPTIONS_CHAR:
+                message.kind = ChannelMessage::ReceivedConnectionOptions;
+                message.connectionOptions = ConnectionOptionsPacket(&place);
+                connectionOptionFlags = message.connectionOptions.flags;
+                break;
+
+            default:
+                cout << "Unrecognized packet from " << connectionAuthdUserAddress << ". Kicking." << endl;
+                postMessage(ChannelMessage::Disconnected);
+                return;
+            }
+            // unpacking doesn't watch for the end as it goes, so a packet too short for what it says it holds is caught here
+            if (place > receivedBytes.end())
+            {
+                cout << "Truncated packet from " << connectionAuthdUserAddress << ". Kicking." << endl;
+                postMessage(ChannelMessage::Disconnected);
+                return;
+            }
+            // a spectator's round trip shouldn't hold up everyone else's cmds either
+            if (!(spectating && (message.kind == ChannelMessage::ReceivedCmd || message.kind == ChannelMessage::ReceivedPong)))
+                channelMessages.push(message);
 
             clearVchAndReceiveNextCmd();
         }
     }
 };
 
-void Listener::handleAccept(boost::shared_ptr<tcp::socket> socket, const boost::system::error_code &error)
+// Enough frames for a cmd announced now to reach the client with the slowest round trip (half of it) before it's executed.
+uint64_t cmdDelayForClientRtts()
 {
-    if (error)
+    double maxRttFrames = 0;
+    for (unsigned int i = 0; i < clientChannels.size(); i++)
     {
-        throw("Listener error accepting:" + error.value());
+        if (clientChannels[i]->maybeSmoothedRttFrames)
+            maxRttFrames = max(maxRttFrames, *clientChannels[i]->maybeSmoothedRttFrames);
     }
-    else
-    {
-        cout << "client connected!" << endl;
-        ClientChannel *clientChannel = new ClientChannel(ioService, socket);
-        clientChannel->startHandshakeAsync();
-        
-        clientChannels.push_back(clientChannel);
 
-    }
-    startAccept();
+    uint64_t delay = (uint64_t)ceil(maxRttFrames / 2);
+    return min(max(delay, CMD_DELAY_MIN_FRAMES), CMD_DELAY_MAX_FRAMES);
 }
 
-struct WithdrawEvent
+// Prints the deepest send queue seen since the last report, and everyone who's fallen more than SEND_QUEUE_LAGGING_PACKETS behind.
+void reportSendQueuesAndResetPeaks()
 {
-    string userAddress;
-    coinsInt amountInCoins;
-    WithdrawEvent(string userAddress, coinsInt amountInCoins)
-        : userAddress(userAddress), amountInCoins(amountInCoins) {}
-    boost::shared_ptr<Event> toEventSharedPtr()
+    boost::shared_ptr<ClientChannel> deepestOrNull;
+    vector<boost::shared_ptr<ClientChannel>> lagging;
+    for (unsigned int i = 0; i < clientChannels.size(); i++)
     {
-        return boost::shared_ptr<Event>(new BalanceUpdateEvent(userAddress, amountInCoins, false));
+        if (!deepestOrNull || clientChannels[i]->peakQueuedBytes > deepestOrNull->peakQueuedBytes)
+            deepestOrNull = clientChannels[i];
+        if (clientChannels[i]->peakQueuedPackets > SEND_QUEUE_LAGGING_PACKETS)
+            lagging.push_back(clientChannels[i]);
     }
-};
 
-void actuateWithdrawal(string userAddress, coinsInt amount)
-{
-    string weiString = coinsIntToWeiDepositString(amount);
-    string writeData = userAddress + " " + weiString;
+    if (deepestOrNull)
+    {
+        cout << "Send queues over the last " << SEND_QUEUE_REPORT_INTERVAL << " frames: " << clientChannels.size() << " clients, deepest peaked at "
+             << deepestOrNull->peakQueuedPackets << " packets / " << deepestOrNull->peakQueuedBytes << " bytes (" << deepestOrNull->simAuthdUserAddress << ")" << endl;
+    }
+    for (unsigned int i = 0; i < lagging.size(); i++)
+    {
+        cout << "  lagging: " << lagging[i]->simAuthdUserAddress << " peaked at " << lagging[i]->peakQueuedPackets << " packets / " << lagging[i]->peakQueuedBytes << " bytes, "
+             << "now " << lagging[i]->numQueuedPackets << " / " << lagging[i]->numQueuedBytes << endl;
+    }
 
-    string filename = to_string(time(0)) + "-" + to_string(clock());
-    ofstream withdrawDescriptorFile(filename);
-    withdrawDescriptorFile << writeData;
-    withdrawDescriptorFile.close();
+    for (unsigned int i = 0; i < clientChannels.size(); i++)
+    {
+        clientChannels[i]->peakQueuedPackets = 0;
+        clientChannels[i]->peakQueuedBytes = 0;
+    }
+}
 
-    filesystem::rename(filename, "./accounting/pending_withdrawals/" + filename);
+void Listener::handleAccept(boost::shared_ptr<tcp::socket> socket, const boost::system::error_code &error)
+{
+    if (error)
+    {
+        throw("Listener error accepting:" + error.value());
+    }
+    else
+    {
+        cout << "client connected!" << endl;
+        // keeps itself alive through its pending handlers, and through clientChannels once it's authenticated
+        boost::shared_ptr<ClientChannel> clientChannel(new ClientChannel(ioService, socket, sigVerifier, sessionTokens));
+        clientChannel->startHandshakeAsync();
+    }
+    startAccept();
 }
 
-vector<boost::shared_ptr<Event>> pollPendingDepositsAndHoneypotEvents()
+// Each deposit file taken up is moved to CONSUMED_DEPOSITS_DIR, and its name added to consumedDepositFilesDest;
+// it's only removed once the write-ahead log has the frame with its events.
+vector<boost::shared_ptr<Event>> pollPendingDepositsAndHoneypotEvents(vector<string> *consumedDepositFilesDest)
 {
     vector<boost::shared_ptr<Event>> events;
 
     boost::filesystem::path accountingDirPath("./accounting/pending_deposits/");
     boost::filesystem::directory_iterator directoryEndIter; // default constructor makes it an end_iter
 
+    // addresses that will join via this batch of events, in the order they'll be added to game.players
+    vector<string> joiningAddresses;
+
     for (boost::filesystem::directory_iterator dirIter(accountingDirPath); dirIter != directoryEndIter; dirIter++)
     {
         if (boost::filesystem::is_regular_file(dirIter->path())) {
@@ -379,6 +1008,7 @@ vector<boost::shared_ptr<Event>> pollPendingDepositsAndHoneypotEvents()
             std::ifstream depositFile(depositFilePath);
             string depositData;
 
+            vector<pair<string, coinsInt>> deposits;
             if (depositFile.is_open())
             {
                 while (depositFile)
@@ -394,14 +1024,7 @@ vector<boost::shared_ptr<Event>> pollPendingDepositsAndHoneypotEvents()
                     string depositWeiString = splitted[1];
                     coinsInt depositInCoins = weiDepositStringToCoinsInt(depositWeiString);
 
-                    if (userAddressOrHoneypotString == "honeypot")
-                    {
-                        events.push_back(boost::shared_ptr<Event>(new HoneypotAddedEvent(depositInCoins)));
-                    }
-                    else
-                    {
-                        events.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent(userAddressOrHoneypotString, depositInCoins, true)));
-                    }
+                    deposits.push_back({userAddressOrHoneypotString, depositInCoins});
                 }
             }
             else
@@ -409,69 +1032,377 @@ vector<boost::shared_ptr<Event>> pollPendingDepositsAndHoneypotEvents()
                 throw runtime_error("Couldn't open a deposit file...\n");
             }
             depositFile.close();
-            // delete the file, having processed it
-            boost::filesystem::remove(dirIter->path());
+
+            // count how many new players this file would add before committing to any of it
+            vector<string> newAddressesInFile;
+            for (uint i=0; i<deposits.size(); i++)
+            {
+                string address = deposits[i].first;
+                if (address != "honeypot"
+                 && game.playerAddressToIdOrNegativeOne(address) == -1
+                 && find(joiningAddresses.begin(), joiningAddresses.end(), address) == joiningAddresses.end()
+                 && find(newAddressesInFile.begin(), newAddressesInFile.end(), address) == newAddressesInFile.end())
+                {
+                    newAddressesInFile.push_back(address);
+                }
+            }
+            if (game.players.size() + joiningAddresses.size() + newAddressesInFile.size() > MAX_PLAYERS)
+            {
+                cout << "Can't fit the players in " << depositFilePath << " under MAX_PLAYERS. Leaving it for later." << endl;
+                continue;
+            }
+
+            for (uint i=0; i<deposits.size(); i++)
+            {
+                string address = deposits[i].first;
+                coinsInt depositInCoins = deposits[i].second;
+
+                if (address == "honeypot")
+                {
+                    events.push_back(boost::shared_ptr<Event>(new HoneypotAddedEvent(depositInCoins)));
+                    continue;
+                }
+
+                int playerId = game.playerAddressToIdOrNegativeOne(address);
+                if (playerId == -1)
+                {
+                    auto joiningIter = find(joiningAddresses.begin(), joiningAddresses.end(), address);
+                    if (joiningIter == joiningAddresses.end())
+                    {
+                        events.push_back(boost::shared_ptr<Event>(new PlayerJoinedEvent(address)));
+                        joiningIter = joiningAddresses.insert(joiningAddresses.end(), address);
+                    }
+                    playerId = game.players.size() + (joiningIter - joiningAddresses.begin());
+                }
+
+                events.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent(playerId, depositInCoins, true)));
+            }
+            // set the file aside, having processed it
+            string depositFileName = dirIter->path().filename().string();
+            boost::filesystem::rename(dirIter->path(), CONSUMED_DEPOSITS_DIR + depositFileName);
+            consumedDepositFilesDest->push_back(depositFileName);
         }
     }
 
     return events;
 }
 
+// Drops any unit cmd that a later cmd from the same player, bound for the same frame, would completely overwrite
+// (see UnitCmd::supersedes), so it isn't sent to or run by every client for nothing.
+void dropSupersededCmds(vector<boost::shared_ptr<AuthdCmd>> *cmds)
+{
+    vector<boost::shared_ptr<AuthdCmd>> keptCmds;
+    for (unsigned int i = 0; i < cmds->size(); i++)
+    {
+        bool superseded = false;
+        if (auto earlierUnitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>((*cmds)[i]->cmd))
+        {
+            for (unsigned int j = i + 1; j < cmds->size() && !superseded; j++)
+            {
+                if ((*cmds)[j]->playerId != (*cmds)[i]->playerId)
+                    continue;
+                if (auto laterUnitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>((*cmds)[j]->cmd))
+                    superseded = laterUnitCmd->supersedes(earlierUnitCmd.get());
+            }
+        }
+        if (!superseded)
+            keptCmds.push_back((*cmds)[i]);
+    }
+    *cmds = keptCmds;
+}
+
 int main(int argc, char *argv[])
 {
     srand(time(0));
 
+    if (loadSnapshotFileIntoGame(SNAPSHOT_FILE_PATH, &game))
+    {
+        cout << "Resumed game at frame " << game.frame << " from " << SNAPSHOT_FILE_PATH << endl;
+    }
+    // then on through every frame committed since, which may have scheduled cmds still to come
+    CmdSchedule cmdSchedule;
+    vector<FrameEventsPacket> recoveredAnnouncingFrames;
+    // withdrawals asked for on the last frame run, to be paid out on the next
+    vector<WithdrawEvent> pendingWithdrawEvents;
+    recoverFromWriteAheadLog(&game, &cmdSchedule, &recoveredAnnouncingFrames, &pendingWithdrawEvents);
+
+    RecentFramePackets recentFramePackets;
+    vector<boost::shared_ptr<const vch>> recoveredAnnouncingPackets;
+    for (unsigned int i = 0; i < recoveredAnnouncingFrames.size(); i++)
+    {
+        boost::shared_ptr<SharedFramePacket> framePacket(new SharedFramePacket(&recoveredAnnouncingFrames[i]));
+        recentFramePackets.push_back({framePacket->frame, framePacket});
+        recoveredAnnouncingPackets.push_back(framePacket->plain);
+    }
+
+    SnapshotFileWriter snapshotFileWriter(SNAPSHOT_FILE_PATH);
+    unsigned int framesSinceSnapshotFile = 0;
+    // the game as recovered is this run's first checkpoint
+    WriteAheadLogWriter writeAheadLogWriter(&snapshotFileWriter);
+    boost::shared_ptr<GameSnapshot> startingSnapshot(new GameSnapshot(&game));
+    writeAheadLogWriter.startSegment(startingSnapshot, recoveredAnnouncingPackets);
+
+    // everything from here on goes in this run's replay log, starting with the game as recovered
+    // (after the frames that announced cmds still due, so the replay has those too)
+    ReplayLogWriter replayLogWriter(REPLAY_LOG_DIR + to_string(time(0)) + ".cfreplay");
+    for (unsigned int i = 0; i < recoveredAnnouncingPackets.size(); i++)
+        replayLogWriter.appendFramePacket(recoveredAnnouncingPackets[i]);
+    replayLogWriter.appendKeyframe(startingSnapshot);
+
     boost::asio::io_service io_service;
 
-    Listener listener(io_service);
+    // signatures are checked on the verifier's own thread, so a slow one doesn't stall the other clients
+    SigVerifier sigVerifier;
+    SessionTokens sessionTokens;
+
+    Listener listener(io_service, &sigVerifier, &sessionTokens);
     listener.startAccept();
 
+    // all networking happens on this thread; the loop below is left to run the game.
+    boost::asio::io_service::work ioWork(io_service);
+    thread ioThread([&io_service] { io_service.run(); });
+
+    // so that a client joining a big game doesn't hold up the frame while it's packed
+    boost::asio::io_service::work resyncWork(resyncWorkService);
+    thread resyncThread([] { resyncWorkService.run(); });
+
+    uint64_t cmdDelayFrames = CMD_DELAY_MIN_FRAMES;
+
     // server will scan this directory for pending deposits (supplied by py/balance_tracker.py)
     boost::filesystem::path accountingDirPath("./accounting/pending_deposits/");
     boost::filesystem::directory_iterator directoryEndIter; // default constructor makes it an end_iter
 
-    chrono::time_point<chrono::system_clock, chrono::duration<double>> nextFrameStart(chrono::system_clock::now());
+    FrameScheduler frameScheduler(FRAME_SPIN_TAIL, FRAME_JITTER_REPORT_INTERVAL);
+    unsigned int framesSinceSendQueueReport = 0;
 
-    vector<WithdrawEvent> pendingWithdrawEvents;
-    
     while (true)
     {
-        // poll io_service, which will populate pendingCmds with anything the ClientChannels have received
-        io_service.poll();
+        frameScheduler.waitUntilFrameDue(NULL);
+        frameScheduler.startFrame();
 
-        // rate limit iteration to a maximum of SEC_PER_FRAME
-        chrono::time_point<chrono::system_clock, chrono::duration<double>> now(chrono::system_clock::now());
-        if (now < nextFrameStart)
-            continue;
-        nextFrameStart += ONE_FRAME;
+        if (writeAheadLogWriter.hasFailed())
+            throw runtime_error("The write-ahead log has stopped committing frames.\n");
+
+        // pick up everything the ClientChannels have received since last frame
+        vector<boost::shared_ptr<AuthdCmd>> pendingCmds;
+        vector<ChannelMessage> messages = channelMessages.drain();
+        for (unsigned int i = 0; i < messages.size(); i++)
+        {
+            boost::shared_ptr<ClientChannel> channel = messages[i].channel;
+            switch (messages[i].kind)
+            {
+                case ChannelMessage::Authenticated:
+                    channel->state = ClientChannel::ReadyForFirstSync;
+                    if (messages[i].maybeResumeFromFrame)
+                    {
+                        channel->maybeCatchUpFromFrame = messages[i].maybeResumeFromFrame;
+                        if (messages[i].resyncRequest.hasBaseline)
+                            channel->maybeResyncRequest = messages[i].resyncRequest;
+                    }
+                    if (!messages[i].sessionToken.empty())
+                        channel->sendSessionToken(messages[i].sessionToken);
+                    clientChannels.push_back(channel);
+                    break;
+
+                case ChannelMessage::ReceivedCmd:
+                {
+                    int playerId = game.playerAddressToIdOrNegativeOne(channel->simAuthdUserAddress);
+                    if (playerId == -1)
+                    {
+                        cout << "Dropping cmd from " << channel->simAuthdUserAddress << ", who hasn't deposited yet." << endl;
+                        break;
+                    }
+
+                    // every cmd admitted goes out to and gets run by every client, so it's checked and limited here
+                    if (cmdRateLimiters.size() <= (unsigned int)playerId)
+                        cmdRateLimiters.resize(playerId + 1);
+                    CmdRateLimiter *rateLimiter = &cmdRateLimiters[playerId];
+                    if (!rateLimiter->tryTake())
+                    {
+                        if (rateLimiter->droppedSinceBackingOff == 0)
+                            cout << "Rate limiting cmds from " << channel->simAuthdUserAddress << "." << endl;
+                        rateLimiter->droppedSinceBackingOff++;
+                        break;
+                    }
+                    // only report once the player has backed off, rather than on every cmd squeezed through in between drops
+                    if (rateLimiter->droppedSinceBackingOff > 0 && rateLimiter->tokens >= CMD_RATE_LIMIT_BURST / 2)
+                    {
+                        cout << "Dropped " << rateLimiter->droppedSinceBackingOff << " cmds from " << channel->simAuthdUserAddress << " over the rate limit." << endl;
+                        rateLimiter->droppedSinceBackingOff = 0;
+                    }
+
+                    if (auto unitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>(messages[i].cmd))
+                    {
+                        if (!unitCmd->admitForPlayer(&game, playerId))
+                            break;
+                    }
+                    pendingCmds.push_back(boost::shared_ptr<AuthdCmd>(new AuthdCmd(messages[i].cmd, playerId)));
+                    break;
+                }
+
+                case ChannelMessage::ReceivedResyncRequest:
+                    channel->maybeResyncRequest = messages[i].resyncRequest;
+                    break;
+
+                case ChannelMessage::ReceivedPong:
+                {
+                    double rttFrames = game.frame - messages[i].pingFrame;
+                    if (channel->maybeSmoothedRttFrames)
+                        channel->maybeSmoothedRttFrames = *channel->maybeSmoothedRttFrames + (rttFrames - *channel->maybeSmoothedRttFrames) / 8;
+                    else
+                        channel->maybeSmoothedRttFrames = rttFrames;
+                    break;
+                }
+
+                case ChannelMessage::ReceivedConnectionOptions:
+                    channel->compressionEnabled = messages[i].connectionOptions.flags & CONNECTION_OPTION_COMPRESSION;
+                    channel->implicitFramesEnabled = messages[i].connectionOptions.flags & CONNECTION_OPTION_IMPLICIT_FRAMES;
+                    break;
+
+                case ChannelMessage::Disconnected:
+                    channel->state = ClientChannel::Closed;
+                    break;
+
+                case ChannelMessage::ResyncPacked:
+                    channel->finishResync(messages[i].resyncPacket);
+                    break;
+            }
+        }
 
         // let's count up events
         vector<boost::shared_ptr<Event>> pendingEvents;
 
         // did we see any withdrawals last loop?
-        // If so, actuate and queue for in-game processing
+        // If so, queue for in-game processing; they're paid out once the write-ahead log has this frame
+        vector<WithdrawalPayout> withdrawalPayouts;
         for (uint i=0; i<pendingWithdrawEvents.size(); i++)
         {
             // just make sure again the math works out
-            if (pendingWithdrawEvents[i].amountInCoins > game.players[game.playerAddressToIdOrNegativeOne(pendingWithdrawEvents[i].userAddress)].credit.getInt())
+            if (pendingWithdrawEvents[i].amountInCoins > game.players[pendingWithdrawEvents[i].playerId].credit.getInt())
             {
                 cout << "Somehow an invalid withdrawal event was about to get processed..." << endl;
             }
             else
             {
-                actuateWithdrawal(pendingWithdrawEvents[i].userAddress, pendingWithdrawEvents[i].amountInCoins);
+                withdrawalPayouts.push_back({game.playerIdToAddress(pendingWithdrawEvents[i].playerId), pendingWithdrawEvents[i].amountInCoins});
                 pendingEvents.push_back(pendingWithdrawEvents[i].toEventSharedPtr());
             }
         }
         pendingWithdrawEvents.clear();
 
         // scan for any pending deposits or honeypotAdd events
-        vector<boost::shared_ptr<Event>> depositAndHoneypotEvents = pollPendingDepositsAndHoneypotEvents();
+        vector<string> consumedDepositFiles;
+        vector<boost::shared_ptr<Event>> depositAndHoneypotEvents = pollPendingDepositsAndHoneypotEvents(&consumedDepositFiles);
         pendingEvents.insert(pendingEvents.end(), depositAndHoneypotEvents.begin(), depositAndHoneypotEvents.end());
 
+        uint64_t newCmdDelayFrames = cmdDelayForClientRtts();
+        if (newCmdDelayFrames != cmdDelayFrames)
+        {
+            cout << "Scheduling cmds " << newCmdDelayFrames << " frames ahead (was " << cmdDelayFrames << ")." << endl;
+            cmdDelayFrames = newCmdDelayFrames;
+        }
+
+        // everything pending here gets run on the same frame, so a cmd made moot by a later one can go now
+        dropSupersededCmds(&pendingCmds);
+
+        // During a match, unit cmds get scheduled cmdDelayFrames ahead and announced now.
+        // Withdrawals are the server's business and cmds in Pregame (where the frame doesn't advance) go through right away.
+        vector<boost::shared_ptr<AuthdCmd>> immediateCmds;
+        vector<ScheduledCmd> scheduledCmds;
+        for (unsigned int i = 0; i < pendingCmds.size(); i++)
+        {
+            if (game.state == Game::Active && boost::dynamic_pointer_cast<UnitCmd, Cmd>(pendingCmds[i]->cmd))
+                scheduledCmds.push_back(ScheduledCmd(game.frame + cmdDelayFrames, pendingCmds[i]));
+            else
+                immediateCmds.push_back(pendingCmds[i]);
+        }
+
         // build FrameEventsPacket for this frame
         // includes all cmds we've received from clients since last time and all new events
-        FrameEventsPacket fcp(game.frame, pendingCmds, pendingEvents);
+        FrameEventsPacket fcp(game.frame, immediateCmds, pendingEvents);
+        fcp.scheduledCmds = scheduledCmds;
+        cmdSchedule.addFromPacket(&fcp);
+        // packed once here, however many clients it goes out to
+        boost::shared_ptr<SharedFramePacket> framePacket(new SharedFramePacket(&fcp));
+
+        // clients keep snapshots of the same frames, to use as baselines for delta resyncs
+        snapshotHistory.maybeRecord(&game);
+        boost::shared_ptr<GameSnapshot> latestSnapshot = snapshotHistory.getLatestOrNull();
+
+        if (game.state == Game::Pregame)
+        {
+            // resyncs aren't built from snapshots in Pregame
+            recentFramePackets.clear();
+        }
+        else
+        {
+            // the frames since the latest snapshot, along with those that could have announced cmds due after it
+            while (recentFramePackets.size() > 0 && latestSnapshot && recentFramePackets.front().first < firstFrameAnnouncingCmdsFor(latestSnapshot->frame))
+            {
+                recentFramePackets.pop_front();
+            }
+            recentFramePackets.push_back({game.frame, framePacket});
+        }
+
+        // The replay log gets the same packets clients do, less those implicit frames let them go without.
+        // Keyframes are snapshots already taken for resyncs, so recording costs the tick nothing but a queue push.
+        if (game.state == Game::Active && game.frame % REPLAY_KEYFRAME_INTERVAL == 0 && latestSnapshot && latestSnapshot->frame == game.frame)
+            replayLogWriter.appendKeyframe(latestSnapshot);
+        if (!framePacket->canBeElided)
+            replayLogWriter.appendFramePacket(framePacket->plain);
+
+        // Checkpoint the game for a restart, starting a new segment of the write-ahead log from it.
+        // The log's writer hands it on to snapshotFileWriter once everything before it is committed.
+        // Only on frames without events, so no deposit or withdrawal is half in and half out of the file.
+        framesSinceSnapshotFile++;
+        if (framesSinceSnapshotFile >= SNAPSHOT_FILE_INTERVAL && pendingEvents.size() == 0)
+        {
+            boost::shared_ptr<GameSnapshot> checkpointOrNull;
+            if (game.state == Game::Active && latestSnapshot && latestSnapshot->frame == game.frame)
+                checkpointOrNull = latestSnapshot;
+            else if (game.state == Game::Pregame)
+                // frame doesn't advance in Pregame, so there's no fresh resync snapshot to reuse; it's small anyway
+                checkpointOrNull.reset(new GameSnapshot(&game));
+
+            if (checkpointOrNull)
+            {
+                // a restart from the checkpoint needs the cmds that earlier frames scheduled past it
+                vector<boost::shared_ptr<const vch>> announcingPackets;
+                for (unsigned int i = 0; i < recentFramePackets.size(); i++)
+                {
+                    uint64_t frame = recentFramePackets[i].first;
+                    if (frame >= firstFrameAnnouncingCmdsFor(game.frame) && frame < game.frame && !recentFramePackets[i].second->canBeElided)
+                        announcingPackets.push_back(recentFramePackets[i].second->plain);
+                }
+                writeAheadLogWriter.startSegment(checkpointOrNull, announcingPackets);
+                framesSinceSnapshotFile = 0;
+            }
+        }
+        if (!framePacket->canBeElided || consumedDepositFiles.size() > 0 || withdrawalPayouts.size() > 0)
+            writeAheadLogWriter.appendFrame(framePacket->plain, consumedDepositFiles, withdrawalPayouts);
+
+        // deal with clients that aren't keeping up before queueing anything more for them
+        for (unsigned int i = 0; i < clientChannels.size(); i++)
+        {
+            if (clientChannels[i]->state != ClientChannel::Closed)
+                clientChannels[i]->checkSendQueueFromSimThread();
+        }
+        framesSinceSendQueueReport++;
+        if (framesSinceSendQueueReport >= SEND_QUEUE_REPORT_INTERVAL)
+        {
+            reportSendQueuesAndResetPeaks();
+            framesSinceSendQueueReport = 0;
+        }
+
+        // clients answer pings right away, which tells us their round trip for cmdDelayFrames
+        boost::shared_ptr<vch> pingPacketOrNull;
+        if (game.state == Game::Active && game.frame % CMD_DELAY_PING_INTERVAL == 0)
+        {
+            pingPacketOrNull.reset(new vch);
+            packToVch(pingPacketOrNull.get(), "C", PACKET_PING_CHAR);
+            packToVch(pingPacketOrNull.get(), "Q", (uint64_t)8);
+            packToVch(pingPacketOrNull.get(), "Q", game.frame);
+        }
 
         // send the packet out to all clients
         for (unsigned int i = 0; i < clientChannels.size(); i++)
@@ -482,14 +1413,26 @@ int main(int argc, char *argv[])
                     break;
 
                 case ClientChannel::ReadyForFirstSync:
-                    clientChannels[i]->sendResyncPacket();
-                    clientChannels[i]->sendFrameCmdsPacket(fcp);
+                case ClientChannel::UpToDate:
+                    if (clientChannels[i]->state == ClientChannel::ReadyForFirstSync)
+                        clientChannels[i]->maybeCatchUp(&recentFramePackets);
+                    if (clientChannels[i]->state == ClientChannel::ReadyForFirstSync || clientChannels[i]->maybeResyncRequest)
+                        clientChannels[i]->startResync(&recentFramePackets);
 
-                    clientChannels[i]->state = ClientChannel::UpToDate;
+                    // otherwise this frame's packet is already held to follow the resync
+                    if (clientChannels[i]->state == ClientChannel::UpToDate)
+                    {
+                        clientChannels[i]->sendFrameCmdsPacket(framePacket.get());
+                        if (pingPacketOrNull)
+                            clientChannels[i]->queuePacketFromSimThread(pingPacketOrNull);
+                    }
                     break;
 
-                case ClientChannel::UpToDate:
-                    clientChannels[i]->sendFrameCmdsPacket(fcp);
+                case ClientChannel::AwaitingResync:
+                    clientChannels[i]->holdFramePacketForResync(framePacket.get());
+                    break;
+
+                case ClientChannel::WaitingForSendQueueToDrain:
                     break;
                 
                 case ClientChannel::Closed:
@@ -499,38 +1442,10 @@ int main(int argc, char *argv[])
             }
         }
 
-        // execute all events
-        for (unsigned int i = 0; i < pendingEvents.size(); i++)
-        {
-            pendingEvents[i]->execute(&game);
-        }
+        // events, then this frame's immediate cmds, then those scheduled for it, the same way clients and a restart run it
         pendingEvents.clear();
-
-        // execute all cmds on server-side game
-        for (unsigned int i = 0; i < pendingCmds.size(); i++)
-        {
-            if (auto unitCmd = boost::dynamic_pointer_cast<UnitCmd, Cmd>(fcp.authdCmds[i]->cmd))
-            {
-                unitCmd->executeAsPlayer(&game, fcp.authdCmds[i]->playerAddress);
-            }
-            else if (auto withdrawCmd = boost::dynamic_pointer_cast<WithdrawCmd, Cmd>(fcp.authdCmds[i]->cmd))
-            {
-                int playerId = game.playerAddressToIdOrNegativeOne(fcp.authdCmds[i]->playerAddress);
-                if (playerId < 0)
-                {
-                    cout << "Woah, getting a negative playerId when processing a withdraw cmd..." << endl;
-                    continue;
-                }
-                // if 0, interpret this as "all"
-                coinsInt withdrawSpecified = withdrawCmd->amount > 0 ? withdrawCmd->amount : game.players[playerId].credit.getInt();
-                coinsInt amountToWithdraw = min(withdrawSpecified, game.players[playerId].credit.getInt());
-
-                pendingWithdrawEvents.push_back(WithdrawEvent(fcp.authdCmds[i]->playerAddress, amountToWithdraw));
-            }
-        }
         pendingCmds.clear();
-
-        game.iterate();
+        runFrameAsServer(&game, &fcp, &cmdSchedule, &pendingWithdrawEvents);
     }
 
     cout << "oohhhhh Logan you done did it this time" << endl;
@@ -0,0 +1,67 @@
+#include <chrono>
+#include <random>
+#include "sessiontokens.h"
+#include "keccak.h"
+#include "config.h"
+
+using namespace std;
+
+uint64_t unixSecondsNow()
+{
+    return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+string SessionTokens::macHexFor(string addressAndExpiry)
+{
+    vch mac = hmacKeccak256(key, vch(addressAndExpiry.begin(), addressAndExpiry.end()));
+
+    const char *hexDigits = "0123456789abcdef";
+    string hex;
+    for (unsigned int i = 0; i < mac.size(); i++)
+    {
+        hex += hexDigits[mac[i] >> 4];
+        hex += hexDigits[mac[i] & 0xf];
+    }
+    return hex;
+}
+
+string SessionTokens::issue(string address)
+{
+    string addressAndExpiry = address + "." + to_string(unixSecondsNow() + SESSION_TOKEN_LIFETIME_SECONDS);
+    return addressAndExpiry + "." + macHexFor(addressAndExpiry);
+}
+
+optional<string> SessionTokens::tokenToAddress(string token)
+{
+    size_t macStart = token.rfind('.');
+    if (macStart == string::npos)
+        return {};
+    string addressAndExpiry = token.substr(0, macStart);
+    string mac = token.substr(macStart + 1);
+
+    // compare every byte, so how long the check takes doesn't say how much of a forged mac was right
+    string expectedMac = macHexFor(addressAndExpiry);
+    if (mac.size() != expectedMac.size())
+        return {};
+    unsigned char difference = 0;
+    for (unsigned int i = 0; i < mac.size(); i++)
+        difference |= mac[i] ^ expectedMac[i];
+    if (difference != 0)
+        return {};
+
+    size_t expiryStart = addressAndExpiry.rfind('.');
+    if (expiryStart == string::npos)
+        return {};
+    uint64_t expiry = strtoull(addressAndExpiry.c_str() + expiryStart + 1, NULL, 10);
+    if (expiry < unixSecondsNow())
+        return {};
+
+    return addressAndExpiry.substr(0, expiryStart);
+}
+
+SessionTokens::SessionTokens()
+{
+    random_device randomDevice;
+    for (unsigned int i = 0; i < 32; i++)
+        key.push_back((unsigned char)randomDevice());
+}
@@ -0,0 +1,27 @@
+#include <string>
+#include <optional>
+#include "common.h"
+
+#ifndef SESSIONTOKENS_H
+#define SESSIONTOKENS_H
+
+using namespace std;
+
+// Lets a client that's proven its address once reconnect without signing a challenge again.
+// A token reads "<address>.<expiry>.<mac>": the expiry in unix seconds, and the mac an HMAC-Keccak256 of the rest
+// under a key made fresh each time the server starts, so a restart invalidates every outstanding token.
+// Safe to use from any thread; nothing changes after construction.
+class SessionTokens
+{
+    vch key;
+
+    string macHexFor(string addressAndExpiry);
+public:
+    string issue(string address);
+    // the address the token was issued to, if it's genuine and hasn't expired
+    optional<string> tokenToAddress(string token);
+
+    SessionTokens();
+};
+
+#endif // SESSIONTOKENS_H
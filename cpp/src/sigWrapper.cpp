@@ -1,53 +1,160 @@
 #include <iostream>
 #include "sigWrapper.h"
+#include "keccak.h"
+#include "secp256k1.h"
 
 using namespace std;
 
-string getPythonErrorText()
+const string PERSONAL_MESSAGE_PREFIX = "\x19" "Ethereum Signed Message:\n";
+
+optional<vch> hexToVch(string hex)
 {
-    PyObject *ptype, *pvalue, *ptraceback;
-    PyErr_Fetch(&ptype, &pvalue, &ptraceback);
-    if (pvalue)
-        {
-        PyObject *pstr = PyObject_Str(pvalue);
-        if (pstr)
+    if (hex.size() >= 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X'))
+        hex = hex.substr(2);
+    if (hex.size() % 2 == 1)
+        hex = "0" + hex;
+
+    vch bytes;
+    for (size_t i = 0; i < hex.size(); i += 2)
+    {
+        int byte = 0;
+        for (size_t j = i; j < i + 2; j++)
         {
-            const char* err_msg = PyUnicode_AsUTF8(pstr);
-            if(pstr)
-            return string(err_msg);
+            char c = hex[j];
+            int nibble;
+            if (c >= '0' && c <= '9')
+                nibble = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                nibble = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                nibble = c - 'A' + 10;
+            else
+                return {};
+            byte = (byte << 4) | nibble;
         }
+        bytes.push_back((unsigned char)byte);
     }
-    return "... but I can't get the error string for some reason :/";
+    return bytes;
 }
 
-optional<string> signedMsgToAddress(string message, string sig, string *error)
+string addressToChecksummedString(const vch &address)
 {
-    Py_Initialize();
+    const char *hexDigits = "0123456789abcdef";
+    string lower;
+    for (unsigned int i = 0; i < address.size(); i++)
+    {
+        lower += hexDigits[address[i] >> 4];
+        lower += hexDigits[address[i] & 0xf];
+    }
 
-    PyRun_SimpleString("import sys, os");
-    PyRun_SimpleString("sys.path.append(os.getcwd())");
+    // a letter is capitalized if the matching nibble of the hash of the lowercase hex is 8 or more
+    vch hash = keccak256(lower);
+    string checksummed = "0x";
+    for (unsigned int i = 0; i < lower.size(); i++)
+    {
+        unsigned char nibble = (i % 2 == 0) ? (hash[i / 2] >> 4) : (hash[i / 2] & 0xf);
+        checksummed += (nibble >= 8) ? (char)toupper(lower[i]) : lower[i];
+    }
+    return checksummed;
+}
 
-    PyObject* module = PyImport_ImportModule("signed_msg_to_address");
-    if (!module)
+string pubKeyToAddress(const vch &pubKey)
+{
+    vch pubKeyHash = keccak256(pubKey);
+    vch address(pubKeyHash.begin() + 12, pubKeyHash.end());
+    return addressToChecksummedString(address);
+}
+
+optional<string> signedMsgToAddress(string message, string sig, string *error)
+{
+    optional<vch> maybeSigBytes = hexToVch(sig);
+    if (!maybeSigBytes)
+    {
+        *error = "Signature isn't hex.";
+        return {};
+    }
+    vch sigBytes = *maybeSigBytes;
+    if (sigBytes.size() != 65)
     {
-        *error = "Python error: error importing module: " + getPythonErrorText();
+        *error = "Signature is " + to_string(sigBytes.size()) + " bytes; expected 65.";
         return {};
     }
 
-    PyObject* function = PyObject_GetAttrString(module,(char*)"signed_msg_to_address");
-    if (!function)
+    // v may be given as 0/1, 27/28, or with an EIP-155 chain id folded in, as eth_account accepts
+    unsigned char v = sigBytes[64];
+    unsigned char recoveryId;
+    if (v <= 1)
+        recoveryId = v;
+    else if (v == 27 || v == 28)
+        recoveryId = v - 27;
+    else if (v >= 35)
+        recoveryId = (v - 35) % 2;
+    else
     {
-        *error = "Python error: error loading functino signed_msg_to_address: " + getPythonErrorText();
+        *error = "Signature has an invalid v of " + to_string(v) + ".";
         return {};
     }
+    sigBytes.pop_back();
+
+    vch hash = keccak256(PERSONAL_MESSAGE_PREFIX + to_string(message.size()) + message);
 
-    PyObject* result = PyObject_CallFunction(function, "ss", message.c_str(), sig.c_str());
-    if (!result)
+    optional<vch> maybePubKey = recoverPubKey(hash, sigBytes, recoveryId);
+    if (!maybePubKey)
     {
-        *error = "Python error: error calling function signed_msg_to_address: " + getPythonErrorText();
+        *error = "Signature doesn't recover to a public key.";
+        return {};
+    }
+
+    return pubKeyToAddress(*maybePubKey);
+}
+
+optional<string> privKeyToAddress(const vch &privKey)
+{
+    optional<vch> maybePubKey = pubKeyFromPrivKey(privKey);
+    if (!maybePubKey)
         return {};
+    return pubKeyToAddress(*maybePubKey);
+}
+
+optional<string> signMessage(string message, const vch &privKey)
+{
+    vch hash = keccak256(PERSONAL_MESSAGE_PREFIX + to_string(message.size()) + message);
+
+    unsigned char recoveryId;
+    optional<vch> maybeSig = signHash(hash, privKey, &recoveryId);
+    if (!maybeSig)
+        return {};
+    maybeSig->push_back(27 + recoveryId);
+
+    const char *hexDigits = "0123456789abcdef";
+    string sigHex = "0x";
+    for (unsigned int i = 0; i < maybeSig->size(); i++)
+    {
+        sigHex += hexDigits[(*maybeSig)[i] >> 4];
+        sigHex += hexDigits[(*maybeSig)[i] & 0xf];
     }
+    return sigHex;
+}
+
+void SigVerifier::verifyAsync(string message, string sig, function<void(optional<string>, string)> onDone)
+{
+    workService.post([message, sig, onDone]
+    {
+        string error;
+        optional<string> maybeAddress = signedMsgToAddress(message, sig, &error);
+        onDone(maybeAddress, error);
+    });
+}
 
-    const char* resultCStr = PyUnicode_AsUTF8(result);
-    return {string(resultCStr)};
-}
\ No newline at end of file
+SigVerifier::SigVerifier()
+{
+    maybeWork.emplace(workService);
+    workerThread = thread([this] { workService.run(); });
+}
+
+SigVerifier::~SigVerifier()
+{
+    // let anything already queued finish
+    maybeWork.reset();
+    workerThread.join();
+}
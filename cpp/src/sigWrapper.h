@@ -1,14 +1,37 @@
 #ifndef SIGWRAPPER_H
 #define SIGWRAPPER_H
 
-#define PY_SSIZE_T_CLEAN
-
-#include <Python.h>
 #include <string>
 #include <optional>
+#include <thread>
+#include <functional>
+#include <boost/asio.hpp>
+#include "common.h"
 
 using namespace std;
 
+// Does what web3's recover_message does for an encode_defunct(text=message):
+// recovers who signed the EIP-191 personal message from a 65-byte r, s, v hex signature,
+// and returns their address with the EIP-55 checksum capitalization.
 optional<string> signedMsgToAddress(string message, string sig, string *error);
 
-#endif // SIGWARPPER_H
\ No newline at end of file
+// The signing side of the same, for test keys (see secp256k1.h); the signature has v as 27 or 28.
+// Both return nothing if privKey isn't a valid 32-byte key.
+optional<string> signMessage(string message, const vch &privKey);
+optional<string> privKeyToAddress(const vch &privKey);
+
+// Recovers signer addresses on its own thread, so a burst of handshakes doesn't hold up networking.
+class SigVerifier
+{
+    boost::asio::io_service workService;
+    optional<boost::asio::io_service::work> maybeWork;
+    thread workerThread;
+public:
+    // onDone is called on the verifier's thread, with the address or with nothing and an error.
+    void verifyAsync(string message, string sig, function<void(optional<string>, string)> onDone);
+
+    SigVerifier();
+    ~SigVerifier();
+};
+
+#endif // SIGWRAPPER_H
@@ -0,0 +1,220 @@
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshotfile.h"
+
+using namespace std;
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, p, size);
+        if (written < 0)
+            return false;
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool fsyncParentDir(string path)
+{
+    size_t lastSlash = path.rfind('/');
+    string dirPath = lastSlash == string::npos ? "." : path.substr(0, lastSlash + 1);
+
+    int dirFd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0)
+        return false;
+    bool ok = fsync(dirFd) == 0;
+    close(dirFd);
+    return ok;
+}
+
+uint64_t hashEntityOffsets(const uint32_t *offsets, uint64_t numOffsets)
+{
+    const unsigned char *bytes = (const unsigned char*)offsets;
+    return hashVch(vch(bytes, bytes + numOffsets * sizeof(uint32_t)));
+}
+
+bool writeSnapshotFile(string path, GameSnapshot *snapshot)
+{
+    SnapshotFileHeader header;
+    memcpy(header.magic, SNAPSHOT_FILE_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_FILE_VERSION;
+    header.byteOrderMark = SNAPSHOT_FILE_BYTE_ORDER_MARK;
+    header.frame = snapshot->frame;
+    header.gameHash = snapshot->hash;
+    header.entityOffsetsHash = hashEntityOffsets(snapshot->entityOffsets.data(), snapshot->entityOffsets.size());
+    header.entityOffsetsStart = sizeof(SnapshotFileHeader);
+    header.numEntityOffsets = snapshot->entityOffsets.size();
+    header.packedGameStart = header.entityOffsetsStart + header.numEntityOffsets * sizeof(uint32_t);
+    header.packedGameSize = snapshot->packed.size();
+
+    string tempPath = path + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    bool ok = writeAll(fd, &header, sizeof(header))
+           && writeAll(fd, snapshot->entityOffsets.data(), header.numEntityOffsets * sizeof(uint32_t))
+           && writeAll(fd, snapshot->packed.data(), snapshot->packed.size())
+           && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    // the write-ahead log is trimmed once a snapshot is written, so the rename has to be on disk too
+    return fsyncParentDir(path);
+}
+
+bool loadSnapshotFileIntoGame(string path, Game *game)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(SnapshotFileHeader))
+    {
+        close(fd);
+        cout << "Snapshot file " << path << " is too small to be a snapshot." << endl;
+        return false;
+    }
+    uint64_t fileSize = st.st_size;
+
+    void *mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    const unsigned char *base = (const unsigned char*)mapped;
+    const SnapshotFileHeader *header = (const SnapshotFileHeader*)base;
+
+    bool ok = true;
+    if (memcmp(header->magic, SNAPSHOT_FILE_MAGIC, sizeof(header->magic)) != 0
+     || header->version != SNAPSHOT_FILE_VERSION
+     || header->byteOrderMark != SNAPSHOT_FILE_BYTE_ORDER_MARK)
+    {
+        cout << "Snapshot file " << path << " has an unrecognized header." << endl;
+        ok = false;
+    }
+    // checked on its own first, so a corrupt count can't wrap the sum below around to something that lines up
+    else if (header->numEntityOffsets > (fileSize - sizeof(SnapshotFileHeader)) / sizeof(uint32_t))
+    {
+        cout << "Snapshot file " << path << " is truncated or its sections don't line up." << endl;
+        ok = false;
+    }
+    else if (header->entityOffsetsStart != sizeof(SnapshotFileHeader)
+          || header->packedGameStart != header->entityOffsetsStart + header->numEntityOffsets * sizeof(uint32_t)
+          || header->packedGameStart > fileSize
+          || header->packedGameSize != fileSize - header->packedGameStart)
+    {
+        cout << "Snapshot file " << path << " is truncated or its sections don't line up." << endl;
+        ok = false;
+    }
+
+    vch packed;
+    vector<uint32_t> entityOffsets;
+    if (ok)
+    {
+        const uint32_t *offsetsStart = (const uint32_t*)(base + header->entityOffsetsStart);
+        entityOffsets.assign(offsetsStart, offsetsStart + header->numEntityOffsets);
+        packed.assign(base + header->packedGameStart, base + header->packedGameStart + header->packedGameSize);
+
+        if (hashVch(packed) != header->gameHash
+         || hashEntityOffsets(entityOffsets.data(), entityOffsets.size()) != header->entityOffsetsHash)
+        {
+            cout << "Snapshot file " << path << " doesn't match its hash." << endl;
+            ok = false;
+        }
+        else if (entityOffsets.size() == 0 || entityOffsets.back() != packed.size() || packed.size() < PACK_C_SIZE + PACK_Q_SIZE)
+        {
+            cout << "Snapshot file " << path << " has an entity offset table that doesn't fit the game." << endl;
+            ok = false;
+        }
+        else
+        {
+            // the packed game starts with its state then its frame, so this can be checked before unpacking anything
+            uint64_t packedFrame;
+            unpackFromIter(packed.begin() + PACK_C_SIZE, "Q", &packedFrame);
+            if (packedFrame != header->frame)
+            {
+                cout << "Snapshot file " << path << " says frame " << header->frame << " but the game inside is at " << packedFrame << "." << endl;
+                ok = false;
+            }
+        }
+    }
+
+    munmap(mapped, fileSize);
+    if (!ok)
+        return false;
+
+    game->unpackInParallelWithEntityOffsets(packed.begin(), entityOffsets, thread::hardware_concurrency());
+    return true;
+}
+
+void SnapshotFileWriter::writerLoop()
+{
+    while (true)
+    {
+        boost::shared_ptr<GameSnapshot> snapshot;
+        {
+            unique_lock<mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || pendingSnapshotOrNull; });
+
+            if (!pendingSnapshotOrNull)
+                return;
+
+            snapshot.swap(pendingSnapshotOrNull);
+        }
+
+        if (!writeSnapshotFile(path, snapshot.get()))
+        {
+            cout << "Couldn't write snapshot of frame " << snapshot->frame << " to " << path << endl;
+        }
+        else
+        {
+            lock_guard<mutex> lock(mtx);
+            maybeLastWrittenHash = snapshot->hash;
+        }
+    }
+}
+
+optional<uint64_t> SnapshotFileWriter::getMaybeLastWrittenHash()
+{
+    lock_guard<mutex> lock(mtx);
+    return maybeLastWrittenHash;
+}
+
+void SnapshotFileWriter::writeAsync(boost::shared_ptr<GameSnapshot> snapshot)
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        pendingSnapshotOrNull = snapshot;
+    }
+    cv.notify_one();
+}
+
+SnapshotFileWriter::SnapshotFileWriter(string path)
+    : path(path), stopping(false)
+{
+    writerThread = thread(&SnapshotFileWriter::writerLoop, this);
+}
+
+SnapshotFileWriter::~SnapshotFileWriter()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_one();
+    writerThread.join();
+}
@@ -0,0 +1,74 @@
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include "common.h"
+#include "engine.h"
+#include "snapshots.h"
+
+#ifndef SNAPSHOTFILE_H
+#define SNAPSHOTFILE_H
+
+using namespace std;
+
+// Layout of a snapshot file, meant to be mmap'd and checked in place:
+//   SnapshotFileHeader
+//   uint32_t entityOffsets[numEntityOffsets] (relative to the start of the packed game),
+//     so entities can be unpacked in parallel or picked out individually
+//   the packed game, exactly as Game::pack produces it
+// All fields are in host byte order; byteOrderMark catches a file written on a different host.
+struct SnapshotFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint64_t frame;
+    uint64_t gameHash;
+    uint64_t entityOffsetsHash;
+    uint64_t entityOffsetsStart;
+    uint64_t numEntityOffsets;
+    uint64_t packedGameStart;
+    uint64_t packedGameSize;
+};
+
+const char SNAPSHOT_FILE_MAGIC[8] = {'C', 'F', 'S', 'N', 'A', 'P', 0, 0};
+const uint32_t SNAPSHOT_FILE_VERSION = 2;
+const uint32_t SNAPSHOT_FILE_BYTE_ORDER_MARK = 0x01020304;
+
+// Writes snapshots to disk on its own thread, so the tick thread doesn't wait on the disk.
+// If a write is still in progress when another snapshot comes in, only the newest waiting one gets written.
+// Each write goes to a temp file that's renamed over the old one, so a crash mid-write leaves the old file intact.
+class SnapshotFileWriter
+{
+    string path;
+
+    thread writerThread;
+    mutex mtx;
+    condition_variable cv;
+    boost::shared_ptr<GameSnapshot> pendingSnapshotOrNull;
+    bool stopping;
+    optional<uint64_t> maybeLastWrittenHash;
+
+    void writerLoop();
+public:
+    void writeAsync(boost::shared_ptr<GameSnapshot> snapshot);
+    // the hash of the game in the file as it now stands on disk, if this writer has written one
+    optional<uint64_t> getMaybeLastWrittenHash();
+
+    SnapshotFileWriter(string path);
+    ~SnapshotFileWriter();
+};
+
+// keeps calling write() until all of data is out; false if any call fails
+bool writeAll(int fd, const void *data, size_t size);
+// so that files just created, renamed or removed within it stay that way through a crash
+bool fsyncParentDir(string path);
+
+bool writeSnapshotFile(string path, GameSnapshot *snapshot);
+
+// Maps the file, checks the header and hash, and unpacks it into game.
+// Returns false (leaving game untouched) if there's no file or it doesn't check out.
+bool loadSnapshotFileIntoGame(string path, Game *game);
+
+#endif // SNAPSHOTFILE_H
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <thread>
+#include "snapshots.h"
+#include "config.h"
+#include "vchpack.h"
+
+using namespace std;
+
+GameSnapshot::GameSnapshot(Game *game)
+    : frame(game->frame)
+{
+    game->packInParallelAndRecordEntityOffsets(&packed, &entityOffsets, thread::hardware_concurrency());
+    hash = hashVch(packed);
+}
+
+uint32_t GameSnapshot::getHeaderSize()
+{
+    // everything before the entity count
+    return entityOffsets[0] - PACK_H_SIZE;
+}
+uint16_t GameSnapshot::getNumEntities()
+{
+    return entityOffsets.size() - 1;
+}
+bool GameSnapshot::entityBytesEqual(uint16_t i, GameSnapshot *other)
+{
+    uint32_t size = entityOffsets[i + 1] - entityOffsets[i];
+    uint32_t otherSize = other->entityOffsets[i + 1] - other->entityOffsets[i];
+    if (size != otherSize)
+        return false;
+
+    return memcmp(&packed[entityOffsets[i]], &other->packed[other->entityOffsets[i]], size) == 0;
+}
+
+void SnapshotHistory::maybeRecord(Game *game)
+{
+    if (game->frame % RESYNC_SNAPSHOT_INTERVAL != 0)
+        return;
+
+    // frame doesn't advance in Pregame, so make sure we only take one per frame
+    if (snapshots.size() > 0 && snapshots.back()->frame >= game->frame)
+        return;
+
+    snapshots.push_back(boost::shared_ptr<GameSnapshot>(new GameSnapshot(game)));
+
+    if (snapshots.size() > RESYNC_SNAPSHOTS_KEPT)
+        snapshots.pop_front();
+}
+boost::shared_ptr<GameSnapshot> SnapshotHistory::getSnapshotOrNull(uint64_t frame, uint64_t hash)
+{
+    for (unsigned int i = 0; i < snapshots.size(); i++)
+    {
+        if (snapshots[i]->frame == frame && snapshots[i]->hash == hash)
+            return snapshots[i];
+    }
+    return boost::shared_ptr<GameSnapshot>();
+}
+boost::shared_ptr<GameSnapshot> SnapshotHistory::getLatestOrNull()
+{
+    if (snapshots.size() == 0)
+        return boost::shared_ptr<GameSnapshot>();
+    return snapshots.back();
+}
+
+// Layout:
+//   Q baselineFrame, Q baselineHash
+//   L headerSize, then the header bytes of the current game (state, frame, players)
+//   H numEntities, H numRuns
+//   for each run of changed entities: H firstEntity, H numEntitiesInRun, L numBytes, then the bytes
+//   Q hash of the full packed game, so the client can check its result
+void packDeltaResync(vch *dest, GameSnapshot *baseline, GameSnapshot *current)
+{
+    packToVch(dest, "QQ", baseline->frame, baseline->hash);
+
+    uint32_t headerSize = current->getHeaderSize();
+    packToVch(dest, "L", (unsigned long)headerSize);
+    dest->insert(dest->end(), current->packed.begin(), current->packed.begin() + headerSize);
+
+    uint16_t numEntities = current->getNumEntities();
+    uint16_t numBaselineEntities = baseline->getNumEntities();
+
+    vector<pair<uint16_t, uint16_t>> runs; // first, count
+    for (uint16_t i = 0; i < numEntities; i++)
+    {
+        bool changed = i >= numBaselineEntities || !current->entityBytesEqual(i, baseline);
+        if (!changed)
+            continue;
+
+        if (runs.size() > 0 && runs.back().first + runs.back().second == i)
+            runs.back().second++;
+        else
+            runs.push_back(pair<uint16_t, uint16_t>(i, 1));
+    }
+
+    packToVch(dest, "HH", numEntities, (uint16_t)(runs.size()));
+    for (unsigned int i = 0; i < runs.size(); i++)
+    {
+        uint32_t start = current->entityOffsets[runs[i].first];
+        uint32_t end = current->entityOffsets[runs[i].first + runs[i].second];
+
+        packToVch(dest, "HHL", runs[i].first, runs[i].second, (unsigned long)(end - start));
+        dest->insert(dest->end(), current->packed.begin() + start, current->packed.begin() + end);
+    }
+
+    packToVch(dest, "Q", current->hash);
+}
+
+// whether there are at least n bytes left before end
+bool bytesRemain(vchIter iter, vchIter end, uint64_t n)
+{
+    return iter <= end && (uint64_t)(end - iter) >= n;
+}
+
+optional<vch> unpackDeltaResyncToPackedGame(vchIter *iter, vchIter end, SnapshotHistory *history)
+{
+    if (!bytesRemain(*iter, end, 8 + 8 + 4))
+        return {};
+
+    uint64_t baselineFrame, baselineHash;
+    *iter = unpackFromIter(*iter, "QQ", &baselineFrame, &baselineHash);
+
+    boost::shared_ptr<GameSnapshot> baseline = history->getSnapshotOrNull(baselineFrame, baselineHash);
+    if (!baseline)
+        return {};
+
+    unsigned long headerSize;
+    *iter = unpackFromIter(*iter, "L", &headerSize);
+
+    if (!bytesRemain(*iter, end, (uint64_t)headerSize + 2 + 2))
+        return {};
+
+    vch packed(*iter, *iter + headerSize);
+    *iter += headerSize;
+
+    uint16_t numEntities, numRuns;
+    *iter = unpackFromIter(*iter, "HH", &numEntities, &numRuns);
+    packToVch(&packed, "H", numEntities);
+
+    uint16_t nextEntity = 0;
+    for (unsigned int i = 0; i < numRuns; i++)
+    {
+        if (!bytesRemain(*iter, end, 2 + 2 + 4))
+            return {};
+
+        uint16_t first, count;
+        unsigned long numBytes;
+        *iter = unpackFromIter(*iter, "HHL", &first, &count, &numBytes);
+
+        // runs are in order, don't overlap, and stay within the game
+        if (first < nextEntity || (uint32_t)first + count > numEntities || !bytesRemain(*iter, end, numBytes))
+            return {};
+
+        // fill in the unchanged entities before this run from the baseline
+        if (first > nextEntity)
+        {
+            if (first > baseline->getNumEntities())
+                return {};
+            packed.insert(packed.end(), baseline->packed.begin() + baseline->entityOffsets[nextEntity], baseline->packed.begin() + baseline->entityOffsets[first]);
+        }
+
+        packed.insert(packed.end(), *iter, *iter + numBytes);
+        *iter += numBytes;
+        nextEntity = first + count;
+    }
+    if (numEntities > nextEntity)
+    {
+        if (numEntities > baseline->getNumEntities())
+            return {};
+        packed.insert(packed.end(), baseline->packed.begin() + baseline->entityOffsets[nextEntity], baseline->packed.begin() + baseline->entityOffsets[numEntities]);
+    }
+
+    if (!bytesRemain(*iter, end, 8))
+        return {};
+
+    uint64_t expectedHash;
+    *iter = unpackFromIter(*iter, "Q", &expectedHash);
+
+    if (hashVch(packed) != expectedHash)
+        return {};
+
+    return {packed};
+}
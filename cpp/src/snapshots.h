@@ -0,0 +1,49 @@
+#include <deque>
+#include <optional>
+#include <boost/shared_ptr.hpp>
+#include "common.h"
+#include "engine.h"
+
+#ifndef SNAPSHOTS_H
+#define SNAPSHOTS_H
+
+using namespace std;
+
+// A packed copy of the game, along with where each entity sits within it,
+// so that two snapshots can be compared entity by entity.
+// `packed` is exactly what Game::pack produces.
+struct GameSnapshot
+{
+    uint64_t frame;
+    vch packed;
+    vector<uint32_t> entityOffsets; // one per entity, plus a final entry marking the end
+    uint64_t hash;
+
+    uint32_t getHeaderSize();
+    uint16_t getNumEntities();
+    bool entityBytesEqual(uint16_t i, GameSnapshot *other);
+
+    GameSnapshot(Game *game);
+};
+
+// Keeps the last RESYNC_SNAPSHOTS_KEPT snapshots taken every RESYNC_SNAPSHOT_INTERVAL frames.
+// Server and client each keep one, so they'll hold snapshots of the same frames.
+// Snapshots aren't modified once taken, so other threads can hold on to one for as long as they need.
+class SnapshotHistory
+{
+    deque<boost::shared_ptr<GameSnapshot>> snapshots;
+public:
+    void maybeRecord(Game *game);
+    boost::shared_ptr<GameSnapshot> getSnapshotOrNull(uint64_t frame, uint64_t hash);
+    boost::shared_ptr<GameSnapshot> getLatestOrNull();
+};
+
+// Packs only the entities that differ between baseline and current.
+void packDeltaResync(vch *dest, GameSnapshot *baseline, GameSnapshot *current);
+
+// Rebuilds the full Game::pack bytes from a delta resync.
+// Returns nothing if the baseline isn't in history, the delta runs past end or doesn't fit the baseline,
+// or the result doesn't match what the server had.
+optional<vch> unpackDeltaResyncToPackedGame(vchIter *iter, vchIter end, SnapshotHistory *history);
+
+#endif // SNAPSHOTS_H
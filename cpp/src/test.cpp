@@ -1,21 +1,389 @@
 #include <iostream>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
 #include "coins.h"
+#include "config.h"
+#include "engine.h"
+#include "entities.h"
+#include "events.h"
+#include "cmds.h"
+#include "packets.h"
+#include "snapshots.h"
+#include "compression.h"
+#include "jitterbuffer.h"
+#include "keccak.h"
+#include "sigWrapper.h"
+#include "snapshotfile.h"
+#include "writeaheadlog.h"
 
 // void makeSure(bool condition) // hacky test function
 // {
 //     cout << (condition ? "PASSED" : "FAILED") << endl;
 // }
 
-// void makeSure(string name, bool condition) // hacky test function
-// {
-//     cout << (condition ? "PASSED: " : "FAILED: ") << name << endl;
-// }
-
 using namespace std;
 
+bool allPassed = true;
+
+void makeSure(string name, bool condition) // hacky test function
+{
+    cout << (condition ? "PASSED: " : "FAILED: ") << name << endl;
+    allPassed = allPassed && condition;
+}
+
+// a match with a couple of moving Primes among GoldPiles that sit still, on a frame the client would snapshot
+void setupDeltaTestGame(Game *game)
+{
+    PlayerJoinedEvent("0x1111111111111111111111111111111111111111").execute(game);
+    PlayerJoinedEvent("0x2222222222222222222222222222222222222222").execute(game);
+    BalanceUpdateEvent(0, 1000000000, true).execute(game);
+    BalanceUpdateEvent(1, 1000000000, true).execute(game);
+    game->startMatch();
+
+    for (int i = 0; i < 20; i++)
+    {
+        boost::shared_ptr<GoldPile> goldPile(new GoldPile(game, game->getNextEntityRef(), vector2f(i * 37.5, -200)));
+        goldPile->gold.createMoreByFiat(100 + i);
+        game->entities.push_back(goldPile);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        boost::shared_ptr<Prime> prime(new Prime(game, game->getNextEntityRef(), i, vector2f(i * 300, 0)));
+        prime->completeBuildingInstantly(&game->players[i].credit);
+        prime->cmdMove(vector2f(i * 300 + 0.3, 700.1));
+        game->entities.push_back(prime);
+    }
+
+    while (game->frame % RESYNC_SNAPSHOT_INTERVAL != 0)
+    {
+        game->iterate();
+    }
+}
+
+void testDeltaResync()
+{
+    Game serverGame;
+    setupDeltaTestGame(&serverGame);
+
+    // the client only ever has what came through a packed game
+    vch packedGame;
+    serverGame.pack(&packedGame);
+    vchIter place = packedGame.begin();
+    Game clientGame(&place);
+    clientGame.reassignEntityGamePointers();
+
+    SnapshotHistory clientHistory;
+    clientHistory.maybeRecord(&clientGame);
+    GameSnapshot serverBaseline(&serverGame);
+    boost::shared_ptr<GameSnapshot> clientBaseline = clientHistory.getSnapshotOrNull(serverBaseline.frame, serverBaseline.hash);
+    makeSure("client snapshot of an unpacked game matches the server's", (bool)clientBaseline);
+
+    for (int i = 0; i < 10; i++)
+    {
+        serverGame.iterate();
+    }
+    GameSnapshot current(&serverGame);
+
+    vch delta;
+    packDeltaResync(&delta, &serverBaseline, &current);
+    makeSure("delta resync leaves out unchanged entities", delta.size() < current.packed.size());
+
+    vchIter deltaPlace = delta.begin();
+    optional<vch> maybeRebuilt = unpackDeltaResyncToPackedGame(&deltaPlace, delta.end(), &clientHistory);
+    makeSure("delta resync applies to the client's snapshot", maybeRebuilt && *maybeRebuilt == current.packed && deltaPlace == delta.end());
+
+    vch truncated(delta.begin(), delta.end() - 12);
+    vchIter truncatedPlace = truncated.begin();
+    makeSure("truncated delta resync is refused", !unpackDeltaResyncToPackedGame(&truncatedPlace, truncated.end(), &clientHistory));
+
+    SnapshotHistory emptyHistory;
+    deltaPlace = delta.begin();
+    makeSure("delta resync without its baseline is refused", !unpackDeltaResyncToPackedGame(&deltaPlace, delta.end(), &emptyHistory));
+}
+
+void testFramePacketWithManyCmds()
+{
+    // more of each than a byte can count
+    FrameEventsPacket fcp(1234, {}, {});
+    for (int i = 0; i < 300; i++)
+    {
+        boost::shared_ptr<Cmd> cmd(new MoveCmd({(EntityRef)(i + 1)}, vector2f(i, -i)));
+        fcp.authdCmds.push_back(boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, i % 2)));
+        fcp.scheduledCmds.push_back(ScheduledCmd(fcp.frame + 1 + i % CMD_DELAY_MAX_FRAMES, boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, i % 2))));
+        fcp.events.push_back(boost::shared_ptr<Event>(new BalanceUpdateEvent(i % 2, i, true)));
+    }
+
+    vch packed;
+    fcp.pack(&packed);
+    vchIter place = packed.begin();
+    FrameEventsPacket unpacked(&place);
+    makeSure("frame packet with 300 cmds round-trips",
+        place == packed.end() && unpacked.frame == fcp.frame
+        && unpacked.authdCmds.size() == 300 && unpacked.events.size() == 300 && unpacked.scheduledCmds.size() == 300
+        && unpacked.scheduledCmds[299].executeFrame == fcp.scheduledCmds[299].executeFrame);
+
+    // as it goes out in a frame bundle, between two empty frames
+    vector<boost::shared_ptr<const vch>> framePackets;
+    for (uint64_t frame = fcp.frame - 1; frame <= fcp.frame + 1; frame++)
+    {
+        FrameEventsPacket framePacket = frame == fcp.frame ? fcp : FrameEventsPacket(frame, {}, {});
+        vch body;
+        framePacket.pack(&body);
+        boost::shared_ptr<vch> full(new vch);
+        packToVch(full.get(), "CQ", PACKET_FRAMECMDS_CHAR, (uint64_t)body.size());
+        full->insert(full->end(), body.begin(), body.end());
+        framePackets.push_back(full);
+    }
+    vch bundle;
+    packFrameBundle(&bundle, framePackets);
+    vchIter bundlePlace = bundle.begin();
+    vector<FrameEventsPacket> unbundled;
+    unpackFrameBundleAndMoveIter(&bundlePlace, &unbundled);
+    makeSure("frame bundle with 300 cmds in a frame round-trips",
+        bundlePlace == bundle.end() && unbundled.size() == 3
+        && unbundled[0].authdCmds.size() == 0 && unbundled[1].authdCmds.size() == 300 && unbundled[1].scheduledCmds.size() == 300 && unbundled[2].events.size() == 0);
+}
+
+void testCompressionRoundTrips()
+{
+    vch empty, compressedEmpty, decompressedEmpty;
+    compressToVch(&compressedEmpty, empty.data(), empty.size());
+    makeSure("empty input compresses and decompresses", decompressToVch(&decompressedEmpty, compressedEmpty.data(), compressedEmpty.size()) && decompressedEmpty.size() == 0);
+
+    vch repetitive;
+    for (int i = 0; i < 1000; i++)
+        repetitive.push_back(i % 7);
+    vch compressed, decompressed;
+    compressToVch(&compressed, repetitive.data(), repetitive.size());
+    makeSure("repetitive input compresses and decompresses", compressed.size() < repetitive.size() && decompressToVch(&decompressed, compressed.data(), compressed.size()) && decompressed == repetitive);
+}
+
+void testJitterBufferAfterResync()
+{
+    JitterBuffer receivedFrames;
+    uint64_t gameFrame = 100;
+    for (uint64_t frame = 100; frame < 140; frame++)
+        receivedFrames.push(FrameEventsPacket(frame, {}, {}));
+
+    FrameEventsPacket fcp(0, {}, {});
+    for (int i = 0; i < 10 && receivedFrames.popFrameFor(gameFrame, &fcp); i++)
+        gameFrame = fcp.frame + 1;
+
+    // a resync of frame 120 comes in, followed by the frames from 30 before it on
+    gameFrame = 120;
+    for (uint64_t frame = 90; frame <= 150; frame++)
+        receivedFrames.push(FrameEventsPacket(frame, {}, {}));
+
+    bool inOrder = true;
+    while (receivedFrames.popFrameFor(gameFrame, &fcp))
+    {
+        inOrder = inOrder && fcp.frame == gameFrame;
+        gameFrame = fcp.frame + 1;
+    }
+    makeSure("frames after a resync play on in order past what was already buffered", inOrder && gameFrame == 151);
+}
+
+string vchToHex(const vch &bytes)
+{
+    const char *hexDigits = "0123456789abcdef";
+    string hex;
+    for (unsigned int i = 0; i < bytes.size(); i++)
+    {
+        hex += hexDigits[bytes[i] >> 4];
+        hex += hexDigits[bytes[i] & 0xf];
+    }
+    return hex;
+}
+
+// signedMsgToAddress replaced web3's recover_message, so it has to give the same answers on the same vectors
+void testSignatureRecovery()
+{
+    makeSure("keccak256 of nothing", vchToHex(keccak256(vch())) == "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470");
+
+    vch privKeyOne(32, 0);
+    privKeyOne[31] = 1;
+    makeSure("address of private key 1", privKeyToAddress(privKeyOne) == optional<string>("0x7E5F4552091A69125d5DfCb7b8C2659029395Bdf"));
+
+    // from web3.py's sign_message documentation
+    string message = "I\xe2\x99\xa5SF";
+    string rs = "e6ca9bba58c88611fad66a6ce8f996908195593807c4b38bd528d2cff09d4eb3" "3e5bfbbf4d3e39b1a2fd816a7680c19ebebaf3a141b239934ad43cb33fcec8ce";
+    string signer = "0x5ce9454909639D2D17A3F753ce7d93fa0b9aB12E";
+    string error;
+    makeSure("web3 sign_message vector recovers with v = 28", signedMsgToAddress(message, "0x" + rs + "1c", &error) == optional<string>(signer));
+    makeSure("web3 sign_message vector recovers with v = 1", signedMsgToAddress(message, "0x" + rs + "01", &error) == optional<string>(signer));
+    makeSure("web3 sign_message vector recovers without 0x", signedMsgToAddress(message, rs + "1c", &error) == optional<string>(signer));
+    optional<string> maybeOtherParity27 = signedMsgToAddress(message, "0x" + rs + "1b", &error);
+    optional<string> maybeOtherParity0 = signedMsgToAddress(message, "0x" + rs + "00", &error);
+    makeSure("v = 27 and v = 0 agree, on someone else", maybeOtherParity27 && maybeOtherParity27 == maybeOtherParity0 && maybeOtherParity27 != optional<string>(signer));
+
+    // our own signatures, of both parities, come back to the key
+    vch privKey(32, 0);
+    for (unsigned int i = 0; i < 32; i++)
+        privKey[i] = i * 7 + 3;
+    optional<string> maybeAddress = privKeyToAddress(privKey);
+    bool allRecovered = true;
+    bool sawParity[2] = {false, false};
+    for (int i = 0; i < 20; i++)
+    {
+        string signedMessage = "challenge " + to_string(i);
+        optional<string> maybeSig = signMessage(signedMessage, privKey);
+        if (!maybeSig)
+        {
+            allRecovered = false;
+            continue;
+        }
+        bool odd = maybeSig->substr(130) == "1c";
+        sawParity[odd] = true;
+        string zeroOneSig = maybeSig->substr(0, 130) + (odd ? "01" : "00");
+        allRecovered = allRecovered
+            && signedMsgToAddress(signedMessage, *maybeSig, &error) == maybeAddress
+            && signedMsgToAddress(signedMessage, zeroOneSig, &error) == maybeAddress;
+    }
+    makeSure("signatures recover with v as 0/1 and 27/28", maybeAddress && allRecovered && sawParity[0] && sawParity[1]);
+
+    string zero(64, '0');
+    string groupOrder = "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141";
+    string r = rs.substr(0, 64);
+    string s = rs.substr(64);
+    vector<pair<string, string>> badSigs = {
+        {"short", "0x" + rs},
+        {"long", "0x" + rs + "1c00"},
+        {"not hex", "0x" + rs.substr(0, 127) + "g1c"},
+        {"empty", ""},
+        {"v = 29", "0x" + rs + "1d"},
+        {"r of zero", "0x" + zero + s + "1c"},
+        {"s of zero", "0x" + r + zero + "1c"},
+        {"r of n", "0x" + groupOrder + s + "1c"},
+        {"s of n", "0x" + r + groupOrder + "1c"},
+        {"r above n", "0x" + string(64, 'f') + s + "1c"},
+        {"s above n", "0x" + r + string(64, 'f') + "1c"}
+    };
+    for (unsigned int i = 0; i < badSigs.size(); i++)
+    {
+        error = "";
+        makeSure("signature rejected: " + badSigs[i].first, !signedMsgToAddress(message, badSigs[i].second, &error) && error != "");
+    }
+}
+
+void testGatewayLetsGoOfBuiltUnit()
+{
+    Game game;
+    PlayerJoinedEvent("0x1111111111111111111111111111111111111111").execute(&game);
+    BalanceUpdateEvent(0, 1000000000, true).execute(&game);
+    game.startMatch();
+
+    boost::shared_ptr<Gateway> gateway(new Gateway(&game, game.getNextEntityRef(), 0, vector2f(0, 0)));
+    gateway->completeBuildingInstantly(&game.players[0].credit);
+    game.entities.push_back(gateway);
+    boost::shared_ptr<Fighter> fighter(new Fighter(&game, game.getNextEntityRef(), 0, vector2f(20, 0)));
+    fighter->completeBuildingInstantly(&game.players[0].credit);
+    game.entities.push_back(fighter);
+
+    // as if the fighter got finished while the gateway was still putting gold into it
+    gateway->maybeDepositingToEntity = fighter;
+    coinsInt creditBefore = game.players[0].credit.getInt();
+    game.iterate();
+    makeSure("gateway lets go of a unit that's already built", !gateway->maybeDepositingToEntity && game.players[0].credit.getInt() == creditBefore);
+}
+
+void packFramePacketForLog(vch *dest, FrameEventsPacket *fcp)
+{
+    vch body;
+    fcp->pack(&body);
+    packToVch(dest, "CQ", PACKET_FRAMECMDS_CHAR, (uint64_t)body.size());
+    dest->insert(dest->end(), body.begin(), body.end());
+}
+
+// Logs a checkpoint and the frames after it the way the server does, then recovers a new game from them.
+// The segment ends on a frame with a WithdrawCmd, whose payout the next frame would have made.
+void testWriteAheadLogRecovery()
+{
+    // the log and snapshot file live at fixed paths relative to the working directory
+    char tempDir[] = "/tmp/coinfight-test-XXXXXX";
+    if (!mkdtemp(tempDir) || chdir(tempDir) != 0)
+    {
+        makeSure("made a directory to recover in", false);
+        return;
+    }
+    boost::filesystem::create_directories(WAL_DIR);
+    boost::filesystem::create_directories(CONSUMED_DEPOSITS_DIR);
+    boost::filesystem::create_directories("./accounting/pending_deposits");
+    boost::filesystem::create_directories("./accounting/pending_withdrawals");
+
+    Game serverGame;
+    setupDeltaTestGame(&serverGame);
+    CmdSchedule serverCmdSchedule;
+    vector<WithdrawEvent> serverWithdrawEvents;
+    {
+        SnapshotFileWriter snapshotFileWriter(SNAPSHOT_FILE_PATH);
+        WriteAheadLogWriter writeAheadLogWriter(&snapshotFileWriter);
+        writeAheadLogWriter.startSegment(boost::shared_ptr<GameSnapshot>(new GameSnapshot(&serverGame)), {});
+
+        for (int i = 0; i <= 90; i++)
+        {
+            FrameEventsPacket fcp(serverGame.frame, {}, {});
+            if (i % 10 == 0)
+            {
+                boost::shared_ptr<Cmd> cmd(new MoveCmd({serverGame.entities.back()->ref}, vector2f(i * 11.1, -i * 7.3)));
+                fcp.scheduledCmds.push_back(ScheduledCmd(serverGame.frame + 3, boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, 1))));
+            }
+            // the last frame logged asks for a withdrawal that the next, never logged, would have paid out
+            if (i == 90)
+            {
+                boost::shared_ptr<Cmd> cmd(new WithdrawCmd(12345));
+                fcp.authdCmds.push_back(boost::shared_ptr<AuthdCmd>(new AuthdCmd(cmd, 0)));
+            }
+            serverCmdSchedule.addFromPacket(&fcp);
+
+            // empty frames during a match aren't logged
+            if (fcp.scheduledCmds.size() > 0 || fcp.authdCmds.size() > 0)
+            {
+                boost::shared_ptr<vch> framePacket(new vch);
+                packFramePacketForLog(framePacket.get(), &fcp);
+                writeAheadLogWriter.appendFrame(framePacket, {}, {});
+            }
+            serverWithdrawEvents.clear();
+            runFrameAsServer(&serverGame, &fcp, &serverCmdSchedule, &serverWithdrawEvents);
+        }
+    }
+
+    Game recoveredGame;
+    bool loaded = loadSnapshotFileIntoGame(SNAPSHOT_FILE_PATH, &recoveredGame);
+    CmdSchedule recoveredCmdSchedule;
+    vector<FrameEventsPacket> announcingFrames;
+    vector<WithdrawEvent> recoveredWithdrawEvents;
+    recoverFromWriteAheadLog(&recoveredGame, &recoveredCmdSchedule, &announcingFrames, &recoveredWithdrawEvents);
+
+    makeSure("recovered game comes back through the last logged frame",
+        loaded && recoveredGame.frame == serverGame.frame && GameSnapshot(&recoveredGame).hash == GameSnapshot(&serverGame).hash);
+    makeSure("withdrawal asked for on the last logged frame is still to be paid out",
+        serverWithdrawEvents.size() == 1 && recoveredWithdrawEvents.size() == 1
+        && recoveredWithdrawEvents[0].playerId == 0 && recoveredWithdrawEvents[0].amountInCoins == 12345);
+
+    // the last move logged is scheduled for a few frames on
+    for (int i = 0; i < 10; i++)
+    {
+        FrameEventsPacket serverFrame(serverGame.frame, {}, {});
+        runFrameAsClient(&serverGame, &serverFrame, &serverCmdSchedule);
+        FrameEventsPacket recoveredFrame(recoveredGame.frame, {}, {});
+        runFrameAsClient(&recoveredGame, &recoveredFrame, &recoveredCmdSchedule);
+    }
+    makeSure("recovered game runs on to the same hash", GameSnapshot(&recoveredGame).hash == GameSnapshot(&serverGame).hash);
+
+    boost::filesystem::remove_all(tempDir);
+}
+
 int main()
 {
     cout << coinsIntToWeiDepositString(1000) << endl;
-    
-    return 0;
-}
\ No newline at end of file
+
+    testDeltaResync();
+    testFramePacketWithManyCmds();
+    testCompressionRoundTrips();
+    testJitterBufferAfterResync();
+    testSignatureRecovery();
+    testGatewayLetsGoOfBuiltUnit();
+    testWriteAheadLogRecovery();
+
+    return allPassed ? 0 : 1;
+}
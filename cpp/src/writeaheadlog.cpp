@@ -0,0 +1,561 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <set>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include "writeaheadlog.h"
+#include "vchpack.h"
+#include "config.h"
+
+using namespace std;
+
+// longest deposit file name or withdrawal address a frame record can carry
+const uint16_t WAL_MAX_STRING_SIZE = 255;
+
+string walSegmentPath(uint64_t segmentNumber)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%010lu.wal", segmentNumber);
+    return string(WAL_DIR) + name;
+}
+
+// the numbers of the segments in WAL_DIR, oldest first
+vector<uint64_t> listWalSegmentNumbers()
+{
+    vector<uint64_t> numbers;
+    boost::filesystem::path walDirPath(WAL_DIR);
+    if (!boost::filesystem::is_directory(walDirPath))
+        return numbers;
+
+    boost::filesystem::directory_iterator directoryEndIter;
+    for (boost::filesystem::directory_iterator dirIter(walDirPath); dirIter != directoryEndIter; dirIter++)
+    {
+        if (dirIter->path().extension() != ".wal")
+            continue;
+        string stem = dirIter->path().stem().string();
+        if (stem.empty() || stem.find_first_not_of("0123456789") != string::npos)
+            continue;
+        numbers.push_back(stoull(stem));
+    }
+    sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+bool walSegmentHeaderValid(const WalSegmentHeader &header)
+{
+    return memcmp(header.magic, WAL_SEGMENT_MAGIC, sizeof(header.magic)) == 0
+        && header.version == WAL_SEGMENT_VERSION
+        && header.byteOrderMark == WAL_SEGMENT_BYTE_ORDER_MARK;
+}
+
+bool readWalSegment(uint64_t segmentNumber, vch *dest)
+{
+    ifstream segmentFile(walSegmentPath(segmentNumber), ios::binary);
+    if (!segmentFile)
+        return false;
+    dest->assign(istreambuf_iterator<char>(segmentFile), istreambuf_iterator<char>());
+    return dest->size() >= sizeof(WalSegmentHeader);
+}
+
+// Reads the record at *offset into kind and body, moving *offset past it.
+// Returns false at the end of the segment, or where a record is cut short or doesn't match its hash.
+bool readWalRecord(const vch &segment, uint64_t *offset, unsigned char *kind, vch *body)
+{
+    const uint64_t recordHeaderSize = 1 + 8 + 8;
+    if (*offset + recordHeaderSize > segment.size())
+        return false;
+
+    uint64_t bodySize, bodyHash;
+    vch recordHeader(segment.begin() + *offset, segment.begin() + *offset + recordHeaderSize);
+    unpackFromIter(recordHeader.begin(), "CQQ", kind, &bodySize, &bodyHash);
+    uint64_t bodyStart = *offset + recordHeaderSize;
+    if (bodySize > segment.size() - bodyStart)
+        return false;
+
+    body->assign(segment.begin() + bodyStart, segment.begin() + bodyStart + bodySize);
+    if (hashVch(*body) != bodyHash)
+        return false;
+
+    *offset = bodyStart + bodySize;
+    return true;
+}
+
+// Unpacks the frame packet a record body leads with, leaving place just past it.
+FrameEventsPacket unpackFramePacketFromRecord(vchIter *place)
+{
+    unsigned char typechar;
+    uint64_t packetSize;
+    *place = unpackFromIter(*place, "CQ", &typechar, &packetSize);
+    if (typechar != PACKET_FRAMECMDS_CHAR)
+        throw runtime_error("Write-ahead log record doesn't hold a frame packet.");
+    return FrameEventsPacket(place);
+}
+
+void recoverFromWriteAheadLog(Game *game, CmdSchedule *cmdSchedule, vector<FrameEventsPacket> *announcingFramesDest, vector<WithdrawEvent> *pendingWithdrawEventsDest)
+{
+    vector<uint64_t> segmentNumbers = listWalSegmentNumbers();
+    boost::filesystem::path consumedDepositsDirPath(CONSUMED_DEPOSITS_DIR);
+
+    // the latest segment that follows on from the game as loaded
+    uint64_t gameHash = GameSnapshot(game).hash;
+    int startSegment = -1;
+    for (unsigned int i = 0; i < segmentNumbers.size(); i++)
+    {
+        ifstream segmentFile(walSegmentPath(segmentNumbers[i]), ios::binary);
+        WalSegmentHeader header;
+        if (segmentFile.read((char*)&header, sizeof(header))
+         && walSegmentHeaderValid(header)
+         && header.checkpointFrame == game->frame
+         && header.checkpointHash == gameHash)
+            startSegment = i;
+    }
+
+    if (startSegment == -1)
+    {
+        if (segmentNumbers.size() > 0)
+            cout << "No segment of the write-ahead log in " << WAL_DIR << " follows on from the loaded game; going on without it." << endl;
+        if (boost::filesystem::is_directory(consumedDepositsDirPath) && !boost::filesystem::is_empty(consumedDepositsDirPath))
+            cout << "Without the log there's no telling whether the deposit files in " << CONSUMED_DEPOSITS_DIR
+                 << " made it into the game, so they're left there; check them by hand." << endl;
+        return;
+    }
+
+    // what made it into the game: everything in segments before the one started from, and everything replayed
+    set<string> depositFilesInGame;
+    vector<pair<string, WithdrawalPayout>> withdrawalsInGame;
+    set<string> writtenWithdrawalIds;
+    vector<FrameEventsPacket> recentFrames;
+    uint64_t framesReplayed = 0;
+    bool replaying = true;
+
+    // empty frames during a match weren't logged
+    auto runEmptyFramesBefore = [&](uint64_t frame)
+    {
+        while (game->state == Game::Active && game->frame < frame)
+        {
+            FrameEventsPacket emptyFrame(game->frame, {}, {});
+            pendingWithdrawEventsDest->clear();
+            runFrameAsServer(game, &emptyFrame, cmdSchedule, pendingWithdrawEventsDest);
+            cmdSchedule->dropCmdsBefore(game->frame);
+        }
+    };
+
+    for (unsigned int i = 0; i < segmentNumbers.size(); i++)
+    {
+        vch segment;
+        WalSegmentHeader header;
+        if (!readWalSegment(segmentNumbers[i], &segment))
+        {
+            cout << "Couldn't read " << walSegmentPath(segmentNumbers[i]) << "." << endl;
+            if ((int)i >= startSegment)
+                replaying = false;
+            continue;
+        }
+        memcpy(&header, segment.data(), sizeof(header));
+
+        bool replayingSegment = (int)i >= startSegment && replaying;
+        if ((int)i > startSegment && replayingSegment)
+        {
+            runEmptyFramesBefore(header.checkpointFrame);
+            if (!walSegmentHeaderValid(header) || game->frame != header.checkpointFrame || GameSnapshot(game).hash != header.checkpointHash)
+            {
+                cout << "The replayed game at frame " << game->frame << " doesn't match the checkpoint "
+                     << walSegmentPath(segmentNumbers[i]) << " starts from; stopping the replay there." << endl;
+                replaying = replayingSegment = false;
+            }
+        }
+
+        uint64_t offset = sizeof(WalSegmentHeader);
+        uint64_t recordOffset = offset;
+        unsigned char kind;
+        vch body;
+        while (readWalRecord(segment, &offset, &kind, &body))
+        {
+            bool inGame = (int)i < startSegment || replayingSegment;
+            vchIter place = body.begin();
+            switch (kind)
+            {
+            case WAL_ANNOUNCE_RECORD_CHAR:
+                if (replayingSegment)
+                {
+                    FrameEventsPacket fcp = unpackFramePacketFromRecord(&place);
+                    cmdSchedule->addFromPacket(&fcp);
+                    if (recentFrames.empty() || fcp.frame > recentFrames.back().frame)
+                        recentFrames.push_back(fcp);
+                }
+                break;
+
+            case WAL_FRAME_RECORD_CHAR:
+            {
+                if (!inGame)
+                    break;
+                if (replayingSegment)
+                {
+                    FrameEventsPacket fcp = unpackFramePacketFromRecord(&place);
+                    cmdSchedule->addFromPacket(&fcp);
+                    runEmptyFramesBefore(fcp.frame);
+                    if (fcp.frame != game->frame)
+                    {
+                        cout << "The write-ahead log has frame " << fcp.frame << " where the replayed game is at " << game->frame
+                             << "; stopping the replay there." << endl;
+                        replaying = replayingSegment = false;
+                        break;
+                    }
+                    // a WithdrawCmd's payout is only made on the next frame, which may not have been committed
+                    pendingWithdrawEventsDest->clear();
+                    runFrameAsServer(game, &fcp, cmdSchedule, pendingWithdrawEventsDest);
+                    cmdSchedule->dropCmdsBefore(game->frame);
+                    recentFrames.push_back(fcp);
+                    framesReplayed++;
+                }
+                else
+                {
+                    unpackFramePacketFromRecord(&place);
+                }
+
+                uint16_t numDepositFiles, numWithdrawals;
+                place = unpackFromIter(place, "H", &numDepositFiles);
+                for (unsigned int j = 0; j < numDepositFiles; j++)
+                {
+                    string depositFile;
+                    place = unpackStringFromIter(place, WAL_MAX_STRING_SIZE, &depositFile);
+                    depositFilesInGame.insert(depositFile);
+                }
+                place = unpackFromIter(place, "H", &numWithdrawals);
+                for (unsigned int j = 0; j < numWithdrawals; j++)
+                {
+                    WithdrawalPayout withdrawal;
+                    place = unpackStringFromIter(place, WAL_MAX_STRING_SIZE, &withdrawal.address);
+                    place = unpackFromIter(place, "Q", &withdrawal.amount);
+                    string id = to_string(segmentNumbers[i]) + "-" + to_string(recordOffset) + "-" + to_string(j);
+                    withdrawalsInGame.push_back({id, withdrawal});
+                }
+                break;
+            }
+
+            case WAL_WITHDRAWAL_WRITTEN_RECORD_CHAR:
+            {
+                string id;
+                unpackStringFromIter(place, WAL_MAX_STRING_SIZE, &id);
+                writtenWithdrawalIds.insert(id);
+                break;
+            }
+
+            default:
+                cout << "Unrecognized record in " << walSegmentPath(segmentNumbers[i]) << " at offset " << recordOffset << "." << endl;
+                break;
+            }
+            recordOffset = offset;
+        }
+
+        // only the last segment should end partway through a record, where the server stopped
+        if (offset != segment.size() && replayingSegment && i + 1 < segmentNumbers.size())
+        {
+            cout << walSegmentPath(segmentNumbers[i]) << " ends short of a whole record at offset " << offset << "; stopping the replay there." << endl;
+            replaying = false;
+        }
+    }
+
+    cout << "Replayed " << framesReplayed << " frames from the write-ahead log, up to frame " << game->frame << "." << endl;
+
+    if (game->state == Game::Active)
+    {
+        for (unsigned int i = 0; i < recentFrames.size(); i++)
+        {
+            if (recentFrames[i].frame + CMD_DELAY_MAX_FRAMES >= game->frame)
+                announcingFramesDest->push_back(recentFrames[i]);
+        }
+    }
+
+    // A consumed deposit file the game doesn't have went with a frame that never got committed, so it's due again.
+    unsigned int depositFilesRemoved = 0, depositFilesReturned = 0;
+    if (boost::filesystem::is_directory(consumedDepositsDirPath))
+    {
+        boost::filesystem::directory_iterator directoryEndIter;
+        vector<boost::filesystem::path> consumedPaths;
+        for (boost::filesystem::directory_iterator dirIter(consumedDepositsDirPath); dirIter != directoryEndIter; dirIter++)
+            consumedPaths.push_back(dirIter->path());
+
+        for (unsigned int i = 0; i < consumedPaths.size(); i++)
+        {
+            string name = consumedPaths[i].filename().string();
+            if (depositFilesInGame.count(name))
+            {
+                boost::filesystem::remove(consumedPaths[i]);
+                depositFilesRemoved++;
+            }
+            else
+            {
+                boost::filesystem::rename(consumedPaths[i], "./accounting/pending_deposits/" + name);
+                depositFilesReturned++;
+            }
+        }
+    }
+    if (depositFilesRemoved + depositFilesReturned > 0)
+        cout << "Of the deposit files the server had taken up, " << depositFilesRemoved << " were in the recovered game and "
+             << depositFilesReturned << " were put back in pending_deposits." << endl;
+
+    for (unsigned int i = 0; i < withdrawalsInGame.size(); i++)
+    {
+        string id = withdrawalsInGame[i].first;
+        if (writtenWithdrawalIds.count(id) || boost::filesystem::exists("./accounting/pending_withdrawals/" + id))
+            continue;
+        cout << "Withdrawal " << id << " of " << withdrawalsInGame[i].second.amount << " coins to " << withdrawalsInGame[i].second.address
+             << " is in the recovered game, but there's no sign it was written out; it may already have been paid, so check it by hand." << endl;
+    }
+}
+
+bool writeWithdrawalFile(string id, WithdrawalPayout withdrawal)
+{
+    string writeData = withdrawal.address + " " + coinsIntToWeiDepositString(withdrawal.amount);
+    string tempPath = "./accounting/" + id + ".tmp";
+    string path = "./accounting/pending_withdrawals/" + id;
+
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = writeAll(fd, writeData.data(), writeData.size()) && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return fsyncParentDir(path);
+}
+
+bool WriteAheadLogWriter::writeRecord(unsigned char kind, const vch &body)
+{
+    vch recordHeader;
+    packToVch(&recordHeader, "C", kind);
+    packToVch(&recordHeader, "Q", (uint64_t)(body.size()));
+    packToVch(&recordHeader, "Q", hashVch(body));
+
+    if (!writeAll(segmentFd, recordHeader.data(), recordHeader.size())
+     || !writeAll(segmentFd, body.data(), body.size()))
+        return false;
+    segmentSize += recordHeader.size() + body.size();
+    return true;
+}
+
+bool WriteAheadLogWriter::openSegment(const QueuedItem &item)
+{
+    if (segmentFd >= 0)
+    {
+        // the old segment has to be all on disk before anything goes after it
+        bool ok = fdatasync(segmentFd) == 0;
+        close(segmentFd);
+        segmentFd = -1;
+        if (!ok)
+            return false;
+    }
+
+    segmentNumber++;
+    string path = walSegmentPath(segmentNumber);
+    segmentFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (segmentFd < 0)
+        return false;
+
+    WalSegmentHeader header;
+    memcpy(header.magic, WAL_SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = WAL_SEGMENT_VERSION;
+    header.byteOrderMark = WAL_SEGMENT_BYTE_ORDER_MARK;
+    header.checkpointFrame = item.checkpointOrNull->frame;
+    header.checkpointHash = item.checkpointOrNull->hash;
+    if (!writeAll(segmentFd, &header, sizeof(header)))
+        return false;
+    segmentSize = sizeof(header);
+    segments.push_back({segmentNumber, header.checkpointHash});
+
+    for (unsigned int i = 0; i < item.announcingPackets.size(); i++)
+    {
+        if (!writeRecord(WAL_ANNOUNCE_RECORD_CHAR, *item.announcingPackets[i]))
+            return false;
+    }
+    return fsyncParentDir(path);
+}
+
+bool WriteAheadLogWriter::commit(const deque<QueuedItem> &items)
+{
+    vector<pair<string, WithdrawalPayout>> withdrawalsToWrite;
+    vector<string> depositFilesToRemove;
+    boost::shared_ptr<GameSnapshot> checkpointOrNull;
+
+    if (segmentFd >= 0)
+    {
+        for (unsigned int i = 0; i < writtenWithdrawalIds.size(); i++)
+        {
+            vch body;
+            packStringToVch(&body, writtenWithdrawalIds[i]);
+            if (!writeRecord(WAL_WITHDRAWAL_WRITTEN_RECORD_CHAR, body))
+                return false;
+        }
+        writtenWithdrawalIds.clear();
+    }
+
+    for (unsigned int i = 0; i < items.size(); i++)
+    {
+        if (items[i].checkpointOrNull)
+        {
+            if (!openSegment(items[i]))
+                return false;
+            checkpointOrNull = items[i].checkpointOrNull;
+            continue;
+        }
+        if (segmentFd < 0)
+            return false;
+
+        vch body(*items[i].framePacketOrNull);
+        packToVch(&body, "H", (uint16_t)(items[i].depositFiles.size()));
+        for (unsigned int j = 0; j < items[i].depositFiles.size(); j++)
+            packStringToVch(&body, items[i].depositFiles[j]);
+        packToVch(&body, "H", (uint16_t)(items[i].withdrawals.size()));
+        for (unsigned int j = 0; j < items[i].withdrawals.size(); j++)
+        {
+            packStringToVch(&body, items[i].withdrawals[j].address);
+            packToVch(&body, "Q", items[i].withdrawals[j].amount);
+
+            string id = to_string(segmentNumber) + "-" + to_string(segmentSize) + "-" + to_string(j);
+            withdrawalsToWrite.push_back({id, items[i].withdrawals[j]});
+        }
+        depositFilesToRemove.insert(depositFilesToRemove.end(), items[i].depositFiles.begin(), items[i].depositFiles.end());
+
+        if (!writeRecord(WAL_FRAME_RECORD_CHAR, body))
+            return false;
+    }
+
+    if (segmentFd < 0 || fdatasync(segmentFd) != 0)
+        return false;
+
+    // committed; now what depended on it can go ahead
+    for (unsigned int i = 0; i < depositFilesToRemove.size(); i++)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(string(CONSUMED_DEPOSITS_DIR) + depositFilesToRemove[i], ec);
+    }
+    for (unsigned int i = 0; i < withdrawalsToWrite.size(); i++)
+    {
+        if (writeWithdrawalFile(withdrawalsToWrite[i].first, withdrawalsToWrite[i].second))
+            writtenWithdrawalIds.push_back(withdrawalsToWrite[i].first);
+        else
+            cout << "Couldn't write out withdrawal " << withdrawalsToWrite[i].first << "; it'll be reported on the next restart." << endl;
+    }
+    if (checkpointOrNull)
+        snapshotFileWriter->writeAsync(checkpointOrNull);
+
+    if (optional<uint64_t> maybeWrittenHash = snapshotFileWriter->getMaybeLastWrittenHash())
+        dropSegmentsBefore(*maybeWrittenHash);
+
+    return true;
+}
+
+void WriteAheadLogWriter::dropSegmentsBefore(uint64_t checkpointHash)
+{
+    int latestMatching = -1;
+    for (unsigned int i = 0; i < segments.size(); i++)
+    {
+        if (segments[i].second == checkpointHash)
+            latestMatching = i;
+    }
+    if (latestMatching <= 0)
+        return;
+
+    for (int i = 0; i < latestMatching; i++)
+        unlink(walSegmentPath(segments[i].first).c_str());
+    segments.erase(segments.begin(), segments.begin() + latestMatching);
+}
+
+void WriteAheadLogWriter::writerLoop()
+{
+    chrono::steady_clock::time_point lastCommit = chrono::steady_clock::now();
+    while (true)
+    {
+        deque<QueuedItem> items;
+        {
+            unique_lock<mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || queuedItems.size() > 0; });
+            // let a few frames gather, so they share one fdatasync
+            cv.wait_until(lock, lastCommit + WAL_COMMIT_INTERVAL, [this] { return stopping; });
+
+            if (queuedItems.size() == 0)
+                return;
+
+            items.swap(queuedItems);
+        }
+        lastCommit = chrono::steady_clock::now();
+
+        if (failed)
+            continue;
+        if (!commit(items))
+        {
+            cout << "Couldn't commit to the write-ahead log in " << WAL_DIR << "; the game can't safely go on." << endl;
+            failed = true;
+        }
+    }
+}
+
+void WriteAheadLogWriter::queueItem(QueuedItem item)
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        queuedItems.push_back(item);
+    }
+    cv.notify_one();
+}
+
+void WriteAheadLogWriter::appendFrame(boost::shared_ptr<const vch> framePacket, vector<string> depositFiles, vector<WithdrawalPayout> withdrawals)
+{
+    QueuedItem item;
+    item.framePacketOrNull = framePacket;
+    item.depositFiles = depositFiles;
+    item.withdrawals = withdrawals;
+    queueItem(item);
+}
+
+void WriteAheadLogWriter::startSegment(boost::shared_ptr<GameSnapshot> checkpoint, vector<boost::shared_ptr<const vch>> announcingPackets)
+{
+    QueuedItem item;
+    item.checkpointOrNull = checkpoint;
+    item.announcingPackets = announcingPackets;
+    queueItem(item);
+}
+
+bool WriteAheadLogWriter::hasFailed()
+{
+    return failed;
+}
+
+WriteAheadLogWriter::WriteAheadLogWriter(SnapshotFileWriter *snapshotFileWriter)
+    : snapshotFileWriter(snapshotFileWriter), segmentNumber(0), segmentFd(-1), segmentSize(0), failed(false), stopping(false)
+{
+    vector<uint64_t> segmentNumbers = listWalSegmentNumbers();
+    for (unsigned int i = 0; i < segmentNumbers.size(); i++)
+    {
+        ifstream segmentFile(walSegmentPath(segmentNumbers[i]), ios::binary);
+        WalSegmentHeader header;
+        if (segmentFile.read((char*)&header, sizeof(header)) && walSegmentHeaderValid(header))
+            segments.push_back({segmentNumbers[i], header.checkpointHash});
+        else
+            segments.push_back({segmentNumbers[i], 0});
+        segmentNumber = segmentNumbers[i];
+    }
+
+    writerThread = thread(&WriteAheadLogWriter::writerLoop, this);
+}
+
+WriteAheadLogWriter::~WriteAheadLogWriter()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_one();
+    writerThread.join();
+
+    if (segmentFd >= 0)
+        close(segmentFd);
+}
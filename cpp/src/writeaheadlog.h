@@ -0,0 +1,126 @@
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+#include "common.h"
+#include "coins.h"
+#include "engine.h"
+#include "packets.h"
+#include "snapshots.h"
+#include "snapshotfile.h"
+
+#ifndef WRITEAHEADLOG_H
+#define WRITEAHEADLOG_H
+
+using namespace std;
+
+// Everything the server has run since its last checkpoint (the snapshot file), so that a crash mid-match
+// loses nothing that was committed: on restart the checkpoint is loaded and the frames after it are run again.
+// That only comes out the same because the game is deterministic and packs losslessly.
+//
+// The log is a series of segments, WAL_DIR/<number>.wal, a new one begun at each checkpoint:
+//   WalSegmentHeader, naming the checkpoint (the game at the start of a frame) that the segment follows on from
+//   then records, each a kind char, a "Q" body size and a "Q" hashVch of the body, then the body:
+//     WAL_ANNOUNCE_RECORD_CHAR  a frame packet from before the checkpoint, only for the cmds it scheduled past it
+//     WAL_FRAME_RECORD_CHAR     a frame packet, as sent to clients (empty frames during a match are left out),
+//                               then "H" and the names of the deposit files its events came from,
+//                               then "H" and the withdrawals its events paid out, each an address and a "Q" amount
+//     WAL_WITHDRAWAL_WRITTEN_RECORD_CHAR  the id of a withdrawal since written out to accounting/pending_withdrawals
+// A withdrawal's id is "<segment number>-<offset of its frame record>-<index within it>".
+// A record that's cut short or doesn't match its hash ends the log; nothing after it was committed.
+//
+// Frames are committed in groups, with one fdatasync every WAL_COMMIT_INTERVAL or so, on the writer's own thread;
+// the tick never waits on the disk. Clients may see a frame before it's committed, so a crash can undo the last few,
+// but nothing that reaches outside the game happens until its frame is committed:
+//   a deposit file waits in CONSUMED_DEPOSITS_DIR, and a withdrawal isn't written out, until then,
+//   and a checkpoint isn't handed to the SnapshotFileWriter until everything before it is.
+struct WalSegmentHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint64_t checkpointFrame;
+    uint64_t checkpointHash;
+};
+
+const char WAL_SEGMENT_MAGIC[8] = {'C', 'F', 'W', 'A', 'L', 0, 0, 0};
+const uint32_t WAL_SEGMENT_VERSION = 2;
+const uint32_t WAL_SEGMENT_BYTE_ORDER_MARK = 0x01020304;
+
+const unsigned char WAL_ANNOUNCE_RECORD_CHAR = 1;
+const unsigned char WAL_FRAME_RECORD_CHAR = 2;
+const unsigned char WAL_WITHDRAWAL_WRITTEN_RECORD_CHAR = 3;
+
+struct WithdrawalPayout
+{
+    string address;
+    coinsInt amount;
+};
+
+// Brings game, just loaded from the checkpoint (or new, if there wasn't one), up through the last frame committed to the log,
+// running frames as fast as they'll go. cmdSchedule is left holding any cmds those frames scheduled for later,
+// and announcingFramesDest the packets of the last CMD_DELAY_MAX_FRAMES frames, which announced them.
+// pendingWithdrawEventsDest gets the withdrawals the last of those frames asked for, which the next frame pays out.
+// Then settles the accounting files that were waiting on the log: consumed deposit files the recovered game has are removed
+// and the rest put back in pending_deposits, and any recovered withdrawal that may not have been written out is reported.
+void recoverFromWriteAheadLog(Game *game, CmdSchedule *cmdSchedule, vector<FrameEventsPacket> *announcingFramesDest, vector<WithdrawEvent> *pendingWithdrawEventsDest);
+
+class WriteAheadLogWriter
+{
+    SnapshotFileWriter *snapshotFileWriter;
+
+    uint64_t segmentNumber;
+    int segmentFd;
+    uint64_t segmentSize;
+    // (number, checkpoint hash) of each segment still on disk, oldest first
+    vector<pair<uint64_t, uint64_t>> segments;
+    atomic<bool> failed;
+    // ids of withdrawals written out since the last commit, to be marked as such in the next
+    vector<string> writtenWithdrawalIds;
+
+    // a frame, or the start of a segment if checkpointOrNull is set
+    struct QueuedItem
+    {
+        boost::shared_ptr<const vch> framePacketOrNull;
+        vector<string> depositFiles;
+        vector<WithdrawalPayout> withdrawals;
+
+        boost::shared_ptr<GameSnapshot> checkpointOrNull;
+        vector<boost::shared_ptr<const vch>> announcingPackets;
+    };
+
+    thread writerThread;
+    mutex mtx;
+    condition_variable cv;
+    deque<QueuedItem> queuedItems;
+    bool stopping;
+
+    bool writeRecord(unsigned char kind, const vch &body);
+    bool openSegment(const QueuedItem &item);
+    bool commit(const deque<QueuedItem> &items);
+    void dropSegmentsBefore(uint64_t checkpointHash);
+    void writerLoop();
+    void queueItem(QueuedItem item);
+public:
+    // framePacket is exactly as packed for clients. The deposit files should already be in CONSUMED_DEPOSITS_DIR;
+    // they're removed, and the withdrawals written out to accounting/pending_withdrawals, once the frame is committed.
+    void appendFrame(boost::shared_ptr<const vch> framePacket, vector<string> depositFiles, vector<WithdrawalPayout> withdrawals);
+    // Starts a new segment from checkpoint, the game as it stands at the start of this frame (before anything's appended for it),
+    // beginning with announcingPackets. The checkpoint goes to the SnapshotFileWriter once everything before it is committed,
+    // and segments from before the last checkpoint it wrote are removed.
+    void startSegment(boost::shared_ptr<GameSnapshot> checkpoint, vector<boost::shared_ptr<const vch>> announcingPackets);
+
+    // if so, nothing more is being committed, and the game shouldn't go on
+    bool hasFailed();
+
+    // numbers its segments on from any already in WAL_DIR, leaving those to be removed once they're no longer needed
+    WriteAheadLogWriter(SnapshotFileWriter *snapshotFileWriter);
+    // commits anything still queued first
+    ~WriteAheadLogWriter();
+};
+
+#endif // WRITEAHEADLOG_H